@@ -0,0 +1,34 @@
+#include "BurstModel.h"
+
+namespace {
+
+const double minFlow = 0.3; // g/s, below that the dose never got going and says nothing about a burst
+const uint32_t averageBursts = 4; // bursts the dead time is averaged over once it has seen that many
+
+}
+
+BurstModel::BurstModel(uint32_t deadMs, uint32_t minMs, uint32_t maxMs) :
+    dead(deadMs), minMs(minMs), maxMs(maxMs), bursts(0) {
+}
+
+uint32_t BurstModel::burstMs(Grams missing, Grams flow) const {
+  double gramsPerMs = (flow.toDouble() > minFlow ? flow.toDouble() : minFlow) / 1000;
+  double ms = dead + missing.toDouble() / gramsPerMs;
+  return ms < minMs ? minMs : ms > maxMs ? maxMs : (uint32_t)ms;
+}
+
+void BurstModel::delivered(uint32_t ms, Grams grams, Grams flow) {
+  if (flow.toDouble() < minFlow || grams.toDouble() <= 0) {
+    return; // nothing landed, the motor may not have started at all
+  }
+  double measured = ms - grams.toDouble() / (flow.toDouble() / 1000);
+  if (measured < 0) {
+    measured = 0;
+  }
+  if (measured > maxMs) {
+    measured = maxMs;
+  }
+  // the prior counts as one burst, then a running average that follows wear
+  bursts++;
+  dead += (measured - dead) / (bursts < averageBursts ? bursts + 1 : averageBursts);
+}
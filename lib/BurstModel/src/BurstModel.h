@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include <FixedPoint.h>
+
+// Sizes the short grinder runs that top up a dose stopped short of its target.
+//
+// A burst of ms milliseconds delivers about flow * (ms - deadMs): the motor
+// spins up and down, so the start of every burst is partly lost, and the flow
+// is what the dose itself ran at. The dead time is learned from the grams each
+// burst delivered, so burst yield carries over between beans and flow rates.
+class BurstModel {
+public:
+	typedef Fixed<16> Grams; // also g/s for flow rates
+
+	BurstModel(uint32_t deadMs, uint32_t minMs, uint32_t maxMs);
+
+	uint32_t burstMs(Grams missing, Grams flow) const; // how long to run for missing grams
+	void delivered(uint32_t ms, Grams grams, Grams flow); // what a burst of ms delivered
+
+	uint32_t deadMs() const { return (uint32_t)dead; }
+
+private:
+	double dead;
+	uint32_t minMs;
+	uint32_t maxMs;
+	uint32_t bursts; // learned from so far
+};
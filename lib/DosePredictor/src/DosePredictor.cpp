@@ -0,0 +1,174 @@
+#include "DosePredictor.h"
+#include <math.h>
+
+namespace {
+
+const double initialCovariance[2] = {0.25, 0.04}; // prior variance of inFlight (g^2) and latency (s^2)
+const double driftVariance[2] = {4e-4, 2.5e-5}; // how far inFlight (g^2) and latency (s^2) may wander per dose
+const double overshootVariance = 0.0025; // g^2, scatter of the settled weight around the model
+
+}
+
+DosePredictor::DosePredictor(double latency, double inFlight) {
+  setModel(latency, inFlight);
+  reset();
+}
+
+void DosePredictor::setModel(double latency, double inFlight) {
+  model[0] = inFlight;
+  model[1] = latency;
+  covariance[0][0] = initialCovariance[0];
+  covariance[1][1] = initialCovariance[1];
+  covariance[0][1] = covariance[1][0] = 0;
+  modelInFlight = Grams(inFlight);
+  modelLatency = Grams(latency);
+}
+
+void DosePredictor::setModel(const Model &learned) {
+  model[0] = learned.inFlight;
+  model[1] = learned.latency;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      covariance[i][j] = learned.covariance[i][j];
+    }
+  }
+  modelInFlight = Grams(model[0]);
+  modelLatency = Grams(model[1]);
+}
+
+DosePredictor::Model DosePredictor::learned() const {
+  return {model[0], model[1], {{covariance[0][0], covariance[0][1]}, {covariance[1][0], covariance[1][1]}}};
+}
+
+void DosePredictor::reset() {
+  head = 0;
+  count = 0;
+  flow = 0;
+  intercept = 0;
+  fitSamples = 0;
+  hasStop = false;
+}
+
+void DosePredictor::addSample(int64_t timestampMs, Grams weight) {
+  head = (head + 1) % maxSamples;
+  timestamps[head] = timestampMs;
+  weights[head] = weight;
+  if (count < maxSamples) {
+    count++;
+  }
+  fit();
+}
+
+void DosePredictor::fit() {
+  // least squares line through the recent samples, in ms and raw grams relative
+  // to the newest sample so the sums stay small
+  int64_t sumT = 0, sumW = 0, sumTT = 0, sumTW = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t index = (head + maxSamples - i) % maxSamples;
+    int64_t t = timestamps[index] - timestamps[head];
+    if (t < -flowWindowMs) {
+      break;
+    }
+    int64_t w = weights[index].raw() - weights[head].raw();
+    sumT += t;
+    sumW += w;
+    sumTT += t * t;
+    sumTW += t * w;
+    n++;
+  }
+
+  fitSamples = n;
+  int64_t denominator = (int64_t)n * sumTT - sumT * sumT;
+  if (n < 3 || denominator <= 0) {
+    flow = 0;
+    intercept = weights[head];
+    return;
+  }
+  flow = Grams::fromRaw((int32_t)(((int64_t)n * sumTW - sumT * sumW) * 1000 / denominator));
+  intercept = weights[head] + Grams::fromRaw((int32_t)((sumW - (int64_t)flow.raw() * sumT / 1000) / (int64_t)n));
+}
+
+DosePredictor::Grams DosePredictor::flowOver(int64_t ms) const {
+  return Grams::fromRaw((int32_t)((int64_t)flow.raw() * ms / 1000));
+}
+
+DosePredictor::Grams DosePredictor::overshoot() const {
+  return modelInFlight + flow * modelLatency;
+}
+
+bool DosePredictor::ready() const {
+  return fitSamples >= 3 && flow >= minFlowRate;
+}
+
+DosePredictor::Grams DosePredictor::predictFinal(int64_t stopMs) const {
+  return intercept + flowOver(stopMs - timestamps[head]) + overshoot();
+}
+
+int64_t DosePredictor::stopAt(Grams target) const {
+  if (!ready()) {
+    return INT64_MAX;
+  }
+  int64_t remaining = (int64_t)(target - intercept - overshoot()).raw() * 1000;
+  int64_t ms = remaining / flow.raw();
+  if (remaining % flow.raw() != 0 && remaining < 0) {
+    ms--; // round towards the earlier stop
+  }
+  return timestamps[head] + ms;
+}
+
+void DosePredictor::stopped(int64_t stopMs) {
+  hasStop = ready();
+  stopFlow = flow;
+  stopWeight = intercept + flowOver(stopMs - timestamps[head]);
+}
+
+bool DosePredictor::learn(Grams finalWeight, double maxError) {
+  if (!hasStop) {
+    return false;
+  }
+  hasStop = false;
+
+  // once per dose, so plain double is fine here
+  double x[2] = {1, stopFlow.toDouble()};
+  double overshoot = (finalWeight - stopWeight).toDouble();
+  double error = overshoot - (model[0] + model[1] * x[1]);
+  if (fabs(error) > maxError) {
+    return false; // cup was touched or something else went wrong
+  }
+
+  // recursive least squares with the parameters as a random walk. Unlike exponential
+  // forgetting this keeps the covariance positive definite when doses at similar
+  // flow rates only excite one direction of the model.
+  double px[2] = {covariance[0][0] * x[0] + covariance[0][1] * x[1],
+                  covariance[1][0] * x[0] + covariance[1][1] * x[1]};
+  double denominator = overshootVariance + x[0] * px[0] + x[1] * px[1];
+  double gain[2] = {px[0] / denominator, px[1] / denominator};
+
+  model[0] += gain[0] * error;
+  model[1] += gain[1] * error;
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      covariance[i][j] -= gain[i] * px[j];
+    }
+    covariance[i][i] += driftVariance[i];
+  }
+  covariance[0][1] = covariance[1][0] = (covariance[0][1] + covariance[1][0]) / 2;
+
+  // the unexcited direction still grows by the drift every dose, bound it by the prior
+  for (int i = 0; i < 2; i++) {
+    if (covariance[i][i] > initialCovariance[i]) {
+      double scale = sqrt(initialCovariance[i] / covariance[i][i]);
+      covariance[i][0] *= scale;
+      covariance[0][i] *= scale;
+      covariance[i][1] *= scale;
+      covariance[1][i] *= scale;
+    }
+  }
+  if (model[1] < 0) {
+    model[1] = 0;
+  }
+  modelInFlight = Grams(model[0]);
+  modelLatency = Grams(model[1]);
+  return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <FixedPoint.h>
+
+// Predicts when to stop the grinder so the settled weight lands on target.
+//
+// The flow rate is a least squares fit over the last flowWindowMs of samples.
+// Stopping does not end the dose immediately: the relay, motor spin down, grounds
+// in the chute and in the air, and the filter lag all add mass after the stop
+// command. That overshoot is modelled as inFlight + flow * latency and both
+// parameters are learned from finished doses with recursive least squares.
+//
+// Everything done per sample is fixed point; only learn() works in double.
+class DosePredictor {
+public:
+	typedef Fixed<16> Grams; // also g/s for flow rates and s for the latency
+
+	// What learn() found so far, with how sure it is, to switch between grinders or beans
+	struct Model {
+		double inFlight; // grams
+		double latency; // seconds
+		double covariance[2][2];
+	};
+
+	DosePredictor(double latency, double inFlight);
+
+	static constexpr size_t maxSamples = 128; // covers flowWindowMs up to 150 SPS
+	static constexpr int64_t flowWindowMs = 800;
+	static constexpr Grams minFlowRate = Grams(0.3); // g/s, below that the grinder is still spinning up
+
+	void setModel(double latency, double inFlight); // with the prior uncertainty
+	void setModel(const Model &learned);
+	Model learned() const;
+	double latency() const { return model[1]; } // seconds
+	double inFlight() const { return model[0]; } // grams
+
+	void reset(); // call when a dose starts
+	void addSample(int64_t timestampMs, Grams weight);
+
+	bool ready() const;
+	Grams flowRate() const { return flow; } // g/s
+	Grams predictFinal(int64_t stopMs) const; // settled weight if the grinder stops at stopMs
+	int64_t stopAt(Grams target) const; // when to stop, INT64_MAX if no prediction can be made yet
+
+	void stopped(int64_t stopMs); // the grinder was told to stop
+	bool learn(Grams finalWeight, double maxError); // update the model once the dose settled
+
+private:
+	void fit();
+	Grams flowOver(int64_t ms) const; // grams flowing in ms at the fitted rate
+	Grams overshoot() const; // grams added after a stop at the fitted rate
+
+	int64_t timestamps[maxSamples];
+	Grams weights[maxSamples];
+	size_t head;
+	size_t count;
+
+	Grams flow;
+	Grams intercept; // fitted weight at timestamps[head]
+	size_t fitSamples;
+
+	bool hasStop;
+	Grams stopFlow;
+	Grams stopWeight;
+
+	double model[2]; // inFlight, latency
+	double covariance[2][2];
+	Grams modelInFlight; // fixed point copies of model
+	Grams modelLatency;
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <type_traits>
+
+// Signed fixed point number with F fraction bits stored in S.
+//
+// The ESP32 FPU only does single precision, so doubles are emulated in
+// software. Fixed keeps hot paths on integer instructions: products and
+// quotients go through int64_t. Integers convert implicitly. Doubles only
+// convert explicitly, which folds at compile time for constants. toFloat()
+// and toDouble() are meant for display and for code that runs rarely.
+template<int F, typename S = int32_t> class Fixed {
+public:
+	static_assert(std::is_integral<S>::value && std::is_signed<S>::value, "S must be a signed integer");
+	static_assert(F > 0 && F < (int)sizeof(S) * 8 - 1, "F leaves no integer bits");
+
+	typedef Fixed<F, int64_t> Wide; // for sums of many values
+	static constexpr int fractionBits = F;
+	static constexpr S one = (S)1 << F;
+
+	constexpr Fixed() : value(0) {}
+	constexpr Fixed(int integer) : value((S)integer * one) {}
+	constexpr explicit Fixed(double real) : value((S)(real * one + (real < 0 ? -0.5 : 0.5))) {}
+
+	// widening is implicit, narrowing explicit
+	template<typename O, typename std::enable_if<(sizeof(O) <= sizeof(S)), int>::type = 0>
+	constexpr Fixed(Fixed<F, O> other) : value((S)other.raw()) {}
+	template<typename O, typename std::enable_if<(sizeof(O) > sizeof(S)), int>::type = 0>
+	constexpr explicit Fixed(Fixed<F, O> other) : value((S)other.raw()) {}
+
+	static constexpr Fixed fromRaw(S raw) { Fixed result; result.value = raw; return result; }
+	constexpr S raw() const { return value; }
+
+	constexpr S round() const { return (value + (value < 0 ? -(one / 2) : one / 2)) / one; } // nearest integer
+	constexpr float toFloat() const { return (float)value / (float)one; }
+	constexpr double toDouble() const { return (double)value / (double)one; }
+
+	constexpr Fixed absolute() const { return fromRaw(value < 0 ? -value : value); }
+
+	constexpr Fixed operator-() const { return fromRaw(-value); }
+	Fixed &operator+=(Fixed other) { value += other.value; return *this; }
+	Fixed &operator-=(Fixed other) { value -= other.value; return *this; }
+
+	friend constexpr Fixed operator+(Fixed a, Fixed b) { return fromRaw(a.value + b.value); }
+	friend constexpr Fixed operator-(Fixed a, Fixed b) { return fromRaw(a.value - b.value); }
+	// the int64_t intermediate only holds products of 32 bit values, so these are not for Wide
+	friend constexpr Fixed operator*(Fixed a, Fixed b) {
+		static_assert(sizeof(S) <= 4, "Fixed * Fixed overflows with 64 bit storage");
+		return fromRaw((S)(((int64_t)a.value * b.value) >> F));
+	}
+	friend constexpr Fixed operator/(Fixed a, Fixed b) {
+		static_assert(sizeof(S) <= 4, "Fixed / Fixed overflows with 64 bit storage");
+		return fromRaw((S)(((int64_t)a.value * one) / b.value));
+	}
+	friend constexpr Fixed operator*(Fixed a, int64_t b) { return fromRaw((S)(a.value * b)); }
+	friend constexpr Fixed operator/(Fixed a, int64_t b) { return fromRaw((S)(a.value / b)); }
+
+	friend constexpr bool operator==(Fixed a, Fixed b) { return a.value == b.value; }
+	friend constexpr bool operator!=(Fixed a, Fixed b) { return a.value != b.value; }
+	friend constexpr bool operator<(Fixed a, Fixed b) { return a.value < b.value; }
+	friend constexpr bool operator<=(Fixed a, Fixed b) { return a.value <= b.value; }
+	friend constexpr bool operator>(Fixed a, Fixed b) { return a.value > b.value; }
+	friend constexpr bool operator>=(Fixed a, Fixed b) { return a.value >= b.value; }
+
+private:
+	S value;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// What the grinder does during a stage, and when the stage is over
+#define GRIND_RUN 1 // on until the stop predicted from weight and flow lands on the aim
+#define GRIND_SETTLE 2 // off until the weight settled
+#define GRIND_PAUSE 3 // off for limit ms
+#define GRIND_PULSE 4 // bursts for what the settled weight misses of the aim, until within tolerance or limit bursts
+
+#define GRIND_PROGRAM_STAGES 6
+
+struct GrindStage {
+	uint8_t action; // GRIND_*
+	int16_t aimPermille; // of the dose
+	int16_t aimOffsetCg; // added to that
+	uint16_t limit; // GRIND_PAUSE: ms, GRIND_PULSE: bursts
+};
+
+// A dose as a sequence of stages, run in order by the status machine. Programs
+// are plain data, usually constexpr tables; nothing is allocated to run them.
+struct GrindProgram {
+	const char *name;
+	uint8_t stageCount;
+	GrindStage stages[GRIND_PROGRAM_STAGES];
+
+	// where stage has to leave the dose, W is a Fixed
+	template<typename W> W aim(uint8_t stage, W dose) const {
+		const GrindStage &s = stages[stage];
+		return W(typename W::Wide(dose) * (int64_t)s.aimPermille / (int64_t)1000) + W(s.aimOffsetCg) / (int64_t)100;
+	}
+
+	// starts grinding and knows all its stages
+	constexpr bool valid() const {
+		if (stageCount == 0 || stageCount > GRIND_PROGRAM_STAGES || stages[0].action != GRIND_RUN) {
+			return false;
+		}
+		for (uint8_t i = 0; i < stageCount; i++) {
+			if (stages[i].action < GRIND_RUN || stages[i].action > GRIND_PULSE) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,94 @@
+#include "LatencyTrace.h"
+
+void LatencyTrace::clear() {
+  for (size_t i = 0; i < size; i++) {
+    events[i].used = 0;
+  }
+  next.store(0, std::memory_order_relaxed);
+}
+
+void LatencyTrace::dump(Print &out) const {
+  uint32_t end = next.load(std::memory_order_relaxed);
+  uint32_t start = end > size ? end - size : 0;
+
+  out.println("sample,stage,cycles");
+  for (uint32_t i = start; i < end; i++) {
+    const Event &event = events[i & (size - 1)];
+    if (event.used) {
+      out.printf("%u,%u,%u\n", (unsigned)event.sample, (unsigned)event.stage, (unsigned)event.cycles);
+    }
+  }
+}
+
+uint8_t LatencyTrace::bucketOf(uint32_t us) {
+  if (us < 4) {
+    return us;
+  }
+  uint8_t octave = 31 - __builtin_clz(us);
+  uint8_t quarter = (us >> (octave - 2)) & 3;
+  uint8_t bucket = (octave - 1) * 4 + quarter;
+  return bucket < histogramBuckets ? bucket : histogramBuckets - 1;
+}
+
+uint32_t LatencyTrace::bucketLimit(uint8_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  uint8_t octave = bucket / 4 + 1;
+  uint8_t quarter = bucket % 4;
+  return ((4u + quarter + 1) << (octave - 2)) - 1;
+}
+
+// Latency of the event at index since the start of its sample, false if the
+// start is no longer in the ring
+bool LatencyTrace::latencyOf(size_t index, uint32_t &us) const {
+  const Event &event = events[index & (size - 1)];
+  uint32_t end = next.load(std::memory_order_relaxed);
+  uint32_t oldest = end > size ? end - size : 0;
+
+  for (size_t back = 1; back <= searchBack && index >= oldest + back; back++) {
+    const Event &start = events[(index - back) & (size - 1)];
+    if (start.used && start.stage == 0 && start.sample == event.sample) {
+      us = (event.cycles - start.cycles) / ESP.getCpuFreqMHz();
+      return true;
+    }
+  }
+  return false;
+}
+
+void LatencyTrace::summarize(Print &out, const char *const stageNames[], uint8_t stages) const {
+  uint32_t end = next.load(std::memory_order_relaxed);
+  uint32_t start = end > size ? end - size : 0;
+  uint16_t histogram[histogramBuckets];
+
+  out.println("stage              count    p50 us    p99 us    max us");
+  for (uint8_t stage = 1; stage < stages && stage < maxStages; stage++) {
+    memset(histogram, 0, sizeof(histogram));
+    uint32_t count = 0;
+    uint32_t maxUs = 0;
+
+    for (uint32_t i = start; i < end; i++) {
+      const Event &event = events[i & (size - 1)];
+      uint32_t us;
+      if (event.used && event.stage == stage && latencyOf(i, us)) {
+        histogram[bucketOf(us)]++;
+        maxUs = max(maxUs, us);
+        count++;
+      }
+    }
+
+    // percentiles are reported as the upper limit of their bucket
+    uint32_t p50 = 0, p99 = 0, seen = 0;
+    for (uint8_t bucket = 0; bucket < histogramBuckets && count > 0; bucket++) {
+      if (seen < (count + 1) / 2 && seen + histogram[bucket] >= (count + 1) / 2) {
+        p50 = min(bucketLimit(bucket), maxUs);
+      }
+      if (seen < (count * 99 + 99) / 100 && seen + histogram[bucket] >= (count * 99 + 99) / 100) {
+        p99 = min(bucketLimit(bucket), maxUs);
+      }
+      seen += histogram[bucket];
+    }
+
+    out.printf("%-16s %7u %9u %9u %9u\n", stageNames[stage], (unsigned)count, (unsigned)p50, (unsigned)p99, (unsigned)maxUs);
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef LATENCY_TRACE_EVENTS
+#define LATENCY_TRACE_EVENTS 1024 // power of two, the native build keeps whole runs
+#endif
+
+// Records when each sample passes the stages of a pipeline, using the CPU cycle
+// counter, into a fixed ring of the most recent events.
+//
+// Stage 0 marks the start of a sample; the latency of every other stage is
+// measured from the stage 0 event with the same sample number. record() is
+// safe to call from tasks and ISRs. Cycle counters are per core, so all stages
+// of a sample should be recorded on the same core.
+class LatencyTrace {
+public:
+	static constexpr size_t size = LATENCY_TRACE_EVENTS; // events kept
+	static constexpr uint8_t maxStages = 8;
+
+	struct Event {
+		uint32_t cycles;
+		uint16_t sample;
+		uint8_t stage;
+		uint8_t used;
+	};
+
+	inline void record(uint8_t stage, uint16_t sample) {
+		uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+		Event &event = events[index & (size - 1)];
+		event.cycles = ESP.getCycleCount();
+		event.sample = sample;
+		event.stage = stage;
+		event.used = 1;
+	}
+
+	void clear();
+
+	// Prints one "sample,stage,cycles" line per event, oldest first
+	void dump(Print &out) const;
+
+	// Prints count, p50, p99 and max latency in us of every stage after the first
+	void summarize(Print &out, const char *const stageNames[], uint8_t stages) const;
+
+private:
+	static constexpr uint8_t histogramBuckets = 128; // four per octave of us
+	static constexpr size_t searchBack = 64; // events to look back for the start of a sample
+
+	static uint8_t bucketOf(uint32_t us);
+	static uint32_t bucketLimit(uint8_t bucket); // largest latency in us that falls in bucket
+
+	bool latencyOf(size_t index, uint32_t &us) const;
+
+	Event events[size] = {};
+	std::atomic<uint32_t> next{0};
+};
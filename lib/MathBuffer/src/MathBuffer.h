@@ -2,29 +2,163 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <Arduino.h>
+#include <Seqlock.h>
 #include <type_traits>
 
-template<typename T, size_t S> class MathBuffer {
+// Type used for running sums of T: T itself for floating point, int64_t for
+// integers and T::Wide for number classes that declare one (see Fixed)
+template<typename T, typename = void> struct MathBufferSum {
+	typedef typename std::conditional<std::is_floating_point<T>::value, T, int64_t>::type type;
+};
+template<typename T> struct MathBufferSum<T, std::void_t<typename T::Wide>> {
+	typedef typename T::Wide type;
+};
+
+// Ring of timestamped samples with O(1) sliding windows and time based queries.
+//
+// Values and timestamps are separate arrays. Timestamps are 32 bit ms offsets
+// from a base that moves forward every few weeks. Timestamps never go
+// backwards, so the samples since a cutoff are found by binary search, and the
+// queries over them are plain loops over at most two contiguous runs of values.
+// A query pays for the samples it covers, not for the size of the buffer.
+template<typename T, size_t S, size_t W = 4> class MathBuffer {
 public:
 	constexpr MathBuffer();
 
 	static constexpr size_t capacity = S;
+	static constexpr size_t maxWindows = W;
 
 	bool push(T value);
+	bool push(T value, int64_t timestampMs); // timestamps must not go backwards
+
+	// Sliding windows are kept up to date on every push and cover the samples
+	// taken at most durationMs before the newest one. Queries are O(1).
+	int registerWindow(int64_t durationMs);
+	size_t windowCount(int window) const;
+	T windowAverage(int window) const;
+	T windowMax(int window) const;
+	T windowMin(int window) const;
+
+	struct Sample {
+		T value;
+		int64_t timestampMs;
+	};
+
+	// Walks the ring from the newest sample back
+	class Iterator {
+	public:
+		Iterator(const MathBuffer *buffer, size_t index, size_t left) : buffer(buffer), index(index), left(left) {}
+		Sample operator*() const { return {buffer->buffer[index], buffer->timestampAt(index)}; }
+		Iterator &operator++() {
+			index = index == 0 ? S - 1 : index - 1;
+			left -= 1;
+			return *this;
+		}
+		bool operator!=(const Iterator &other) const { return left != other.left; }
+
+	private:
+		const MathBuffer *buffer;
+		size_t index;
+		size_t left;
+	};
 
-	void executeOnSamplesSince(int64_t cutoffMs, std::function<void (T, int64_t)> iterator);
-	size_t countSamplesSince(int64_t cutoffMs);
-	T averageSince(int64_t cutoffMs);
-	T maxSince(int64_t cutoffMs);
-	T minSince(int64_t cutoffMs);
-	T firstValueOlderThan(int64_t cutoffMs);
+	struct Range {
+		Iterator first;
+		Iterator begin() const { return first; }
+		Iterator end() const { return Iterator(nullptr, 0, 0); }
+	};
+
+	// for (auto sample : buffer.samplesSince(ms)), newest first
+	Range samples() const { return {Iterator(this, headIndex, count)}; }
+	Range samplesSince(int64_t cutoffMs) const { return {Iterator(this, headIndex, countSamplesSince(cutoffMs))}; }
+
+	// Calls visit(T value, int64_t timestampMs) for every sample taken at or after
+	// cutoffMs, newest first, and returns how many there were. Templated so the
+	// visitor is inlined, nothing is allocated.
+	template<typename F> size_t forEachSince(int64_t cutoffMs, F visit) const;
+
+	void executeOnSamplesSince(int64_t cutoffMs, std::function<void (T, int64_t)> iterator); // prefer forEachSince
+	size_t countSamplesSince(int64_t cutoffMs) const;
+	T averageSince(int64_t cutoffMs) const;
+	T maxSince(int64_t cutoffMs) const;
+	T minSince(int64_t cutoffMs) const;
+	T firstValueOlderThan(int64_t cutoffMs) const;
 
 private:
+	typedef typename MathBufferSum<T>::type SumType;
+
+	// smallest type that indexes the buffer, windows keep two queues of S of them
+	typedef typename std::conditional<(S <= UINT16_MAX), uint16_t, size_t>::type Slot;
+
+	// Ring of buffer slots used as a monotonic deque for window min/max
+	struct SlotQueue {
+		Slot slots[S];
+		size_t head;
+		size_t size;
+
+		size_t front() const { return slots[head]; }
+		size_t back() const { return slots[(head + size - 1) % S]; }
+		void pushBack(size_t slot) { slots[(head + size) % S] = (Slot)slot; size += 1; }
+		void popBack() { size -= 1; }
+		void popFront() { head = (head + 1) % S; size -= 1; }
+	};
+
+	struct Window {
+		int64_t durationMs;
+		size_t count;
+		SumType sum;
+		SlotQueue minQueue; // values increasing from front to back
+		SlotQueue maxQueue; // values decreasing from front to back
+	};
+
+	void evictOldest(Window &window);
+	void addNewest(Window &window);
+
+	int64_t timestampAt(size_t index) const { return baseMs + bufferOffset[index]; }
+	void rebase(int64_t timestampMs);
+	// visit(const T *values, size_t length) over the newest n samples, in at most two runs
+	template<typename F> void forRuns(size_t n, F visit) const;
+
 	T buffer[S];
-	int64_t bufferTimestamp[S];
+	uint32_t bufferOffset[S]; // timestamp - baseMs
+	int64_t baseMs;
 
 	size_t headIndex;
-  size_t count;
+	size_t count;
+
+	Window windows[W];
+	size_t windowsCount;
+};
+
+// MathBuffer written by one task and queried by others (see SequenceCounter).
+// push() and registerWindow() belong to the writer, the queries can be called
+// from any task and see the buffer between two pushes. read() runs several
+// queries against the same samples.
+template<typename T, size_t S, size_t W = 4> class SharedMathBuffer {
+public:
+	typedef MathBuffer<T, S, W> Buffer;
+
+	static constexpr size_t capacity = S;
+
+	bool push(T value, int64_t timestampMs);
+	int registerWindow(int64_t durationMs);
+
+	// query(const Buffer &) must only read, it is run again when a push overlapped it
+	template<typename F> auto read(F query) const -> decltype(query(std::declval<const Buffer &>()));
+
+	size_t windowCount(int window) const { return read([window](const Buffer &buffer) { return buffer.windowCount(window); }); }
+	T windowAverage(int window) const { return read([window](const Buffer &buffer) { return buffer.windowAverage(window); }); }
+	T windowMax(int window) const { return read([window](const Buffer &buffer) { return buffer.windowMax(window); }); }
+	T windowMin(int window) const { return read([window](const Buffer &buffer) { return buffer.windowMin(window); }); }
+	size_t countSamplesSince(int64_t cutoffMs) const { return read([cutoffMs](const Buffer &buffer) { return buffer.countSamplesSince(cutoffMs); }); }
+	T averageSince(int64_t cutoffMs) const { return read([cutoffMs](const Buffer &buffer) { return buffer.averageSince(cutoffMs); }); }
+	T maxSince(int64_t cutoffMs) const { return read([cutoffMs](const Buffer &buffer) { return buffer.maxSince(cutoffMs); }); }
+	T minSince(int64_t cutoffMs) const { return read([cutoffMs](const Buffer &buffer) { return buffer.minSince(cutoffMs); }); }
+	T firstValueOlderThan(int64_t cutoffMs) const { return read([cutoffMs](const Buffer &buffer) { return buffer.firstValueOlderThan(cutoffMs); }); }
+
+private:
+	Buffer buffer;
+	SequenceCounter counter;
 };
 
 #include "MathBuffer.tpp"
@@ -1,13 +1,31 @@
 #include "MathBuffer.h"
 
-template<typename T, size_t S>
-constexpr MathBuffer<T,S>::MathBuffer() :
-		headIndex(0), count(0) {
-  static_assert(std::is_arithmetic<T>::value, "T must be numeric");
+template<typename T, size_t S, size_t W>
+constexpr MathBuffer<T,S,W>::MathBuffer() :
+		baseMs(0), headIndex(0), count(0), windowsCount(0) {
+  static_assert(std::is_arithmetic<T>::value || std::is_class<T>::value, "T must be numeric");
 }
 
-template<typename T,size_t S>
-bool MathBuffer<T, S>::push(T value) {
+template<typename T,size_t S,size_t W>
+bool MathBuffer<T, S, W>::push(T value) {
+  return push(value, millis());
+}
+
+template<typename T,size_t S,size_t W>
+bool MathBuffer<T, S, W>::push(T value, int64_t timestampMs) {
+  if (count == 0) {
+    baseMs = timestampMs;
+  } else if (timestampMs - baseMs > (int64_t)UINT32_MAX) {
+    rebase(timestampMs);
+  }
+
+  // the slot about to be overwritten may still be the oldest sample of a window
+  for (size_t w = 0; w < windowsCount; w++) {
+    if (windows[w].count == S) {
+      evictOldest(windows[w]);
+    }
+  }
+
   headIndex += 1;
   if (headIndex >= S) {
     headIndex = 0;
@@ -17,94 +35,257 @@ bool MathBuffer<T, S>::push(T value) {
   }
 
   buffer[headIndex] = value;
-  bufferTimestamp[headIndex] = millis();
+  bufferOffset[headIndex] = (uint32_t)(timestampMs - baseMs);
+
+  for (size_t w = 0; w < windowsCount; w++) {
+    addNewest(windows[w]);
+  }
 
   return count == S; // Return true if buffer is full
 }
 
-template<typename T,size_t S>
-void MathBuffer<T, S>::executeOnSamplesSince(int64_t cutoffMs, std::function<void (T, int64_t)> iterator) {
-  for (int i = 0; i < count; i++) {
-    int index = (headIndex - i); // going backward to go from newest to oldest
-    if (index < 0) { // wrap around
-      index += S;
-    }
-    if (bufferTimestamp[index] < cutoffMs) {
-      return;
-    }
-    iterator(buffer[index], bufferTimestamp[index]);
+template<typename T,size_t S,size_t W>
+void MathBuffer<T, S, W>::rebase(int64_t timestampMs) {
+  // every 24 days or so: move the base up to keep the newest samples in range,
+  // anything older than that saturates at the new base, far outside any window
+  int64_t shift = timestampMs - baseMs - UINT32_MAX / 2;
+  for (size_t i = 0; i < S; i++) {
+    bufferOffset[i] = bufferOffset[i] > shift ? (uint32_t)(bufferOffset[i] - shift) : 0;
   }
+  baseMs += shift;
 }
 
-template<typename T,size_t S>
-size_t MathBuffer<T, S>::countSamplesSince(int64_t cutoffMs) {
-  for (int i = 0; i < count; i++) {
-    int index = (headIndex - i); // going backward to go from newest to oldest
-    if (index < 0) { // wrap around
-      index += S;
-    }
-    if (bufferTimestamp[index] < cutoffMs) {
-      return i;
-    }
+template<typename T,size_t S,size_t W>
+void MathBuffer<T, S, W>::evictOldest(Window &window) {
+  size_t oldest = (headIndex + S + 1 - window.count) % S;
+
+  window.sum -= buffer[oldest];
+  window.count -= 1;
+  if (window.minQueue.size > 0 && window.minQueue.front() == oldest) {
+    window.minQueue.popFront();
+  }
+  if (window.maxQueue.size > 0 && window.maxQueue.front() == oldest) {
+    window.maxQueue.popFront();
+  }
+}
+
+template<typename T,size_t S,size_t W>
+void MathBuffer<T, S, W>::addNewest(Window &window) {
+  T value = buffer[headIndex];
+
+  // restart the running sum whenever the window is empty so rounding errors can't pile up
+  window.sum = window.count == 0 ? (SumType)value : window.sum + (SumType)value;
+  window.count += 1;
+
+  while (window.minQueue.size > 0 && buffer[window.minQueue.back()] >= value) {
+    window.minQueue.popBack();
+  }
+  window.minQueue.pushBack(headIndex);
+
+  while (window.maxQueue.size > 0 && buffer[window.maxQueue.back()] <= value) {
+    window.maxQueue.popBack();
   }
+  window.maxQueue.pushBack(headIndex);
 
-  return count;
+  int64_t cutoffOffset = (int64_t)bufferOffset[headIndex] - window.durationMs;
+  while ((int64_t)bufferOffset[(headIndex + S + 1 - window.count) % S] < cutoffOffset) {
+    evictOldest(window);
+  }
 }
 
+template<typename T,size_t S,size_t W>
+int MathBuffer<T, S, W>::registerWindow(int64_t durationMs) {
+  if (windowsCount >= W) {
+    return -1;
+  }
 
-template<typename T,size_t S>
-T MathBuffer<T, S>::averageSince(int64_t cutoffMs) {
-  size_t sampleCount = countSamplesSince(cutoffMs);
+  Window &window = windows[windowsCount];
+  window.durationMs = durationMs;
+  window.count = 0;
+  window.sum = 0;
+  window.minQueue.head = window.minQueue.size = 0;
+  window.maxQueue.head = window.maxQueue.size = 0;
 
-  T average = 0;
-  executeOnSamplesSince(cutoffMs, [&average, &sampleCount](T value, int64_t ms) {
-    average += value / sampleCount;
-  });
+  // seed the window with the samples already in the buffer, oldest first
+  size_t newestIndex = headIndex;
+  for (size_t i = count; i > 0; i--) {
+    headIndex = (newestIndex + S + 1 - i) % S;
+    addNewest(window);
+  }
+  headIndex = newestIndex;
 
-  return average;
+  return windowsCount++;
 }
 
-template<typename T,size_t S>
-T MathBuffer<T, S>::maxSince(int64_t cutoffMs) {
-  T max = 0;
-  bool isFirst = true;
+template<typename T,size_t S,size_t W>
+size_t MathBuffer<T, S, W>::windowCount(int window) const {
+  return windows[window].count;
+}
+
+// Queries read count and headIndex once: under SharedMathBuffer a query that
+// overlaps a push gets thrown away, but it must not divide by zero or leave the
+// buffer before that.
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::windowAverage(int window) const {
+  size_t n = windows[window].count;
+  if (n == 0) {
+    return 0;
+  }
+  return (T)(windows[window].sum / (int64_t)n);
+}
 
-  executeOnSamplesSince(cutoffMs, [&max, &isFirst](T value, int64_t ms) {
-    if (isFirst || value > max) {
-      max = value;
-      isFirst = false;
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::windowMax(int window) const {
+  if (windows[window].maxQueue.size == 0) {
+    return 0;
+  }
+  return buffer[windows[window].maxQueue.front()];
+}
+
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::windowMin(int window) const {
+  if (windows[window].minQueue.size == 0) {
+    return 0;
+  }
+  return buffer[windows[window].minQueue.front()];
+}
+
+template<typename T,size_t S,size_t W>
+size_t MathBuffer<T, S, W>::countSamplesSince(int64_t cutoffMs) const {
+  size_t n = count;
+  int64_t base = baseMs;
+  if (n == 0 || cutoffMs <= base) {
+    return n;
+  }
+  if (cutoffMs - base > (int64_t)UINT32_MAX) {
+    return 0;
+  }
+  uint32_t cutoffOffset = (uint32_t)(cutoffMs - base);
+
+  // binary search for the oldest sample at or after the cutoff, in ring order
+  size_t oldest = (headIndex + S + 1 - n) % S;
+  size_t low = 0, high = n;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    size_t index = oldest + middle < S ? oldest + middle : oldest + middle - S;
+    if (bufferOffset[index] < cutoffOffset) {
+      low = middle + 1;
+    } else {
+      high = middle;
     }
-  });
+  }
+  return n - low;
+}
 
-  return max;
+template<typename T,size_t S,size_t W>
+template<typename F>
+void MathBuffer<T, S, W>::forRuns(size_t n, F visit) const {
+  if (n == 0) {
+    return;
+  }
+  size_t start = (headIndex + S + 1 - n) % S;
+  if (start + n <= S) {
+    visit(buffer + start, n);
+  } else {
+    visit(buffer + start, S - start);
+    visit(buffer, n - (S - start));
+  }
+}
+
+template<typename T,size_t S,size_t W>
+template<typename F>
+size_t MathBuffer<T, S, W>::forEachSince(int64_t cutoffMs, F visit) const {
+  size_t n = countSamplesSince(cutoffMs);
+  size_t index = headIndex;
+  for (size_t i = 0; i < n; i++) {
+    visit(buffer[index], timestampAt(index));
+    index = index == 0 ? S - 1 : index - 1; // going backward to go from newest to oldest
+  }
+  return n;
 }
 
-template<typename T,size_t S>
-T MathBuffer<T, S>::minSince(int64_t cutoffMs) {
-  T min = 0;
-  bool isFirst = true;
+template<typename T,size_t S,size_t W>
+void MathBuffer<T, S, W>::executeOnSamplesSince(int64_t cutoffMs, std::function<void (T, int64_t)> iterator) {
+  forEachSince(cutoffMs, iterator);
+}
 
-  executeOnSamplesSince(cutoffMs, [&min, &isFirst](T value, int64_t ms) {
-    if (isFirst || value < min) {
-      min = value;
-      isFirst = false;
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::averageSince(int64_t cutoffMs) const {
+  size_t n = countSamplesSince(cutoffMs);
+  if (n == 0) {
+    return 0;
+  }
+  SumType sum = 0;
+  forRuns(n, [&sum](const T *values, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      sum += (SumType)values[i];
     }
   });
-
-  return min;
+  return (T)(sum / (int64_t)n);
 }
 
-template<typename T,size_t S>
-T MathBuffer<T, S>::firstValueOlderThan(int64_t cutoffMs) {
-  for (int i = 0; i < count; i++) {
-    int index = (headIndex - i); // going backward to go from newest to oldest
-    if (index < 0) { // wrap around
-      index += S;
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::maxSince(int64_t cutoffMs) const {
+  size_t n = countSamplesSince(cutoffMs);
+  if (n == 0) {
+    return 0;
+  }
+  // starting from the newest sample keeps a first-sample branch out of the loop
+  T max = buffer[headIndex];
+  forRuns(n, [&max](const T *values, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      if (values[i] > max) {
+        max = values[i];
+      }
     }
-    if (bufferTimestamp[index] < cutoffMs) {
-      return buffer[index];
+  });
+  return max;
+}
+
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::minSince(int64_t cutoffMs) const {
+  size_t n = countSamplesSince(cutoffMs);
+  if (n == 0) {
+    return 0;
+  }
+  T min = buffer[headIndex];
+  forRuns(n, [&min](const T *values, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      if (values[i] < min) {
+        min = values[i];
+      }
     }
+  });
+  return min;
+}
+
+template<typename T,size_t S,size_t W>
+T MathBuffer<T, S, W>::firstValueOlderThan(int64_t cutoffMs) const {
+  size_t n = countSamplesSince(cutoffMs);
+  if (n >= count) {
+    return 0;
   }
-  return 0;
+  return buffer[(headIndex + S - n) % S]; // the newest sample before the cutoff
+}
+
+template<typename T,size_t S,size_t W>
+bool SharedMathBuffer<T, S, W>::push(T value, int64_t timestampMs) {
+  counter.beginWrite();
+  bool full = buffer.push(value, timestampMs);
+  counter.endWrite();
+  return full;
+}
+
+template<typename T,size_t S,size_t W>
+int SharedMathBuffer<T, S, W>::registerWindow(int64_t durationMs) {
+  counter.beginWrite();
+  int window = buffer.registerWindow(durationMs);
+  counter.endWrite();
+  return window;
 }
 
+template<typename T,size_t S,size_t W>
+template<typename F>
+auto SharedMathBuffer<T, S, W>::read(F query) const -> decltype(query(std::declval<const Buffer &>())) {
+  return counter.read([this, &query] { return query(buffer); });
+}
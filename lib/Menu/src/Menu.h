@@ -0,0 +1,182 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// How an entry is edited once it was clicked in the list
+#define MENU_COMMAND 0 // no screen of its own, the click runs done and closes the menu
+#define MENU_ACTION 1 // instructions, the click runs done
+#define MENU_VALUE 2 // turning steps value between min and max, the click runs done
+#define MENU_TOGGLE 3 // turning flips flag, the click runs done
+#define MENU_CONFIRM 4 // turning picks lines[0] or lines[1], the click runs done on lines[0]
+#define MENU_CHOICE 5 // turning hands the detents to select, the click runs done
+#define MENU_EDITORS 6
+
+// What a click left the menu in
+#define MENU_LIST 0
+#define MENU_EDITING 1
+#define MENU_CLOSED 2
+
+// One line of a menu table. Tables are constexpr arrays built with the menu*()
+// helpers below, each entry naming its editor and the callbacks it needs; the
+// menu and the display dispatch on the editor through tables of their own, so a
+// setting is added by adding its line. V is the edited value type, usually a
+// Fixed, State what describe formats extra lines from.
+template<typename V, typename State> struct MenuEntry {
+	const char *name; // in the list
+	const char *title; // on its screen
+	uint8_t editor; // MENU_*
+	bool (*done)(); // false stays on the screen, e.g. nothing to measure yet
+	V *value; // MENU_VALUE
+	V step, min, max;
+	bool *flag; // MENU_TOGGLE
+	void (*select)(int detents); // MENU_CHOICE
+	const char *lines[3]; // MENU_ACTION: instructions, MENU_TOGGLE and MENU_CONFIRM: true and false labels
+	// replaces line row when it returns true
+	bool (*describe)(const State &state, uint8_t row, char *buf, size_t size);
+
+	constexpr bool valid() const {
+		return name != nullptr && editor < MENU_EDITORS && (editor != MENU_VALUE || (value != nullptr && min <= max)) &&
+		       (editor != MENU_TOGGLE || flag != nullptr) && (editor != MENU_CHOICE || select != nullptr) &&
+		       (editor != MENU_CONFIRM || done != nullptr);
+	}
+};
+
+template<typename V, typename State> constexpr MenuEntry<V, State> menuCommand(const char *name, bool (*done)() = nullptr) {
+	return {name, name, MENU_COMMAND, done, nullptr, V(), V(), V(), nullptr, nullptr, {}, nullptr};
+}
+
+template<typename V, typename State>
+constexpr MenuEntry<V, State> menuAction(const char *name, const char *title, bool (*done)(), const char *line0,
+                                         const char *line1, const char *line2,
+                                         bool (*describe)(const State &, uint8_t, char *, size_t) = nullptr) {
+	return {name, title, MENU_ACTION, done, nullptr, V(), V(), V(), nullptr, nullptr, {line0, line1, line2}, describe};
+}
+
+template<typename V, typename State>
+constexpr MenuEntry<V, State> menuValue(const char *name, const char *title, V *value, V step, V min, V max,
+                                        bool (*done)()) {
+	return {name, title, MENU_VALUE, done, value, step, min, max, nullptr, nullptr, {}, nullptr};
+}
+
+template<typename V, typename State>
+constexpr MenuEntry<V, State> menuToggle(const char *name, const char *title, bool *flag, const char *on, const char *off,
+                                         bool (*done)(),
+                                         bool (*describe)(const State &, uint8_t, char *, size_t) = nullptr) {
+	return {name, title, MENU_TOGGLE, done, nullptr, V(), V(), V(), flag, nullptr, {on, off, nullptr}, describe};
+}
+
+template<typename V, typename State>
+constexpr MenuEntry<V, State> menuConfirm(const char *name, const char *title, bool (*done)()) {
+	return {name, title, MENU_CONFIRM, done, nullptr, V(), V(), V(), nullptr, nullptr, {"Confirm", "Cancel", nullptr}, nullptr};
+}
+
+template<typename V, typename State>
+constexpr MenuEntry<V, State> menuChoice(const char *name, const char *title, void (*select)(int),
+                                         bool (*describe)(const State &, uint8_t, char *, size_t),
+                                         bool (*done)() = nullptr) {
+	return {name, title, MENU_CHOICE, done, nullptr, V(), V(), V(), nullptr, select, {}, describe};
+}
+
+template<typename V, typename State, size_t N> constexpr bool menuValid(const MenuEntry<V, State> (&entries)[N]) {
+	for (size_t i = 0; i < N; i++) {
+		if (!entries[i].valid()) {
+			return false;
+		}
+	}
+	return N > 0;
+}
+
+// Walks a menu table with the encoder: turning moves through the list or edits
+// the entry that was clicked, a click opens it or finishes editing. Each event is
+// one lookup in a table of editors, nothing is allocated.
+template<typename V, typename State> class Menu {
+public:
+	typedef MenuEntry<V, State> Entry;
+
+	template<size_t N> constexpr Menu(const Entry (&entries)[N]) : entries(entries), count(N) {}
+
+	void open() {
+		selected = 0;
+		editing = false;
+	}
+
+	void turn(int detents) {
+		if (detents == 0) {
+			return;
+		}
+		if (editing) {
+			editors[entries[selected].editor].turn(*this, detents);
+		} else {
+			// one entry at a time however far it was turned, so nothing is skipped
+			selected = (selected + (detents > 0 ? 1 : count - 1)) % count;
+		}
+	}
+
+	// MENU_LIST, MENU_EDITING or MENU_CLOSED
+	uint8_t click() {
+		const Entry &entry = entries[selected];
+		if (!editing) {
+			if (entry.editor == MENU_COMMAND) {
+				if (entry.done) {
+					entry.done();
+				}
+				return MENU_CLOSED;
+			}
+			editing = true;
+			answer = false;
+			return MENU_EDITING;
+		}
+		if (editors[entry.editor].click(*this) && entry.done && !entry.done()) {
+			return MENU_EDITING;
+		}
+		editing = false;
+		return MENU_LIST;
+	}
+
+	const Entry &current() const { return entries[selected]; }
+	uint8_t index() const { return selected; }
+	bool isEditing() const { return editing; }
+	// what the editor shows: the value, the flag or the confirmation
+	V value() const { return entries[selected].value ? *entries[selected].value : V(); }
+	bool flag() const { return entries[selected].editor == MENU_CONFIRM ? answer : entries[selected].flag && *entries[selected].flag; }
+
+private:
+	// click returns whether done runs
+	struct Editor {
+		void (*turn)(Menu &menu, int detents);
+		bool (*click)(Menu &menu);
+	};
+
+	static void ignore(Menu &, int) {}
+	static bool always(Menu &) { return true; }
+
+	static void step(Menu &menu, int detents) {
+		const Entry &entry = menu.entries[menu.selected];
+		V next = *entry.value + entry.step * (int64_t)detents;
+		*entry.value = next < entry.min ? entry.min : next > entry.max ? entry.max : next;
+	}
+
+	static void flip(Menu &menu, int) {
+		*menu.entries[menu.selected].flag = !*menu.entries[menu.selected].flag;
+	}
+
+	static void pick(Menu &menu, int) { menu.answer = !menu.answer; }
+	static bool confirmed(Menu &menu) { return menu.answer; }
+
+	static void choose(Menu &menu, int detents) { menu.entries[menu.selected].select(detents); }
+
+	static constexpr Editor editors[MENU_EDITORS] = {
+	    /* MENU_COMMAND */ {ignore, always},
+	    /* MENU_ACTION */ {ignore, always},
+	    /* MENU_VALUE */ {step, always},
+	    /* MENU_TOGGLE */ {flip, always},
+	    /* MENU_CONFIRM */ {pick, confirmed},
+	    /* MENU_CHOICE */ {choose, always},
+	};
+
+	const Entry *entries;
+	uint8_t count;
+	uint8_t selected = 0;
+	bool editing = false;
+	bool answer = false; // MENU_CONFIRM
+};
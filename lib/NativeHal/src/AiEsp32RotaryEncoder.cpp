@@ -0,0 +1,97 @@
+#include "AiEsp32RotaryEncoder.h"
+
+namespace {
+
+AiEsp32RotaryEncoder *encoder = nullptr;
+void (*encoderIsr)(void) = nullptr;
+int buttonPin = -1;
+int pendingDetents = 0;
+int pendingClicks = 0;
+
+}
+
+namespace sim {
+
+void turnEncoder(int detents) {
+  pendingDetents += detents;
+  if (encoderIsr) {
+    encoderIsr(); // the firmware ISR forwards to readEncoder_ISR()
+  } else if (encoder) {
+    encoder->readEncoder_ISR();
+  }
+}
+
+void clickEncoder() {
+  pendingClicks++;
+  if (buttonPin >= 0) {
+    // press and release, for firmware that wakes up on the button pin
+    setPinLevel(buttonPin, LOW);
+    setPinLevel(buttonPin, HIGH);
+  }
+}
+
+}
+
+AiEsp32RotaryEncoder::AiEsp32RotaryEncoder(uint8_t encoderAPin, uint8_t encoderBPin, int encoderButtonPin,
+                                           int encoderVccPin, uint8_t encoderSteps) {
+  buttonPin = encoderButtonPin;
+}
+
+void AiEsp32RotaryEncoder::begin() {
+  encoder = this;
+  if (buttonPin >= 0) {
+    sim::setPinLevel(buttonPin, HIGH);
+  }
+}
+
+void AiEsp32RotaryEncoder::setup(void (*ISR_callback)(void), void (*ISR_button)(void)) {
+  encoderIsr = ISR_callback;
+}
+
+void AiEsp32RotaryEncoder::setBoundaries(long minValue, long maxValue, bool circleValues) {
+  this->minValue = minValue;
+  this->maxValue = maxValue;
+  this->circleValues = circleValues;
+}
+
+void AiEsp32RotaryEncoder::setAcceleration(unsigned long acceleration) {
+}
+
+void AiEsp32RotaryEncoder::disableAcceleration() {
+}
+
+void AiEsp32RotaryEncoder::readEncoder_ISR() {
+  setEncoderValue(position + pendingDetents);
+  pendingDetents = 0;
+}
+
+void AiEsp32RotaryEncoder::readButton_ISR() {
+}
+
+long AiEsp32RotaryEncoder::readEncoder() {
+  return position;
+}
+
+void AiEsp32RotaryEncoder::setEncoderValue(long newValue) {
+  long range = maxValue - minValue + 1;
+  if (newValue > maxValue) {
+    newValue = circleValues ? minValue + (newValue - maxValue - 1) % range : maxValue;
+  } else if (newValue < minValue) {
+    newValue = circleValues ? maxValue - (minValue - newValue - 1) % range : minValue;
+  }
+  position = newValue;
+}
+
+long AiEsp32RotaryEncoder::encoderChanged() {
+  long diff = position - lastReadPosition;
+  lastReadPosition = position;
+  return diff;
+}
+
+bool AiEsp32RotaryEncoder::isEncoderButtonClicked(unsigned long maximumWaitMilliseconds) {
+  if (pendingClicks == 0) {
+    return false;
+  }
+  pendingClicks--;
+  return true;
+}
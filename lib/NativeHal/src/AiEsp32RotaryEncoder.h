@@ -0,0 +1,36 @@
+#pragma once
+// Stand-in for igorantolic/Ai Esp32 Rotary Encoder, turned and clicked through sim::turnEncoder()/sim::clickEncoder().
+#include "Arduino.h"
+
+class AiEsp32RotaryEncoder {
+public:
+  AiEsp32RotaryEncoder(uint8_t encoderAPin, uint8_t encoderBPin, int encoderButtonPin = -1,
+                       int encoderVccPin = -1, uint8_t encoderSteps = 2);
+
+  void begin();
+  void setup(void (*ISR_callback)(void), void (*ISR_button)(void) = nullptr);
+  void setBoundaries(long minValue = -100, long maxValue = 100, bool circleValues = false);
+  void setAcceleration(unsigned long acceleration);
+  void disableAcceleration();
+  void readEncoder_ISR();
+  void readButton_ISR();
+
+  long readEncoder();
+  void setEncoderValue(long newValue);
+  long encoderChanged();
+  bool isEncoderButtonClicked(unsigned long maximumWaitMilliseconds = 300);
+
+private:
+  long minValue = -100;
+  long maxValue = 100;
+  bool circleValues = false;
+  long position = 0;
+  long lastReadPosition = 0;
+};
+
+namespace sim {
+
+void turnEncoder(int detents); // positive is clockwise
+void clickEncoder();
+
+}
@@ -0,0 +1,185 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include <deque>
+#include <string>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+namespace {
+
+bool serialEcho = false;
+std::deque<uint8_t> serialRx;
+std::function<void(uint8_t, uint8_t)> pinWriteHook;
+uint8_t pinLevels[64];
+void (*pinInterrupts[64])(void);
+int pinInterruptModes[64];
+
+}
+
+namespace sim {
+
+void setSerialEcho(bool echo) {
+  serialEcho = echo;
+}
+
+void serialInput(const char *data) {
+  while (*data) {
+    serialRx.push_back((uint8_t)*data++);
+  }
+}
+
+void onPinWrite(std::function<void(uint8_t pin, uint8_t val)> hook) {
+  pinWriteHook = hook;
+}
+
+void setPinLevel(uint8_t pin, uint8_t val) {
+  pin &= 63;
+  uint8_t previous = pinLevels[pin];
+  pinLevels[pin] = val;
+
+  int edge = val == previous ? 0 : (val ? RISING : FALLING);
+  if (edge && pinInterrupts[pin] && (pinInterruptModes[pin] & edge)) {
+    pinInterrupts[pin]();
+  }
+}
+
+}
+
+unsigned long millis() {
+  sim::spend(sim::CALL_COST_US);
+  return (unsigned long)(sim::now() / 1000);
+}
+
+unsigned long micros() {
+  sim::spend(sim::CALL_COST_US);
+  return (unsigned long)sim::now();
+}
+
+void delay(uint32_t ms) {
+  sim::sleepFor((uint64_t)ms * 1000);
+}
+
+void yield() {
+  sim::yieldTask();
+}
+
+void delayMicroseconds(uint32_t us) {
+  sim::spend(us); // busy wait on the real hardware
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  sim::spend(sim::CALL_COST_US);
+  pinLevels[pin & 63] = val;
+  if (pinWriteHook) {
+    pinWriteHook(pin, val);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  sim::spend(sim::CALL_COST_US);
+  return pinLevels[pin & 63];
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+  pinInterrupts[pin & 63] = handler;
+  pinInterruptModes[pin & 63] = mode;
+}
+
+void detachInterrupt(uint8_t pin) {
+  pinInterrupts[pin & 63] = nullptr;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(const char *str) {
+  return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(int value, int base) {
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return print((unsigned long long)value, base);
+}
+
+size_t Print::print(long value, int base) {
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return print((unsigned long long)value, base);
+}
+
+size_t Print::print(long long value, int base) {
+  if (value < 0 && base == DEC) {
+    return print('-') + print((unsigned long long)-value, base);
+  }
+  return print((unsigned long long)value, base);
+}
+
+size_t Print::print(unsigned long long value, int base) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%llX" : "%llu", value);
+  return print(buf);
+}
+
+size_t Print::print(double value, int digits) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return print(buf);
+}
+
+size_t Print::println() {
+  return print("\r\n");
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  return write((const uint8_t *)buf, std::min((size_t)len, sizeof(buf) - 1));
+}
+
+int HardwareSerial::available() {
+  return (int)serialRx.size();
+}
+
+int HardwareSerial::read() {
+  if (serialRx.empty()) {
+    return -1;
+  }
+  uint8_t c = serialRx.front();
+  serialRx.pop_front();
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (serialEcho) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
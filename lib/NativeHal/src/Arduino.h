@@ -0,0 +1,108 @@
+#pragma once
+// Minimal Arduino core for the native build. Time is virtual, see SimScheduler.h.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <functional>
+#include <algorithm>
+
+#include "SimScheduler.h"
+#include "SimFreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+
+#define digitalPinToInterrupt(pin) (pin)
+
+#define DEC 10
+#define HEX 16
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  size_t print(const char *str);
+  size_t print(char c);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(long long value, int base = DEC);
+  size_t print(unsigned long long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println();
+  template<typename V> size_t println(V value) { return print(value) + println(); }
+  template<typename V> size_t println(V value, int format) { return print(value, format) + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long baud) {}
+  operator bool() const { return true; }
+  int available();
+  int read();
+  using Print::write;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+};
+
+extern HardwareSerial Serial;
+
+// CPU cycle counter of a 240 MHz core running in virtual time
+class EspClass {
+public:
+  uint32_t getCycleCount() { return (uint32_t)(sim::now() * 240); }
+  uint32_t getCpuFreqMHz() { return 240; }
+};
+
+extern EspClass ESP;
+
+namespace sim {
+
+void setSerialEcho(bool echo);        // copy firmware Serial output to stdout
+void serialInput(const char *data);   // queue bytes for Serial.read()
+
+void onPinWrite(std::function<void(uint8_t pin, uint8_t val)> hook);
+void setPinLevel(uint8_t pin, uint8_t val); // drive an input pin from the simulated hardware, runs its ISR on a matching edge
+
+}
@@ -0,0 +1,164 @@
+#include "HX711.h"
+
+namespace {
+
+std::function<long()> signal;
+std::function<bool(uint64_t &, long &)> conversions; // replaces signal and rate when set
+long scheduled = 0; // counts of the conversion scheduled from conversions
+uint32_t periodUs = 100000; // RATE pin low: 10 SPS
+bool connected = true;
+uint8_t doutPin = 0;
+bool converting = false;
+long latched = 0;
+bool dataReady = false;
+uint64_t nextConversionAt = 0;
+
+void convert();
+
+// schedules the conversion after the one at nextConversionAt
+bool scheduleNext() {
+  if (!conversions) {
+    nextConversionAt += periodUs;
+  } else if (!conversions(nextConversionAt, scheduled)) {
+    converting = false; // end of the recording, DOUT stays high from now on
+    return false;
+  }
+  sim::at(nextConversionAt, convert);
+  return true;
+}
+
+void convert() {
+  if (connected) {
+    latched = conversions ? scheduled : signal ? signal() : 0;
+    dataReady = true;
+    sim::setPinLevel(doutPin, LOW); // DOUT falls when a conversion is ready
+  }
+  scheduleNext();
+}
+
+void startConverting() {
+  if (!converting) {
+    converting = true;
+    nextConversionAt = sim::now();
+    scheduleNext();
+  }
+}
+
+}
+
+namespace sim {
+
+void setLoadCellSignal(std::function<long()> source) {
+  signal = source;
+}
+
+void setLoadCellConversions(std::function<bool(uint64_t &atUs, long &raw)> next) {
+  conversions = next;
+}
+
+void setLoadCellRate(uint32_t samplesPerSecond) {
+  periodUs = 1000000 / samplesPerSecond;
+}
+
+bool loadCellConnected() {
+  return connected;
+}
+
+void setLoadCellConnected(bool state) {
+  connected = state;
+  dataReady = dataReady && state;
+}
+
+}
+
+void HX711::begin(byte dout, byte pd_sck, byte gain) {
+  doutPin = dout;
+  sim::setPinLevel(doutPin, HIGH);
+  startConverting();
+}
+
+bool HX711::is_ready() {
+  sim::spend(sim::CALL_COST_US);
+  return dataReady;
+}
+
+void HX711::wait_ready(unsigned long delay_ms) {
+  while (!wait_ready_timeout(1000, delay_ms)) {
+  }
+}
+
+bool HX711::wait_ready_retry(int retries, unsigned long delay_ms) {
+  for (int count = 0; count < retries; count++) {
+    if (is_ready()) {
+      return true;
+    }
+    delay(delay_ms);
+  }
+  return false;
+}
+
+bool HX711::wait_ready_timeout(unsigned long timeout, unsigned long delay_ms) {
+  // The library polls DOUT in a tight loop, sleep until the next conversion instead
+  // so the simulation does not have to step through every poll.
+  uint64_t deadline = sim::now() + (uint64_t)timeout * 1000;
+  while (!is_ready()) {
+    uint64_t now = sim::now();
+    if (now >= deadline) {
+      return false;
+    }
+    uint64_t wake = connected && converting && nextConversionAt < deadline ? nextConversionAt : deadline;
+    sim::sleepFor(wake > now ? wake - now : 0);
+  }
+  return true;
+}
+
+long HX711::read() {
+  wait_ready();
+  sim::spend(sim::HX711_READ_US);
+  dataReady = false;
+  sim::setPinLevel(doutPin, HIGH);
+  return latched;
+}
+
+long HX711::read_average(byte times) {
+  long long sum = 0;
+  for (byte i = 0; i < times; i++) {
+    sum += read();
+    yield();
+  }
+  return (long)(sum / times);
+}
+
+double HX711::get_value(byte times) {
+  return read_average(times) - OFFSET;
+}
+
+float HX711::get_units(byte times) {
+  return get_value(times) / SCALE;
+}
+
+void HX711::tare(byte times) {
+  set_offset(read_average(times));
+}
+
+void HX711::set_scale(float scale) {
+  SCALE = scale;
+}
+
+float HX711::get_scale() {
+  return SCALE;
+}
+
+void HX711::set_offset(long offset) {
+  OFFSET = offset;
+}
+
+long HX711::get_offset() {
+  return OFFSET;
+}
+
+void HX711::power_down() {
+}
+
+void HX711::power_up() {
+}
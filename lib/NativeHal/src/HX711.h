@@ -0,0 +1,43 @@
+#pragma once
+// API compatible stand-in for bogde/HX711. Conversions are produced by a simulated
+// ADC that samples sim::setLoadCellSignal() at the configured data rate, or
+// replays recorded conversions.
+#include "Arduino.h"
+
+class HX711 {
+public:
+  void begin(byte dout, byte pd_sck, byte gain = 128);
+  bool is_ready();
+  void wait_ready(unsigned long delay_ms = 0);
+  bool wait_ready_retry(int retries = 3, unsigned long delay_ms = 0);
+  bool wait_ready_timeout(unsigned long timeout = 1000, unsigned long delay_ms = 0);
+  long read();
+  long read_average(byte times = 10);
+  double get_value(byte times = 1);
+  float get_units(byte times = 1);
+  void tare(byte times = 10);
+  void set_scale(float scale = 1.f);
+  float get_scale();
+  void set_offset(long offset = 0);
+  long get_offset();
+  void power_down();
+  void power_up();
+
+private:
+  long OFFSET = 0;
+  float SCALE = 1;
+};
+
+namespace sim {
+
+static constexpr uint64_t HX711_READ_US = 60; // clocking out 24 bits
+
+void setLoadCellSignal(std::function<long()> signal); // raw counts at the current virtual time
+void setLoadCellRate(uint32_t samplesPerSecond);
+// Recorded conversions instead of the signal: next() gives the time and counts of
+// the conversion after the previous one, false when there are no more
+void setLoadCellConversions(std::function<bool(uint64_t &atUs, long &raw)> next);
+bool loadCellConnected();
+void setLoadCellConnected(bool connected);
+
+}
@@ -0,0 +1,126 @@
+#include "Preferences.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::map<std::string, std::map<std::string, std::vector<uint8_t>>> storage;
+uint32_t writes = 0;
+
+}
+
+namespace sim {
+
+uint32_t nvsWrites() {
+  return writes;
+}
+
+void nvsErase() {
+  storage.clear();
+}
+
+}
+
+bool Preferences::begin(const char *name, bool readOnly) {
+  sim::spend(sim::CALL_COST_US);
+  nameSpace = name;
+  this->readOnly = readOnly;
+  return true;
+}
+
+void Preferences::end() {
+  nameSpace = nullptr;
+}
+
+bool Preferences::clear() {
+  if (!nameSpace || readOnly) {
+    return false;
+  }
+  storage[nameSpace].clear();
+  writes++;
+  sim::stall(sim::NVS_WRITE_US);
+  return true;
+}
+
+bool Preferences::remove(const char *key) {
+  if (!nameSpace || readOnly) {
+    return false;
+  }
+  writes++;
+  sim::stall(sim::NVS_WRITE_US);
+  return storage[nameSpace].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+  return nameSpace && storage[nameSpace].count(key) > 0;
+}
+
+size_t Preferences::put(const char *key, const void *value, size_t len) {
+  if (!nameSpace || readOnly) {
+    return 0;
+  }
+  const uint8_t *bytes = (const uint8_t *)value;
+  storage[nameSpace][key].assign(bytes, bytes + len);
+  writes++;
+  sim::stall(sim::NVS_WRITE_US);
+  return len;
+}
+
+bool Preferences::get(const char *key, void *value, size_t len) {
+  if (!nameSpace) {
+    return false;
+  }
+  sim::spend(sim::CALL_COST_US);
+  auto entry = storage[nameSpace].find(key);
+  if (entry == storage[nameSpace].end() || entry->second.size() != len) {
+    return false;
+  }
+  memcpy(value, entry->second.data(), len);
+  return true;
+}
+
+size_t Preferences::putChar(const char *key, int8_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putUChar(const char *key, uint8_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putShort(const char *key, int16_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putUShort(const char *key, uint16_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putInt(const char *key, int32_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putUInt(const char *key, uint32_t value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putFloat(const char *key, float value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putDouble(const char *key, double value) { return put(key, &value, sizeof(value)); }
+size_t Preferences::putBool(const char *key, bool value) {
+  uint8_t stored = value ? 1 : 0;
+  return put(key, &stored, sizeof(stored));
+}
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) { return put(key, value, len); }
+
+int8_t Preferences::getChar(const char *key, int8_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+int16_t Preferences::getShort(const char *key, int16_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+uint16_t Preferences::getUShort(const char *key, uint16_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+int32_t Preferences::getInt(const char *key, int32_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+float Preferences::getFloat(const char *key, float defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+double Preferences::getDouble(const char *key, double defaultValue) { get(key, &defaultValue, sizeof(defaultValue)); return defaultValue; }
+bool Preferences::getBool(const char *key, bool defaultValue) {
+  uint8_t stored = defaultValue ? 1 : 0;
+  get(key, &stored, sizeof(stored));
+  return stored != 0;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+  if (!nameSpace) {
+    return 0;
+  }
+  auto entry = storage[nameSpace].find(key);
+  return entry == storage[nameSpace].end() ? 0 : entry->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+  size_t len = getBytesLength(key);
+  if (len == 0 || len > maxLen) {
+    return 0;
+  }
+  memcpy(buf, storage[nameSpace][key].data(), len);
+  return len;
+}
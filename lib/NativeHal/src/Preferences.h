@@ -0,0 +1,52 @@
+#pragma once
+// RAM backed stand-in for the ESP32 Preferences (NVS) library. Every put is
+// counted as a flash write and charged the time a real NVS commit takes.
+#include "Arduino.h"
+
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false);
+  void end();
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+
+  size_t putChar(const char *key, int8_t value);
+  size_t putUChar(const char *key, uint8_t value);
+  size_t putShort(const char *key, int16_t value);
+  size_t putUShort(const char *key, uint16_t value);
+  size_t putInt(const char *key, int32_t value);
+  size_t putUInt(const char *key, uint32_t value);
+  size_t putFloat(const char *key, float value);
+  size_t putDouble(const char *key, double value);
+  size_t putBool(const char *key, bool value);
+  size_t putBytes(const char *key, const void *value, size_t len);
+
+  int8_t getChar(const char *key, int8_t defaultValue = 0);
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+  int16_t getShort(const char *key, int16_t defaultValue = 0);
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0);
+  int32_t getInt(const char *key, int32_t defaultValue = 0);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  float getFloat(const char *key, float defaultValue = NAN);
+  double getDouble(const char *key, double defaultValue = NAN);
+  bool getBool(const char *key, bool defaultValue = false);
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+
+private:
+  size_t put(const char *key, const void *value, size_t len);
+  bool get(const char *key, void *value, size_t len);
+
+  const char *nameSpace = nullptr;
+  bool readOnly = true;
+};
+
+namespace sim {
+
+static constexpr uint64_t NVS_WRITE_US = 3000;
+
+uint32_t nvsWrites(); // number of flash writes since start
+void nvsErase();
+
+}
@@ -0,0 +1,102 @@
+#include "Arduino.h"
+#include <deque>
+#include <vector>
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  void *task = sim::createTask(function, name, parameter, (int)priority, (int)core, stackDepth);
+  if (handle) {
+    *handle = task;
+  }
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  sim::sleepFor((uint64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+  uint64_t timeoutUs = ticksToWait == portMAX_DELAY ? UINT64_MAX : (uint64_t)ticksToWait * portTICK_PERIOD_MS * 1000;
+  return sim::notifyTake(clearCountOnExit != pdFALSE, timeoutUs);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  sim::notify(task);
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken) {
+  sim::notify(task);
+  if (higherPriorityTaskWoken) {
+    *higherPriorityTaskWoken = pdTRUE;
+  }
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return sim::stackHighWater(task ? task : sim::currentTask());
+}
+
+BaseType_t xPortGetCoreID() {
+  return sim::currentCore();
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(sim::now() / 1000 / portTICK_PERIOD_MS);
+}
+
+struct SimQueue {
+  size_t length;
+  size_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+  void *receiver;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  SimQueue *queue = new SimQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  queue->receiver = nullptr;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait) {
+  sim::spend(sim::CALL_COST_US);
+  if (queue->items.size() >= queue->length) {
+    return errQUEUE_FULL; // blocking senders are not needed by the firmware
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  if (queue->receiver) {
+    sim::unblock(queue->receiver);
+  }
+  return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken) {
+  BaseType_t result = xQueueSend(queue, item, 0);
+  if (higherPriorityTaskWoken && result == pdPASS && queue->receiver) {
+    *higherPriorityTaskWoken = pdTRUE;
+  }
+  return result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait) {
+  sim::spend(sim::CALL_COST_US);
+  uint64_t deadline = ticksToWait == portMAX_DELAY ? UINT64_MAX : sim::now() + (uint64_t)ticksToWait * portTICK_PERIOD_MS * 1000;
+  while (queue->items.empty()) {
+    uint64_t now = sim::now();
+    if (now >= deadline) {
+      return pdFALSE;
+    }
+    queue->receiver = sim::currentTask();
+    sim::block(deadline == UINT64_MAX ? UINT64_MAX : deadline - now);
+    queue->receiver = nullptr;
+  }
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return (UBaseType_t)queue->items.size();
+}
@@ -0,0 +1,430 @@
+#include "SimScheduler.h"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sim {
+
+namespace {
+
+struct TaskStopped {};
+
+struct Task {
+  std::string name;
+  TaskFunction function;
+  void *parameter;
+  int priority;
+  int core;
+  bool ready;          // wants its core: executing, spending CPU time or waiting for a turn
+  bool finished;
+  uint64_t readySince; // FIFO order among ready tasks of equal priority
+  uint64_t wakeAt;
+  uint64_t computeLeft; // CPU time spend() still needs on the core before the task carries on
+  uint64_t busyUs;
+  uint32_t stackBytes;
+  uintptr_t stackTop;  // frame the task function was called from
+  uintptr_t stackUsed; // deepest frame seen in a call into the scheduler
+  uint32_t notifications;
+  bool waiting;   // in block()
+  bool unblocked; // left block() because of unblock()
+  std::condition_variable wake;
+  std::thread thread;
+};
+
+std::mutex lock;
+std::condition_variable schedulerWake;
+std::vector<Task *> tasks;
+std::multimap<uint64_t, std::function<void()>> timers;
+Task *running = nullptr;
+uint64_t clockUs = 0;
+uint64_t stalledUntil[CORES] = {};
+Task *staller = nullptr; // keeps its own core while the others are stalled
+uint64_t readyCounter = 0;
+bool stopping = false;
+thread_local Task *self = nullptr;
+
+const uint64_t NEVER = UINT64_MAX;
+
+uint64_t nextEventAt() {
+  uint64_t next = timers.empty() ? NEVER : timers.begin()->first;
+  for (Task *task : tasks) {
+    if (!task->finished && !task->ready && task->wakeAt < next) {
+      next = task->wakeAt;
+    }
+  }
+  return next;
+}
+
+bool before(const Task *a, const Task *b) {
+  return a->priority > b->priority || (a->priority == b->priority && a->readySince < b->readySince);
+}
+
+// The ready task the core gives its time to, null while the core is idle or stalled
+Task *holder(int core) {
+  if (clockUs < stalledUntil[core]) {
+    return nullptr;
+  }
+  if (staller && staller->core == core) {
+    return staller;
+  }
+  Task *best = nullptr;
+  for (Task *task : tasks) {
+    if (!task->finished && task->ready && task->core == core && (!best || before(task, best))) {
+      best = task;
+    }
+  }
+  return best;
+}
+
+// Another ready task on the core with the holder's priority, which the tick lets take over
+bool contended(int core, const Task *holding) {
+  for (Task *task : tasks) {
+    if (task != holding && !task->finished && task->ready && task->core == core && task->priority == holding->priority) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// When the clock has to stop next: an event, a core finishing a spend or
+// coming out of a stall, or a tick that rotates equal priorities
+uint64_t nextStepAt() {
+  uint64_t next = nextEventAt();
+  for (int core = 0; core < CORES; core++) {
+    if (clockUs < stalledUntil[core]) {
+      next = std::min(next, stalledUntil[core]);
+      continue;
+    }
+    Task *task = holder(core);
+    if (task && task->computeLeft > 0) {
+      next = std::min(next, clockUs + task->computeLeft);
+      if (contended(core, task)) {
+        next = std::min(next, (clockUs / TICK_US + 1) * TICK_US);
+      }
+    }
+  }
+  return next;
+}
+
+// Moves the clock, the tasks spending time on their cores get it
+void advance(uint64_t to) {
+  Task *holders[CORES];
+  for (int core = 0; core < CORES; core++) {
+    holders[core] = holder(core);
+  }
+  uint64_t elapsed = to - clockUs;
+  clockUs = to;
+  for (int core = 0; core < CORES; core++) {
+    Task *task = holders[core];
+    if (!task || task->computeLeft == 0) {
+      continue;
+    }
+    uint64_t used = std::min(elapsed, task->computeLeft);
+    task->computeLeft -= used;
+    task->busyUs += used;
+    if (task == staller && task->computeLeft == 0) {
+      staller = nullptr;
+    }
+    if (task->computeLeft > 0 && to % TICK_US == 0 && contended(core, task)) {
+      task->readySince = readyCounter++; // time slice over, to the back of its priority
+    }
+  }
+}
+
+void noteStack() {
+  uintptr_t frame = (uintptr_t)__builtin_frame_address(0);
+  if (self->stackTop > frame && self->stackTop - frame > self->stackUsed) {
+    self->stackUsed = self->stackTop - frame;
+  }
+}
+
+// hand the CPU back to the scheduler and wait to be picked again
+void releaseCpu(std::unique_lock<std::mutex> &guard) {
+  running = nullptr;
+  schedulerWake.notify_one();
+  self->wake.wait(guard, [] { return running == self || stopping; });
+  if (stopping) {
+    throw TaskStopped();
+  }
+}
+
+void markReady(Task *task) {
+  task->ready = true;
+  task->waiting = false;
+  task->wakeAt = NEVER;
+  task->readySince = readyCounter++;
+}
+
+void taskMain(Task *task) {
+  self = task;
+  task->stackTop = (uintptr_t)__builtin_frame_address(0);
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    task->wake.wait(guard, [task] { return running == task || stopping; });
+    if (stopping) {
+      task->finished = true;
+      return;
+    }
+  }
+  try {
+    task->function(task->parameter);
+  } catch (TaskStopped &) {
+  }
+  std::unique_lock<std::mutex> guard(lock);
+  task->finished = true;
+  if (running == task) {
+    running = nullptr;
+    schedulerWake.notify_one();
+  }
+}
+
+}
+
+void *createTask(TaskFunction function, const char *name, void *parameter, int priority, int core, uint32_t stackBytes) {
+  Task *task = new Task();
+  task->name = name;
+  task->function = function;
+  task->parameter = parameter;
+  task->priority = priority;
+  task->core = core >= 0 && core < CORES ? core : 0;
+  task->finished = false;
+  task->computeLeft = 0;
+  task->busyUs = 0;
+  task->stackBytes = stackBytes;
+  task->stackTop = 0;
+  task->stackUsed = 0;
+  task->notifications = 0;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    markReady(task);
+    tasks.push_back(task);
+  }
+  task->thread = std::thread(taskMain, task);
+  return task;
+}
+
+const char *taskName(void *task) {
+  return task ? static_cast<Task *>(task)->name.c_str() : "main";
+}
+
+void *currentTask() {
+  return self;
+}
+
+int currentCore() {
+  return self ? self->core : 0;
+}
+
+uint32_t stackHighWater(void *handle) {
+  Task *task = static_cast<Task *>(handle);
+  std::unique_lock<std::mutex> guard(lock);
+  return task->stackUsed < task->stackBytes ? (uint32_t)(task->stackBytes - task->stackUsed) : 0;
+}
+
+uint64_t now() {
+  std::unique_lock<std::mutex> guard(lock);
+  return clockUs;
+}
+
+void spend(uint64_t us) {
+  if (!self) {
+    return;
+  }
+  std::unique_lock<std::mutex> guard(lock);
+  noteStack();
+  bool alone = nextStepAt() > clockUs + us;
+  for (Task *task : tasks) {
+    if (task != self && !task->finished && task->ready &&
+        (task->core == self->core ? task->priority >= self->priority : task == holder(task->core) && task->computeLeft == 0)) {
+      alone = false; // has to take turns, or still has to run at the current time
+    }
+  }
+  if (alone) {
+    // nothing happens meanwhile, skip the round trip through the scheduler
+    advance(clockUs + us);
+    self->busyUs += us;
+    return;
+  }
+  self->computeLeft = us;
+  releaseCpu(guard);
+}
+
+void stall(uint64_t us) {
+  if (!self || us == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> guard(lock);
+  noteStack();
+  for (int core = 0; core < CORES; core++) {
+    if (core != self->core) {
+      stalledUntil[core] = std::max(stalledUntil[core], clockUs + us);
+    }
+  }
+  staller = self; // nothing preempts it either, interrupts are off
+  self->computeLeft = us;
+  releaseCpu(guard);
+}
+
+void sleepFor(uint64_t us) {
+  if (!self) {
+    run(us);
+    return;
+  }
+  std::unique_lock<std::mutex> guard(lock);
+  noteStack();
+  if (us == 0) {
+    markReady(self);
+  } else {
+    self->ready = false;
+    self->wakeAt = clockUs + us;
+  }
+  releaseCpu(guard);
+}
+
+void yieldTask() {
+  sleepFor(0);
+}
+
+void at(uint64_t us, std::function<void()> callback) {
+  std::unique_lock<std::mutex> guard(lock);
+  timers.emplace(us, std::move(callback));
+}
+
+static bool blockLocked(std::unique_lock<std::mutex> &guard, uint64_t timeoutUs) {
+  if (timeoutUs == 0) {
+    return false;
+  }
+  noteStack();
+  self->ready = false;
+  self->waiting = true;
+  self->unblocked = false;
+  self->wakeAt = timeoutUs == NEVER ? NEVER : clockUs + timeoutUs;
+  releaseCpu(guard);
+  return self->unblocked;
+}
+
+static void unblockLocked(std::unique_lock<std::mutex> &guard, Task *task) {
+  if (task->waiting) {
+    markReady(task);
+    task->unblocked = true;
+  }
+  if (self && task->ready && task->core == self->core && task->priority > self->priority) {
+    // a higher priority task was unblocked on this core, FreeRTOS would switch to it right away
+    markReady(self);
+    releaseCpu(guard);
+  }
+}
+
+bool block(uint64_t timeoutUs) {
+  std::unique_lock<std::mutex> guard(lock);
+  return blockLocked(guard, timeoutUs);
+}
+
+void unblock(void *task) {
+  std::unique_lock<std::mutex> guard(lock);
+  unblockLocked(guard, static_cast<Task *>(task));
+}
+
+void notify(void *handle) {
+  Task *task = static_cast<Task *>(handle);
+  std::unique_lock<std::mutex> guard(lock);
+  task->notifications++;
+  unblockLocked(guard, task);
+}
+
+uint32_t notifyTake(bool clear, uint64_t timeoutUs) {
+  std::unique_lock<std::mutex> guard(lock);
+  if (self->notifications == 0) {
+    blockLocked(guard, timeoutUs);
+  }
+  uint32_t value = self->notifications;
+  if (clear) {
+    self->notifications = 0;
+  } else if (value > 0) {
+    self->notifications--;
+  }
+  return value;
+}
+
+void run(uint64_t us) {
+  std::unique_lock<std::mutex> guard(lock);
+  uint64_t until = clockUs + us;
+
+  for (;;) {
+    if (!timers.empty() && timers.begin()->first <= clockUs) {
+      std::function<void()> callback = std::move(timers.begin()->second);
+      timers.erase(timers.begin());
+      guard.unlock();
+      callback();
+      guard.lock();
+      continue;
+    }
+
+    for (Task *task : tasks) {
+      if (!task->finished && !task->ready && task->wakeAt <= clockUs) {
+        markReady(task);
+      }
+    }
+
+    // let the first core whose task has to carry on now execute it
+    Task *next = nullptr;
+    for (int core = 0; core < CORES && !next; core++) {
+      Task *task = holder(core);
+      next = task && task->computeLeft == 0 ? task : nullptr;
+    }
+    if (next) {
+      running = next;
+      next->wake.notify_one();
+      schedulerWake.wait(guard, [] { return running == nullptr; });
+      continue;
+    }
+
+    uint64_t step = nextStepAt();
+    if (step > until) {
+      advance(until);
+      return;
+    }
+    advance(step);
+  }
+}
+
+bool runUntil(std::function<bool()> condition, uint64_t timeoutUs, uint64_t stepUs) {
+  for (uint64_t waited = 0; waited < timeoutUs; waited += stepUs) {
+    if (condition()) {
+      return true;
+    }
+    run(stepUs);
+  }
+  return condition();
+}
+
+void shutdown() {
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stopping = true;
+    for (Task *task : tasks) {
+      task->wake.notify_one();
+    }
+  }
+  for (Task *task : tasks) {
+    task->thread.join();
+    delete task;
+  }
+  tasks.clear();
+  timers.clear();
+  std::fill(stalledUntil, stalledUntil + CORES, 0);
+  staller = nullptr;
+  stopping = false;
+}
+
+void forEachTask(std::function<void(const char *name, int core, uint64_t busyUs)> visit) {
+  for (Task *task : tasks) {
+    visit(task->name.c_str(), task->core, task->busyUs);
+  }
+}
+
+}
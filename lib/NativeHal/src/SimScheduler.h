@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+
+// Deterministic virtual-time scheduler used by the native build.
+//
+// Every FreeRTOS task runs on its own host thread, but only one of them executes
+// at any time: a task runs until it blocks (delay, notification wait, ...) or
+// spends CPU time, and the clock only moves forward when no task can run. Code
+// that runs on a task is charged a small amount of virtual CPU time per call into
+// the HAL, so busy loops still make progress and show up as CPU usage.
+//
+// Tasks are pinned to one of two cores. Each core gives its CPU time to the
+// ready task of the highest priority and rotates equal priorities every tick,
+// like FreeRTOS, so a task only delays the tasks on its own core.
+namespace sim {
+
+typedef void (*TaskFunction)(void *);
+
+static constexpr uint64_t CALL_COST_US = 1; // virtual cost of a HAL call made by a task
+static constexpr int CORES = 2;
+static constexpr uint64_t TICK_US = 1000; // FreeRTOS tick, when equal priorities take turns
+
+void *createTask(TaskFunction function, const char *name, void *parameter, int priority, int core, uint32_t stackBytes);
+const char *taskName(void *task);
+void *currentTask();
+int currentCore();
+uint32_t stackHighWater(void *task); // bytes of the task's stack never used, as far as the host frames tell
+
+uint64_t now();                             // virtual microseconds since start
+void spend(uint64_t us);                    // charge CPU time to the running task
+void stall(uint64_t us);                    // spend() with every other task halted, like flash writes with the cache off
+void sleepFor(uint64_t us);                 // block the running task, or run the simulation outside of tasks
+void yieldTask();                           // let ready tasks of the same priority run
+void at(uint64_t us, std::function<void()> callback); // run callback in interrupt context at a virtual time
+
+bool block(uint64_t timeoutUs);             // wait until unblock() or the timeout, false on timeout. UINT64_MAX waits forever
+void unblock(void *task);                   // wake a task waiting in block()
+void notify(void *task);                    // increment the task's notification value, wakes it if waiting
+uint32_t notifyTake(bool clear, uint64_t timeoutUs); // wait for a notification
+
+void run(uint64_t us);                      // advance the simulation
+bool runUntil(std::function<bool()> condition, uint64_t timeoutUs, uint64_t stepUs = 1000);
+void shutdown();                            // stop and join all tasks
+
+void forEachTask(std::function<void(const char *name, int core, uint64_t busyUs)> visit); // virtual CPU time used per task
+
+}
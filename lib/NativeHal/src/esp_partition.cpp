@@ -0,0 +1,103 @@
+#include "esp_partition.h"
+#include <vector>
+
+namespace {
+
+struct Partition {
+  esp_partition_t info;
+  std::vector<uint8_t> flash;
+};
+
+Partition partitions[] = {
+  {{nullptr, ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40, 0x290000, 0x170000, "shots", false}, {}},
+};
+
+uint32_t erases = 0;
+
+Partition *find(const esp_partition_t *partition) {
+  for (Partition &candidate : partitions) {
+    if (&candidate.info == partition) {
+      if (candidate.flash.empty()) {
+        candidate.flash.assign(candidate.info.size, 0xFF);
+      }
+      return &candidate;
+    }
+  }
+  return nullptr;
+}
+
+}
+
+namespace sim {
+
+uint32_t flashErases() {
+  return erases;
+}
+
+void flashErase() {
+  for (Partition &partition : partitions) {
+    partition.flash.assign(partition.info.size, 0xFF);
+  }
+}
+
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+  sim::spend(sim::CALL_COST_US);
+  for (Partition &partition : partitions) {
+    if (partition.info.type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.info.subtype == subtype) &&
+        (!label || !strcmp(partition.info.label, label))) {
+      return &partition.info;
+    }
+  }
+  return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size) {
+  Partition *target = find(partition);
+  if (!target || offset + size > partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  sim::spend(sim::CALL_COST_US);
+  memcpy(dst, &target->flash[offset], size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size) {
+  Partition *target = find(partition);
+  if (!target || offset + size > partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  sim::stall(sim::FLASH_WRITE_US);
+  const uint8_t *bytes = (const uint8_t *)src;
+  for (size_t i = 0; i < size; i++) {
+    target->flash[offset + i] &= bytes[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+  Partition *target = find(partition);
+  if (!target || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0 || offset + size > partition->size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  sim::stall(sim::FLASH_ERASE_US * (size / SPI_FLASH_SEC_SIZE));
+  memset(&target->flash[offset], 0xFF, size);
+  erases += size / SPI_FLASH_SEC_SIZE;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out_ptr, esp_partition_mmap_handle_t *out_handle) {
+  Partition *target = find(partition);
+  if (!target || offset + size > partition->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  sim::spend(sim::CALL_COST_US);
+  *out_ptr = &target->flash[offset];
+  *out_handle = 0;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include "Arduino.h"
+
+inline int64_t esp_timer_get_time() {
+  sim::spend(sim::CALL_COST_US);
+  return (int64_t)sim::now();
+}
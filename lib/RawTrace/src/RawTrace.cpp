@@ -0,0 +1,154 @@
+#include "RawTrace.h"
+
+namespace {
+
+uint8_t *put(uint8_t *out, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    *out++ = (uint8_t)(value >> (8 * i));
+  }
+  return out;
+}
+
+uint32_t get(const uint8_t *&in, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint32_t)*in++ << (8 * i);
+  }
+  return value;
+}
+
+int32_t signExtend(uint32_t value, size_t bytes) {
+  int shift = 32 - 8 * (int)bytes;
+  return (int32_t)(value << shift) >> shift;
+}
+
+size_t payloadSize(uint8_t type) {
+  switch (type) {
+  case RAW_TRACE_SAMPLE: return 1 + 4 + 3;
+  case RAW_TRACE_GRINDER: return 1 + 4 + 1;
+  case RAW_TRACE_SETTINGS: return 1 + 4 + RawTrace::settingsSize;
+  default: return 0;
+  }
+}
+
+}
+
+namespace RawTrace {
+
+uint8_t crc8(const uint8_t *data, size_t length) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t encode(const RawTraceRecord &record, uint8_t *frame) {
+  uint8_t payload[maxPayload];
+  uint8_t *out = payload;
+  *out++ = record.type;
+  out = put(out, record.timestampUs, 4);
+  if (record.type == RAW_TRACE_SAMPLE) {
+    out = put(out, (uint32_t)record.value, 3); // the HX711 converts to 24 bits
+  } else if (record.type == RAW_TRACE_GRINDER) {
+    *out++ = record.value ? 1 : 0;
+  } else if (record.type == RAW_TRACE_SETTINGS) {
+    const RawTraceSettings &settings = record.settings;
+    *out++ = settings.sps;
+    *out++ = settings.flags;
+    out = put(out, (uint32_t)settings.zeroCounts, 4);
+    out = put(out, (uint32_t)settings.calibrationHundredths, 4);
+    out = put(out, (uint16_t)settings.setWeightCg, 2);
+    out = put(out, (uint16_t)settings.cupWeightCg, 2);
+    out = put(out, (uint16_t)settings.offsetCg, 2);
+    out = put(out, (uint16_t)settings.stopLatencyMs, 2);
+    out = put(out, (uint16_t)settings.inFlightCg, 2);
+  }
+  *out = crc8(payload, out - payload);
+  out++;
+
+  // COBS: every zero is replaced by the distance to the next one
+  size_t length = 0;
+  frame[length++] = 0;
+  size_t code = length++;
+  for (const uint8_t *in = payload; in < out; in++) {
+    if (*in != 0) {
+      frame[length++] = *in;
+    }
+    if (*in == 0 || length - code == 0xFF) {
+      frame[code] = (uint8_t)(length - code);
+      code = length++;
+    }
+  }
+  frame[code] = (uint8_t)(length - code);
+  frame[length++] = 0;
+  return length;
+}
+
+}
+
+bool RawTraceDecoder::push(uint8_t byte, RawTraceRecord &record) {
+  if (byte != 0) {
+    if (length < sizeof(chunk)) {
+      chunk[length++] = byte;
+    } else {
+      overflow = true;
+    }
+    return false;
+  }
+  if (length == 0) {
+    return false; // delimiter between two frames
+  }
+  bool valid = !overflow && decode(record);
+  if (!valid) {
+    droppedChunks++;
+  }
+  length = 0;
+  overflow = false;
+  return valid;
+}
+
+bool RawTraceDecoder::decode(RawTraceRecord &record) {
+  uint8_t payload[RawTrace::maxFrame];
+  size_t size = 0;
+  for (size_t i = 0; i < length;) {
+    uint8_t code = chunk[i++];
+    if (i + code - 1 > length) {
+      return false;
+    }
+    for (uint8_t j = 1; j < code; j++) {
+      payload[size++] = chunk[i++];
+    }
+    if (code != 0xFF && i < length) {
+      payload[size++] = 0;
+    }
+  }
+
+  if (size < 2 || size - 1 != payloadSize(payload[0]) || RawTrace::crc8(payload, size - 1) != payload[size - 1]) {
+    return false;
+  }
+  const uint8_t *in = payload;
+  record = {};
+  record.type = *in++;
+  record.timestampUs = get(in, 4);
+  if (record.type == RAW_TRACE_SAMPLE) {
+    record.value = signExtend(get(in, 3), 3);
+  } else if (record.type == RAW_TRACE_GRINDER) {
+    record.value = *in++;
+  } else {
+    RawTraceSettings &settings = record.settings;
+    settings.sps = *in++;
+    settings.flags = *in++;
+    settings.zeroCounts = (int32_t)get(in, 4);
+    settings.calibrationHundredths = (int32_t)get(in, 4);
+    settings.setWeightCg = (int16_t)get(in, 2);
+    settings.cupWeightCg = (int16_t)get(in, 2);
+    settings.offsetCg = (int16_t)get(in, 2);
+    settings.stopLatencyMs = (int16_t)get(in, 2);
+    settings.inFlightCg = (int16_t)get(in, 2);
+  }
+  return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Record types of a raw load cell trace
+#define RAW_TRACE_SAMPLE 1 // one HX711 conversion
+#define RAW_TRACE_GRINDER 2 // grinder start (value 1) or stop (value 0) command
+#define RAW_TRACE_SETTINGS 3 // what the firmware ran with, sent when a capture starts
+
+#define RAW_TRACE_SCALE_MODE 0x01 // RawTraceSettings flags
+#define RAW_TRACE_CONTINUOUS 0x02
+#define RAW_TRACE_TOP_UP 0x04 // impulse mode doses are finished with bursts
+#define RAW_TRACE_BULK 0x08 // ... after a first stop well short of the target
+
+struct RawTraceSettings {
+	uint8_t sps; // LOADCELL_SPS of the firmware
+	uint8_t flags; // RAW_TRACE_*
+	int32_t zeroCounts; // tare offset at the time
+	int32_t calibrationHundredths; // counts per gram
+	int16_t setWeightCg;
+	int16_t cupWeightCg;
+	int16_t offsetCg;
+	int16_t stopLatencyMs;
+	int16_t inFlightCg;
+};
+
+struct RawTraceRecord {
+	uint8_t type; // RAW_TRACE_*
+	uint32_t timestampUs; // low 32 bits of the esp_timer clock, wraps every 71 minutes
+	int32_t value; // raw counts of a sample, 1/0 for a grinder command
+	RawTraceSettings settings; // RAW_TRACE_SETTINGS only
+};
+
+// Binary framing of raw load cell traces for the serial port.
+//
+// A record is a type byte, its fields little endian and a CRC-8, COBS encoded
+// and delimited by a zero byte on both sides. Text the firmware prints between
+// frames never contains a zero, so it ends up as a chunk of its own that fails
+// the checksum and is dropped, and the frames around it still decode. A sample
+// takes 12 bytes on the wire, under 1 KB per second at 80 SPS.
+namespace RawTrace {
+
+static constexpr size_t settingsSize = 20; // packed RawTraceSettings
+static constexpr size_t maxPayload = 1 + 4 + settingsSize + 1;
+static constexpr size_t maxFrame = maxPayload + maxPayload / 254 + 3;
+
+size_t encode(const RawTraceRecord &record, uint8_t *frame); // writes at most maxFrame bytes, returns how many
+uint8_t crc8(const uint8_t *data, size_t length);
+
+}
+
+// Turns a byte stream back into records
+class RawTraceDecoder {
+public:
+	bool push(uint8_t byte, RawTraceRecord &record); // true when byte completed a valid record
+	uint32_t dropped() const { return droppedChunks; } // chunks that were not a valid frame
+
+private:
+	bool decode(RawTraceRecord &record);
+
+	uint8_t chunk[RawTrace::maxFrame];
+	size_t length = 0;
+	bool overflow = false;
+	uint32_t droppedChunks = 0;
+};
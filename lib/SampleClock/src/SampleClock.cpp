@@ -0,0 +1,66 @@
+#include "SampleClock.h"
+
+namespace {
+
+// loop gains as shifts: phase 1/8, period 1/64 of the error per conversion,
+// a damped loop that settles within a few dozen conversions
+const int phaseShift = 3;
+const int periodShift = 6;
+const int jitterShift = 4; // jitter average over 16 conversions
+
+}
+
+SampleClock::SampleClock(uint32_t nominalPeriodUs) : nominalQ8((int64_t)nominalPeriodUs << 8) {
+  reset();
+  missedConversions = 0;
+}
+
+void SampleClock::reset() {
+  periodQ8 = nominalQ8;
+  clockQ8 = 0;
+  acquireStartQ8 = 0;
+  jitterQ8 = 0;
+  intervals = 0;
+  started = false;
+}
+
+int64_t SampleClock::update(int64_t reportedUs) {
+  int64_t reportedQ8 = reportedUs << 8;
+  if (!started) {
+    started = true;
+    clockQ8 = acquireStartQ8 = reportedQ8;
+    return reportedUs;
+  }
+
+  int64_t elapsedQ8 = reportedQ8 - clockQ8;
+  int64_t periods = (elapsedQ8 + periodQ8 / 2) / periodQ8;
+  if (periods > resyncPeriods) {
+    reset(); // the converter stopped or was unplugged, its phase is lost
+    return update(reportedUs);
+  }
+
+  if (!locked()) {
+    // average of the raw intervals, the loop needs a period to predict from
+    if (intervals > 0 && periods > 1) {
+      acquireStartQ8 = reportedQ8; // a conversion went missing, start averaging again
+      intervals = 0;
+    } else {
+      intervals++;
+      periodQ8 = (reportedQ8 - acquireStartQ8) / intervals;
+    }
+    clockQ8 = reportedQ8;
+    return reportedUs;
+  }
+
+  if (periods < 1) {
+    periods = 1; // reported early, the jitter is larger than half a period
+  }
+  missedConversions += (uint32_t)(periods - 1);
+
+  int64_t predictedQ8 = clockQ8 + periods * periodQ8;
+  int64_t errorQ8 = reportedQ8 - predictedQ8;
+  clockQ8 = predictedQ8 + (errorQ8 >> phaseShift);
+  periodQ8 += (errorQ8 >> periodShift) / periods;
+  jitterQ8 += ((errorQ8 < 0 ? -errorQ8 : errorQ8) - jitterQ8) >> jitterShift;
+  return clockQ8 >> 8;
+}
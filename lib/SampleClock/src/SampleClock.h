@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+
+// Timestamps for a converter that runs off its own oscillator, like the HX711.
+//
+// Conversion n is ready at start + n * period, but the interrupt reporting it
+// adds latency that differs from sample to sample. The clock first averages a
+// few intervals to find the period, then tracks phase and period with a second
+// order loop, so the timestamps it hands out follow oscillator drift without
+// the reporting jitter. Conversions that were never reported advance it by a
+// whole number of periods.
+class SampleClock {
+public:
+	explicit SampleClock(uint32_t nominalPeriodUs);
+
+	static constexpr uint32_t acquireIntervals = 8; // averaged before tracking starts
+	static constexpr uint32_t resyncPeriods = 16; // a longer gap starts over
+
+	int64_t update(int64_t reportedUs); // time of the conversion reported at reportedUs
+	void reset();
+
+	bool locked() const { return intervals >= acquireIntervals; }
+	uint32_t periodUs() const { return (uint32_t)((periodQ8 + 128) >> 8); } // measured once locked
+	uint32_t jitterUs() const { return (uint32_t)(jitterQ8 >> 8); } // average reporting jitter
+	uint32_t missed() const { return missedConversions; }
+
+private:
+	int64_t nominalQ8;
+	int64_t periodQ8; // us with 8 fraction bits
+	int64_t clockQ8; // time of the last conversion
+	int64_t acquireStartQ8;
+	int64_t jitterQ8;
+	uint32_t intervals;
+	uint32_t missedConversions;
+	bool started;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+// Sequence count for data with one writer task and any number of readers, none
+// of which ever blocks the other.
+//
+// The writer makes the count odd while it changes the data and even again when
+// it is done. A reader runs its query and keeps the result only if the count was
+// even and did not move meanwhile. A reader that keeps colliding, because it
+// preempted the writer on the writer's own core, sleeps a tick to let it finish.
+class SequenceCounter {
+public:
+	static constexpr int spinsBeforeSleep = 64;
+
+	void beginWrite(); // writer only
+	void endWrite(); // writer only
+
+	// Returns query() from a run no write overlapped. The query may see data half
+	// way through a write on the runs that are thrown away, so it must only read
+	// and compute its result from scratch.
+	template<typename F> auto read(F query) const -> decltype(query());
+
+private:
+	std::atomic<uint32_t> sequence{0};
+};
+
+// A value published by one task and copied by others without locks. The value is
+// kept as atomic words, so a copy that overlaps a publish is discarded rather
+// than undefined.
+template<typename T> class Seqlock {
+public:
+	static_assert(std::is_trivially_copyable<T>::value, "T is copied as raw words");
+
+	void publish(const T &value); // writer only
+	T read() const; // any task
+
+private:
+	static constexpr size_t words = (sizeof(T) + 3) / 4;
+
+	SequenceCounter counter;
+	std::atomic<uint32_t> data[words] = {};
+};
+
+#include "Seqlock.tpp"
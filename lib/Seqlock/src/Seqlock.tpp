@@ -0,0 +1,51 @@
+#include "Seqlock.h"
+
+inline void SequenceCounter::beginWrite() {
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release); // odd before any of the data changes
+}
+
+inline void SequenceCounter::endWrite() {
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template<typename F>
+auto SequenceCounter::read(F query) const -> decltype(query()) {
+  for (int attempt = 1;; attempt++) {
+    uint32_t before = sequence.load(std::memory_order_acquire);
+    if ((before & 1) == 0) {
+      auto result = query();
+      std::atomic_thread_fence(std::memory_order_acquire); // the data reads before the second look
+      if (sequence.load(std::memory_order_relaxed) == before) {
+        return result;
+      }
+    }
+    if (attempt % spinsBeforeSleep == 0) {
+      delay(1);
+    }
+  }
+}
+
+template<typename T>
+void Seqlock<T>::publish(const T &value) {
+  uint32_t raw[words] = {};
+  memcpy(raw, &value, sizeof(T));
+  counter.beginWrite();
+  for (size_t i = 0; i < words; i++) {
+    data[i].store(raw[i], std::memory_order_relaxed);
+  }
+  counter.endWrite();
+}
+
+template<typename T>
+T Seqlock<T>::read() const {
+  return counter.read([this] {
+    uint32_t raw[words];
+    for (size_t i = 0; i < words; i++) {
+      raw[i] = data[i].load(std::memory_order_relaxed);
+    }
+    T value;
+    memcpy(&value, raw, sizeof(T));
+    return value;
+  });
+}
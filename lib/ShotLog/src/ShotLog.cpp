@@ -0,0 +1,111 @@
+#include "ShotLog.h"
+
+uint16_t ShotLog::checksumOf(const ShotRecord &record) {
+  const uint8_t *bytes = (const uint8_t *)&record;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < sizeof(ShotRecord); i++) {
+    if (i == offsetof(ShotRecord, checksum) || i == offsetof(ShotRecord, checksum) + 1) {
+      continue;
+    }
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+bool ShotLog::sectorInUse(size_t sector) const {
+  const SectorHeader &header = *(const SectorHeader *)(mapped + sector * sectorSize);
+  return header.magic == magic && header.recordSize == sizeof(ShotRecord);
+}
+
+bool ShotLog::begin(const char *label) {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!partition || partition->size < sectorSize) {
+    return false;
+  }
+  const void *pointer;
+  if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &pointer, &mapping) != ESP_OK) {
+    return false;
+  }
+  mapped = (const uint8_t *)pointer;
+  sectors = partition->size / sectorSize;
+
+  // the newest sector has the highest sequence, compared with wrap around
+  bool found = false;
+  for (size_t sector = 0; sector < sectors; sector++) {
+    if (!sectorInUse(sector)) {
+      continue;
+    }
+    uint32_t sequence = ((const SectorHeader *)(mapped + sector * sectorSize))->sequence;
+    if (!found || (int32_t)(sequence - headSectorSequence) > 0) {
+      found = true;
+      headSector = sector;
+      headSectorSequence = sequence;
+    }
+  }
+  if (!found) {
+    // empty log, the first append takes sector 0 into use
+    headSector = sectors - 1;
+    headSlot = recordsPerSector;
+    return true;
+  }
+
+  headSlot = 0;
+  for (size_t slot = 0; slot < recordsPerSector; slot++) {
+    if (recordAt(headSector, slot).sequence != UINT32_MAX) {
+      headSlot = slot + 1; // an interrupted write still used up its slot
+    }
+  }
+  // continue the numbering of the newest intact record, the sector before if the
+  // newest one was taken into use but nothing made it into it
+  for (size_t back = 0; back < 2; back++) {
+    size_t sector = (headSector + sectors - back) % sectors;
+    for (size_t slot = recordsPerSector; sectorInUse(sector) && slot-- > 0;) {
+      const ShotRecord &record = recordAt(sector, slot);
+      if (record.sequence != UINT32_MAX && record.checksum == checksumOf(record)) {
+        nextSequence = record.sequence + 1;
+        boot = record.boot + 1;
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+bool ShotLog::append(ShotRecord &record) {
+  if (!mapped) {
+    return false;
+  }
+  if (headSlot >= recordsPerSector) {
+    size_t sector = (headSector + 1) % sectors;
+    if (esp_partition_erase_range(partition, sector * sectorSize, sectorSize) != ESP_OK) {
+      return false;
+    }
+    SectorHeader header = {magic, headSectorSequence + 1, sizeof(ShotRecord), {0, 0, 0}};
+    if (esp_partition_write(partition, sector * sectorSize, &header, sizeof(header)) != ESP_OK) {
+      return false;
+    }
+    headSector = sector;
+    headSectorSequence++;
+    headSlot = 0;
+  }
+
+  record.sequence = nextSequence;
+  record.boot = boot;
+  record.checksum = checksumOf(record);
+  size_t offset = headSector * sectorSize + sizeof(SectorHeader) + headSlot * sizeof(ShotRecord);
+  headSlot++;
+  if (esp_partition_write(partition, offset, &record, sizeof(record)) != ESP_OK) {
+    return false;
+  }
+  nextSequence++;
+  return true;
+}
+
+size_t ShotLog::count() const {
+  size_t records = 0;
+  forEach([&records](const ShotRecord &record) { records++; });
+  return records;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_partition.h>
+
+#define SHOT_CURVE_POINTS 32
+
+// ShotRecord flags
+#define SHOT_FINISHED 0x01 // reached the target, otherwise the dose failed
+#define SHOT_PREDICTED 0x02 // stopped by the dose predictor rather than the static offset
+#define SHOT_SETTLED 0x04 // dosed is the settled weight, otherwise the last one before the cup was lifted
+#define SHOT_SCALE_MODE 0x08
+#define SHOT_CONTINUOUS 0x10 // grinder held on by the relay instead of pulsed
+#define SHOT_BEAN_SHIFT 5 // bean profile in the two bits above the flags
+#define SHOT_BEAN_MASK 0x60
+#define SHOT_TOPPED_UP 0x80 // bursts after the stop delivered the rest of the dose
+
+// One dose, 96 bytes little endian. Weights are centigrams; tools/shots_to_csv.py
+// decodes the same layout.
+struct ShotRecord {
+	uint32_t sequence; // dose number, counts up across boots; all ones marks a free slot
+	uint16_t boot; // increments on every boot that logs a dose
+	uint16_t checksum; // CRC-16/CCITT of every other byte
+	uint32_t startedAtMs; // since boot
+	int16_t targetCg;
+	int16_t dosedCg;
+	int16_t offsetCg; // static offset at the time
+	int16_t cupCg;
+	uint16_t grindMs; // start to stop command
+	int16_t flowCgPerS; // fitted flow rate when stopped
+	int16_t stopLatencyMs; // stop model the prediction used
+	int16_t inFlightCg;
+	uint8_t flags; // SHOT_*
+	uint8_t curvePoints;
+	uint16_t curveIntervalMs;
+	int16_t curve[SHOT_CURVE_POINTS]; // weight above the cup, every curveIntervalMs from the start
+};
+
+static_assert(sizeof(ShotRecord) == 96, "ShotRecord layout is shared with the host tools");
+
+// Append-only log of ShotRecords in a flash partition.
+//
+// The partition is a ring of 4 KB sectors, each starting with a header that
+// numbers it. Records fill the newest sector; once it is full the oldest one
+// is erased and becomes the newest, so every sector sees the same number of
+// erases. Reads go through a memory mapping of the partition, a record whose
+// write was interrupted fails its checksum and is skipped.
+class ShotLog {
+public:
+	struct SectorHeader {
+		uint32_t magic;
+		uint32_t sequence; // counts up with every sector taken into use
+		uint16_t recordSize;
+		uint16_t reserved[3];
+	};
+
+	static constexpr size_t sectorSize = 4096;
+	static constexpr uint32_t magic = 0x544F4853; // "SHOT"
+	static constexpr size_t recordsPerSector = (sectorSize - sizeof(SectorHeader)) / sizeof(ShotRecord);
+
+	bool begin(const char *label); // maps the partition and finds where the log ends
+	bool append(ShotRecord &record); // fills in sequence, boot and checksum, blocks for the flash write
+
+	// Calls visit(const ShotRecord &) for every intact record, oldest first
+	template<typename F> void forEach(F visit) const {
+		for (size_t i = 1; i <= sectors; i++) {
+			size_t sector = (headSector + i) % sectors;
+			if (!sectorInUse(sector)) {
+				continue;
+			}
+			for (size_t slot = 0; slot < recordsPerSector; slot++) {
+				const ShotRecord &record = recordAt(sector, slot);
+				if (record.sequence != UINT32_MAX && record.checksum == checksumOf(record)) {
+					visit(record);
+				}
+			}
+		}
+	}
+
+	size_t count() const;
+	size_t capacity() const { return sectors * recordsPerSector; }
+
+	static uint16_t checksumOf(const ShotRecord &record);
+
+private:
+	bool sectorInUse(size_t sector) const;
+	const ShotRecord &recordAt(size_t sector, size_t slot) const {
+		return *(const ShotRecord *)(mapped + sector * sectorSize + sizeof(SectorHeader) + slot * sizeof(ShotRecord));
+	}
+
+	const esp_partition_t *partition = nullptr;
+	const uint8_t *mapped = nullptr;
+	esp_partition_mmap_handle_t mapping;
+	size_t sectors = 0;
+
+	size_t headSector = 0; // sector being filled
+	size_t headSlot = 0; // next free slot in it
+	uint32_t headSectorSequence = 0;
+	uint32_t nextSequence = 0;
+	uint16_t boot = 0;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free ring for exactly one producer and one consumer, e.g. an ISR or
+// acquisition task handing samples to a processing task. N must be a power of two.
+template<typename T, size_t N> class SpscQueue {
+public:
+	constexpr SpscQueue();
+
+	static constexpr size_t capacity = N;
+
+	bool push(const T &item); // producer only, false if the queue is full
+	bool pop(T &item); // consumer only, false if the queue is empty
+	size_t popBatch(T *items, size_t maxItems); // consumer only
+
+	size_t size() const;
+	bool empty() const;
+
+private:
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+
+	T items[N];
+	std::atomic<size_t> head; // next slot to write, only written by the producer
+	std::atomic<size_t> tail; // next slot to read, only written by the consumer
+};
+
+#include "SpscQueue.tpp"
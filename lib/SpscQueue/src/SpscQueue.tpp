@@ -0,0 +1,46 @@
+#include "SpscQueue.h"
+
+template<typename T, size_t N>
+constexpr SpscQueue<T,N>::SpscQueue() :
+		items(), head(0), tail(0) {
+}
+
+template<typename T, size_t N>
+bool SpscQueue<T, N>::push(const T &item) {
+  size_t writeIndex = head.load(std::memory_order_relaxed);
+  if (writeIndex - tail.load(std::memory_order_acquire) >= N) {
+    return false;
+  }
+
+  items[writeIndex & (N - 1)] = item;
+  head.store(writeIndex + 1, std::memory_order_release); // publish the item
+  return true;
+}
+
+template<typename T, size_t N>
+bool SpscQueue<T, N>::pop(T &item) {
+  return popBatch(&item, 1) == 1;
+}
+
+template<typename T, size_t N>
+size_t SpscQueue<T, N>::popBatch(T *out, size_t maxItems) {
+  size_t readIndex = tail.load(std::memory_order_relaxed);
+  size_t available = head.load(std::memory_order_acquire) - readIndex;
+  size_t n = available < maxItems ? available : maxItems;
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = items[(readIndex + i) & (N - 1)];
+  }
+  tail.store(readIndex + n, std::memory_order_release); // hand the slots back to the producer
+  return n;
+}
+
+template<typename T, size_t N>
+size_t SpscQueue<T, N>::size() const {
+  return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+template<typename T, size_t N>
+bool SpscQueue<T, N>::empty() const {
+  return size() == 0;
+}
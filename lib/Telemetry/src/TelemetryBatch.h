@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Telemetry event types, one letter each on the wire
+#define TELEMETRY_SAMPLE 'w' // value: weight in centigrams
+#define TELEMETRY_DOSE_STARTED 's' // value: target, extra: cup, both centigrams
+#define TELEMETRY_DOSE_FINISHED 'f' // value: dosed centigrams, extra: ms from start to stop, flags: ShotRecord flags
+#define TELEMETRY_DOSE_FAILED 'x' // same fields as TELEMETRY_DOSE_FINISHED
+#define TELEMETRY_OFFSET 'o' // value: static offset in centigrams
+
+struct TelemetryEvent {
+	uint32_t timestampMs; // since boot
+	int32_t value;
+	int32_t extra;
+	uint8_t type; // TELEMETRY_*
+	uint8_t bean;
+	uint8_t flags;
+};
+
+// Packs telemetry events into one text payload of at most N bytes, a line per
+// event:
+//
+//   w <ms> <interval> <cg> <cg> ...     weight samples, every interval ms from ms
+//   s <ms> <bean> <target> <cup>
+//   f <ms> <bean> <dosed> <grind ms> <flags>
+//   x <ms> <bean> <weight> <grind ms> <flags>
+//   o <ms> <bean> <offset>
+//
+// Samples that follow each other at sampleIntervalMs share a line, a gap starts
+// a new one. Weights are centigrams, times ms since boot.
+template<size_t N> class TelemetryBatch {
+public:
+	static_assert(N >= 64, "N leaves no room for a dose event");
+
+	explicit TelemetryBatch(uint32_t sampleIntervalMs) : sampleIntervalMs(sampleIntervalMs), lastSampleMs(0) { clear(); }
+
+	// false if the event doesn't fit, the batch is left as it was
+	bool add(const TelemetryEvent &event) {
+		char line[64];
+		int written;
+		if (event.type == TELEMETRY_SAMPLE) {
+			int32_t gap = (int32_t)(event.timestampMs - lastSampleMs) - (int32_t)sampleIntervalMs;
+			bool continues = inSampleRun && gap <= (int32_t)sampleIntervalMs / 2 && gap >= -(int32_t)sampleIntervalMs / 2;
+			written = continues ? snprintf(line, sizeof(line), " %ld", (long)event.value)
+			                    : snprintf(line, sizeof(line), "%sw %lu %lu %ld", used ? "\n" : "", (unsigned long)event.timestampMs,
+			                               (unsigned long)sampleIntervalMs, (long)event.value);
+		} else if (event.type == TELEMETRY_DOSE_STARTED) {
+			written = snprintf(line, sizeof(line), "%ss %lu %u %ld %ld", used ? "\n" : "", (unsigned long)event.timestampMs,
+			                   (unsigned)event.bean, (long)event.value, (long)event.extra);
+		} else if (event.type == TELEMETRY_DOSE_FINISHED || event.type == TELEMETRY_DOSE_FAILED) {
+			written = snprintf(line, sizeof(line), "%s%c %lu %u %ld %ld %u", used ? "\n" : "", (char)event.type,
+			                   (unsigned long)event.timestampMs, (unsigned)event.bean, (long)event.value, (long)event.extra,
+			                   (unsigned)event.flags);
+		} else if (event.type == TELEMETRY_OFFSET) {
+			written = snprintf(line, sizeof(line), "%so %lu %u %ld", used ? "\n" : "", (unsigned long)event.timestampMs,
+			                   (unsigned)event.bean, (long)event.value);
+		} else {
+			return true; // unknown, nothing to send
+		}
+		if (written <= 0 || used + (size_t)written >= N) {
+			return false;
+		}
+		memcpy(text + used, line, (size_t)written + 1);
+		used += written;
+		count++;
+		inSampleRun = event.type == TELEMETRY_SAMPLE;
+		if (inSampleRun) {
+			lastSampleMs = event.timestampMs;
+		}
+		return true;
+	}
+
+	void clear() {
+		used = 0;
+		count = 0;
+		inSampleRun = false;
+		text[0] = 0;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t events() const { return count; }
+	const char *payload() const { return text; }
+	size_t length() const { return used; }
+
+private:
+	char text[N];
+	size_t used;
+	size_t count;
+	uint32_t sampleIntervalMs;
+	uint32_t lastSampleMs;
+	bool inSampleRun;
+};
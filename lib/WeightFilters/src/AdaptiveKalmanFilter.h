@@ -0,0 +1,45 @@
+#pragma once
+
+// Kalman filter that trusts the measurements more while they move away from
+// the estimate, so it follows a ramp closely but averages hard at rest.
+//
+// Innovations larger than gate times the measurement error are taken as real
+// change and raise the estimate error by boost times the excess. The process
+// noise keeps the gain from decaying to zero at rest.
+template<typename T> class AdaptiveKalmanFilter {
+public:
+	typedef T Value;
+
+	constexpr AdaptiveKalmanFilter(T measurementError, T processNoise, T gate, T boost) :
+			measurementError(measurementError), processNoise(processNoise), gate(gate), boost(boost),
+			estimateError(measurementError), estimate(0) {}
+
+	T update(T measurement) {
+		T innovation = measurement - estimate;
+		T excess = (innovation < T(0) ? -innovation : innovation) - gate * measurementError;
+		if (excess > T(0)) {
+			estimateError += boost * excess;
+		}
+
+		T gain = estimateError / (estimateError + measurementError);
+		estimate += gain * innovation;
+		estimateError = (T(1) - gain) * estimateError + processNoise;
+		return estimate;
+	}
+
+	// the process noise is per sample, so it has to follow the sample rate
+	void setProcessNoise(T value) { processNoise = value; }
+
+	void reset(T value) {
+		estimate = value;
+		estimateError = measurementError;
+	}
+
+private:
+	T measurementError;
+	T processNoise;
+	T gate;
+	T boost;
+	T estimateError;
+	T estimate;
+};
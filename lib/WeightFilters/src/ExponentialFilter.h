@@ -0,0 +1,25 @@
+#pragma once
+
+// Exponential moving average, alpha is the weight of a new measurement.
+template<typename T> class ExponentialFilter {
+public:
+	typedef T Value;
+
+	constexpr ExponentialFilter(T alpha) : alpha(alpha), estimate(0), started(false) {}
+
+	T update(T measurement) {
+		estimate = started ? estimate + alpha * (measurement - estimate) : measurement;
+		started = true;
+		return estimate;
+	}
+
+	void reset(T value) {
+		estimate = value;
+		started = true;
+	}
+
+private:
+	T alpha;
+	T estimate;
+	bool started;
+};
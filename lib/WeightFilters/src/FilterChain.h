@@ -0,0 +1,26 @@
+#pragma once
+#include <tuple>
+
+// Runs a measurement through Stages in order, each stage being a filter with
+//   typedef ... Value; Value update(Value measurement); void reset(Value value);
+// The chain itself is such a filter, so chains can be nested.
+template<typename... Stages> class FilterChain {
+public:
+	typedef typename std::tuple_element<0, std::tuple<Stages...>>::type::Value Value;
+
+	constexpr FilterChain(Stages... stages) : stages(stages...) {}
+
+	Value update(Value measurement) {
+		std::apply([&measurement](Stages &...stage) { ((measurement = stage.update(measurement)), ...); }, stages);
+		return measurement;
+	}
+
+	void reset(Value value) {
+		std::apply([value](Stages &...stage) { (stage.reset(value), ...); }, stages);
+	}
+
+	template<size_t I> auto &stage() { return std::get<I>(stages); }
+
+private:
+	std::tuple<Stages...> stages;
+};
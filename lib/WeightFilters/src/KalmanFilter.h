@@ -0,0 +1,28 @@
+#pragma once
+
+// One dimensional Kalman filter, the same model as SimpleKalmanFilter but for
+// any number type T (float, double or Fixed).
+template<typename T> class KalmanFilter {
+public:
+	typedef T Value;
+
+	constexpr KalmanFilter(T measurementError, T estimateError, T processNoise) :
+			measurementError(measurementError), estimateError(estimateError), processNoise(processNoise), estimate(0) {}
+
+	T update(T measurement) {
+		T gain = estimateError / (estimateError + measurementError);
+		T previous = estimate;
+		estimate = previous + gain * (measurement - previous);
+		T change = estimate - previous;
+		estimateError = (T(1) - gain) * estimateError + (change < T(0) ? -change : change) * processNoise;
+		return estimate;
+	}
+
+	void reset(T value) { estimate = value; }
+
+private:
+	T measurementError;
+	T estimateError;
+	T processNoise;
+	T estimate;
+};
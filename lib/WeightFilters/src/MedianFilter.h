@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+
+// Median of the last N measurements, rejects spikes shorter than N / 2 samples.
+// Meant for small odd N.
+template<typename T, size_t N> class MedianFilter {
+public:
+	typedef T Value;
+	static_assert(N % 2 == 1, "N must be odd");
+
+	constexpr MedianFilter() : window(), head(0), count(0) {}
+
+	T update(T measurement) {
+		head = (head + 1) % N;
+		window[head] = measurement;
+		if (count < N) {
+			count++;
+		}
+
+		T sorted[N];
+		for (size_t i = 0; i < count; i++) {
+			T value = window[(head + N - i) % N];
+			size_t j = i;
+			for (; j > 0 && sorted[j - 1] > value; j--) {
+				sorted[j] = sorted[j - 1];
+			}
+			sorted[j] = value;
+		}
+		return sorted[count / 2];
+	}
+
+	void reset(T value) {
+		count = 0;
+		update(value);
+	}
+
+private:
+	T window[N];
+	size_t head;
+	size_t count;
+};
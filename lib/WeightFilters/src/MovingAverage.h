@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+// Average of the last N measurements, O(1) per sample with a running sum.
+template<typename T, size_t N> class MovingAverage {
+public:
+	typedef T Value;
+
+	constexpr MovingAverage() : window(), head(0), count(0), sum(0) {}
+
+	T update(T measurement) {
+		head = (head + 1) % N;
+		if (count == N) {
+			sum -= (Sum)window[head];
+		} else {
+			count++;
+		}
+		window[head] = measurement;
+		sum += (Sum)measurement;
+		return (T)(sum / (int64_t)count);
+	}
+
+	void reset(T value) {
+		count = 0;
+		sum = 0;
+		update(value);
+	}
+
+private:
+	// same running sum types as MathBuffer
+	template<typename V, typename = void> struct SumOf {
+		typedef typename std::conditional<std::is_floating_point<V>::value, V, int64_t>::type type;
+	};
+	template<typename V> struct SumOf<V, std::void_t<typename V::Wide>> {
+		typedef typename V::Wide type;
+	};
+	typedef typename SumOf<T>::type Sum;
+
+	T window[N];
+	size_t head;
+	size_t count;
+	Sum sum;
+};
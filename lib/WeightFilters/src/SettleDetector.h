@@ -0,0 +1,107 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Tells when the weight after the grinder stopped has converged, so a dose can be
+// judged as soon as its last grounds landed rather than after a fixed wait.
+//
+// Fed the filtered weight from the stop on. Settled means the tail, how long
+// grounds kept landing after earlier stops, has passed, and over the last N
+// samples the least squares slope is within maxSlope and the spread about the
+// mean is what noise explains. The tail is learned from the last rise of more
+// than riseNoises noise after each stop, so it follows the grinder and the
+// beans instead of covering the slowest case.
+//
+// T is a Fixed; everything is integer.
+template<typename T, size_t N> class SettleDetector {
+public:
+	static_assert(N >= 3, "need a few samples for a slope");
+
+	static constexpr int spreadNoises = 2; // rms about the mean allowed when settled
+	static constexpr int riseNoises = 2; // a rise of more than that is grounds landing
+
+	// maxSlope in grams per second, tails in ms, tailMs until one was measured
+	SettleDetector(T noise, T maxSlope, int64_t tailMs, int64_t minTailMs, int64_t maxTailMs)
+	    : noise(noise), maxSlope(maxSlope), tail(tailMs), minTail(minTailMs), maxTail(maxTailMs), head(0), count(0),
+	      stopMs(0), lastRiseMs(0) {}
+
+	// the grinder stopped, forgets the weights before
+	void stopped(int64_t ms) {
+		stopMs = ms;
+		lastRiseMs = ms;
+		count = 0;
+	}
+
+	void update(int64_t ms, T weight) {
+		if (count == 0 || weight > peak + noise * riseNoises) {
+			lastRiseMs = count == 0 ? stopMs : ms;
+			peak = weight;
+		}
+		head = (head + 1) % N;
+		times[head] = ms;
+		weights[head] = weight;
+		if (count < N) {
+			count++;
+		}
+	}
+
+	// true once the tail passed and the window is at rest, with its mean
+	bool settled(int64_t nowMs, T &weight) const {
+		if (count < N || nowMs - stopMs < tail) {
+			return false;
+		}
+		// relative to the oldest sample, which keeps the sums small
+		size_t oldest = (head + 1) % N;
+		int64_t t0 = times[oldest];
+		int32_t w0 = weights[oldest].raw();
+		int64_t st = 0, sw = 0, stt = 0, stw = 0, sww = 0;
+		for (size_t i = 0; i < N; i++) {
+			int64_t t = times[i] - t0;
+			int64_t w = weights[i].raw() - w0;
+			st += t;
+			sw += w;
+			stt += t * t;
+			stw += t * w;
+			sww += w * w;
+		}
+		int64_t n = N;
+		int64_t spread = (noise * spreadNoises).raw();
+		if (n * sww - sw * sw > n * n * spread * spread) {
+			return false;
+		}
+		// slope = (n stw - st sw) / (n stt - st st) in raw per ms
+		int64_t timeSpread = n * stt - st * st;
+		int64_t slope = n * stw - st * sw;
+		if (timeSpread <= 0 || (slope < 0 ? -slope : slope) * 1000 > maxSlope.raw() * timeSpread) {
+			return false;
+		}
+		weight = T::fromRaw((int32_t)(w0 + sw / n));
+		return true;
+	}
+
+	// folds the tail of the stop that just settled into the learned one, once
+	void learnTail() {
+		if (lastRiseMs > stopMs) { // nothing landed that was worth timing otherwise
+			tail += (lastRiseMs - stopMs - tail) / 4;
+			tail = tail < minTail ? minTail : tail > maxTail ? maxTail : tail;
+			lastRiseMs = stopMs;
+		}
+	}
+
+	int64_t tailMs() const { return tail; }
+	int64_t stoppedAtMs() const { return stopMs; }
+
+private:
+	T noise; // rms of the filtered weight at rest
+	T maxSlope;
+	int64_t tail;
+	int64_t minTail;
+	int64_t maxTail;
+	int64_t times[N];
+	T weights[N];
+	size_t head;
+	size_t count;
+	int64_t stopMs;
+	int64_t lastRiseMs;
+	T peak;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Tells when the last N measurements are at rest: their spread is what sensor
+// noise explains and their older and newer halves agree, so nothing is drifting
+// or still landing. A knock or a spike further than outlierNoises from the
+// median is left out, as long as there are few of them.
+//
+// T is a Fixed; everything is integer. Meant for N up to a few dozen, stable()
+// sorts the window.
+template<typename T, size_t N> class StabilityDetector {
+public:
+	typedef T Value;
+	typedef typename T::Wide Wide;
+	static_assert(N >= 4, "need two halves to compare");
+
+	static constexpr int outlierNoises = 4; // further from the median than that is an outlier
+	static constexpr int spreadNoises = 2; // rms about the mean allowed at rest
+	static constexpr size_t maxOutliers = N / 8 > 0 ? N / 8 : 1; // one even in a short window
+
+	explicit StabilityDetector(T noise) : noise(noise), head(0), count(0) {}
+
+	void update(T measurement) {
+		head = (head + 1) % N;
+		window[head] = measurement;
+		if (count < N) {
+			count++;
+		}
+	}
+
+	void reset() {
+		count = 0;
+	}
+
+	bool empty() const { return count == 0; }
+	bool full() const { return count == N; }
+
+	// true when the window is full and at rest, with the mean of its inliers
+	bool stable(T &mean) const {
+		if (!full()) {
+			return false;
+		}
+		T sorted[N];
+		for (size_t i = 0; i < N; i++) {
+			T value = window[i];
+			size_t j = i;
+			for (; j > 0 && sorted[j - 1] > value; j--) {
+				sorted[j] = sorted[j - 1];
+			}
+			sorted[j] = value;
+		}
+		T median = sorted[N / 2];
+		T limit = noise * outlierNoises;
+
+		// inliers in time order, split into the older and the newer half
+		Wide halves[2] = {0, 0};
+		size_t inliers[2] = {0, 0};
+		for (size_t age = 0; age < N; age++) {
+			T value = window[(head + N - age) % N];
+			if ((value - median).absolute() <= limit) {
+				size_t half = age < N / 2 ? 1 : 0;
+				halves[half] += value;
+				inliers[half]++;
+			}
+		}
+		if (inliers[0] == 0 || inliers[1] == 0 || N - inliers[0] - inliers[1] > maxOutliers) {
+			return false;
+		}
+		mean = T((halves[0] + halves[1]) / (int64_t)(inliers[0] + inliers[1]));
+
+		Wide squares = 0;
+		for (size_t i = 0; i < N; i++) {
+			if ((window[i] - median).absolute() <= limit) {
+				T deviation = window[i] - mean;
+				squares += Wide(deviation * deviation);
+			}
+		}
+		T spread = noise * spreadNoises;
+		if (T(squares / (int64_t)(inliers[0] + inliers[1])) > spread * spread) {
+			return false;
+		}
+		// each half mean scatters by noise * sqrt(2 / N), allow the spread on their difference
+		T drift = T(halves[1] / (int64_t)inliers[1]) - T(halves[0] / (int64_t)inliers[0]);
+		return drift.absolute() <= spread;
+	}
+
+private:
+	T noise; // rms of one measurement at rest
+	T window[N];
+	size_t head;
+	size_t count;
+};
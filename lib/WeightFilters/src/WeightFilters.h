@@ -0,0 +1,10 @@
+#pragma once
+// Filter stages for load cell readings, usable alone or combined with FilterChain.
+#include "KalmanFilter.h"
+#include "AdaptiveKalmanFilter.h"
+#include "MedianFilter.h"
+#include "ExponentialFilter.h"
+#include "MovingAverage.h"
+#include "FilterChain.h"
+#include "StabilityDetector.h"
+#include "SettleDetector.h"
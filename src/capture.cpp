@@ -0,0 +1,96 @@
+#include "capture.hpp"
+#include "settings.hpp"
+#include "tasks.hpp"
+#include <SpscQueue.h>
+#include <esp_timer.h>
+
+TaskHandle_t CaptureTask = NULL;
+Print *volatile captureOut = NULL; // set once the settings frame went out
+SpscQueue<RawTraceRecord, CAPTURE_SAMPLE_QUEUE_SIZE> captureSamples; // ScaleTask to CaptureTask
+SpscQueue<RawTraceRecord, CAPTURE_GRINDER_QUEUE_SIZE> captureCommands; // ScaleStatusTask to CaptureTask
+
+// Each counter has a single writer, the task named
+volatile uint32_t samplesDropped = 0; // ScaleTask
+volatile uint32_t commandsDropped = 0; // ScaleStatusTask
+uint32_t droppedBefore = 0; // both counters when the capture started
+
+void writeRecord(Print &out, const RawTraceRecord &record) {
+  uint8_t frame[RawTrace::maxFrame];
+  out.write(frame, RawTrace::encode(record, frame)); // one write, so text other tasks print stays between frames
+}
+
+// Writes what the dosing tasks queued, or throws it away once the capture stopped
+void captureLoop(void *parameter) {
+  RawTraceRecord record;
+  for (;;) {
+    delay(CAPTURE_DRAIN_MS);
+    Print *out = captureOut;
+    while (captureCommands.pop(record)) {
+      if (out) {
+        writeRecord(*out, record);
+      }
+    }
+    while (captureSamples.pop(record)) {
+      if (out) {
+        writeRecord(*out, record);
+      }
+    }
+  }
+}
+
+void startCapture(Print &out) {
+  double latency, inFlight;
+  loadStopModel(latency, inFlight);
+
+  RawTraceRecord record = {};
+  record.type = RAW_TRACE_SETTINGS;
+  record.timestampUs = (uint32_t)esp_timer_get_time();
+  RawTraceSettings &settings = record.settings;
+  settings.sps = LOADCELL_SPS;
+  settings.flags = (loadScaleMode() ? RAW_TRACE_SCALE_MODE : 0) | (loadGrindMode() ? RAW_TRACE_CONTINUOUS : 0) |
+                   (impulseProgram != GRIND_PROGRAM_SINGLE ? RAW_TRACE_TOP_UP : 0) |
+                   (impulseProgram == GRIND_PROGRAM_BULK ? RAW_TRACE_BULK : 0);
+  settings.zeroCounts = (int32_t)loadcellZero();
+  settings.calibrationHundredths = (int32_t)lround(loadCalibration() * 100);
+  settings.setWeightCg = (int16_t)(Weight::Wide(loadSetWeight()) * 100).round();
+  settings.cupWeightCg = (int16_t)(Weight::Wide(loadCupWeight()) * 100).round();
+  settings.offsetCg = (int16_t)(Weight::Wide(loadOffset()) * 100).round();
+  settings.stopLatencyMs = (int16_t)lround(latency * 1000);
+  settings.inFlightCg = (int16_t)lround(inFlight * 100);
+  writeRecord(out, record);
+  droppedBefore = samplesDropped + commandsDropped;
+  captureOut = &out;
+  if (CaptureTask == NULL) {
+    startTask(TASK_CAPTURE, captureLoop, &CaptureTask);
+  }
+}
+
+void stopCapture() {
+  captureOut = NULL;
+}
+
+bool capturing() {
+  return captureOut != NULL;
+}
+
+uint32_t captureDropped() {
+  return samplesDropped + commandsDropped - droppedBefore;
+}
+
+void captureSample(const LoadcellSample &sample) {
+  if (captureOut) {
+    RawTraceRecord record = {RAW_TRACE_SAMPLE, (uint32_t)sample.timestampUs, sample.raw};
+    if (!captureSamples.push(record)) {
+      samplesDropped = samplesDropped + 1;
+    }
+  }
+}
+
+void captureGrinder(int64_t timestampUs, bool on) {
+  if (captureOut) {
+    RawTraceRecord record = {RAW_TRACE_GRINDER, (uint32_t)timestampUs, on ? 1 : 0};
+    if (!captureCommands.push(record)) {
+      commandsDropped = commandsDropped + 1;
+    }
+  }
+}
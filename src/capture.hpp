@@ -0,0 +1,25 @@
+#pragma once
+
+#include "scale.hpp"
+#include <RawTrace.h>
+
+// Raw load cell capture: while on, every HX711 conversion and grinder command
+// is streamed in the RawTrace framing, starting with the settings the firmware
+// runs with. 'r' on the serial console toggles it, tools/capture_raw.py saves
+// the stream and the native build replays it with --replay.
+//
+// ScaleTask and ScaleStatusTask only push records onto a lock-free queue each,
+// CaptureTask on the UI core writes them out, so a full UART never holds up a
+// sample or a relay edge. Records that don't fit a queue are dropped and
+// counted; the replay copes with gaps.
+#define CAPTURE_SAMPLE_QUEUE_SIZE 128 // samples waiting for CaptureTask, 1.6 s at 80 SPS, a power of two
+#define CAPTURE_GRINDER_QUEUE_SIZE 16 // grinder commands, a power of two
+#define CAPTURE_DRAIN_MS 20 // between writes
+
+void startCapture(Print &out); // writes the settings, starts CaptureTask the first time
+void stopCapture();
+bool capturing();
+uint32_t captureDropped(); // records lost to a full queue since the capture started
+
+void captureSample(const LoadcellSample &sample); // ScaleTask, before the sample is processed
+void captureGrinder(int64_t timestampUs, bool on); // ScaleStatusTask, after the command went to the relay
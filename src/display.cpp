@@ -1,10 +1,46 @@
 #include "display.hpp"
+#include "tasks.hpp"
+#include "session.hpp"
 
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0);
 
 TaskHandle_t DisplayTask;
 
 #define SLEEP_AFTER_MS 60 * 1000 // sleep after 10 seconds
+#define REFRESH_INTERVAL 50 // ms between frames
+#define GRINDING_REFRESH_INTERVAL 20 // ms between frames while grinding
+#define TILE_BYTES 8 // a tile is 8x8 pixels, one byte per column
+
+uint8_t sentFrame[128 * 64 / 8]; // frame buffer as last sent to the display
+bool sentFrameValid = false;
+
+// Sends only the 8x8 tiles that changed since the last frame, one transfer per
+// tile row from its first to its last changed tile. Nothing is sent for an
+// unchanged frame.
+void sendChangedTiles() {
+  uint8_t *frame = u8g2.getBufferPtr();
+  uint8_t tileWidth = u8g2.getBufferTileWidth();
+  uint8_t tileHeight = u8g2.getBufferTileHeight();
+  size_t rowBytes = tileWidth * TILE_BYTES;
+
+  for (uint8_t ty = 0; ty < tileHeight; ty++) {
+    uint8_t *row = frame + ty * rowBytes;
+    uint8_t *sentRow = sentFrame + ty * rowBytes;
+    int first = -1;
+    int last = -1;
+    for (uint8_t tx = 0; tx < tileWidth; tx++) {
+      if (!sentFrameValid || memcmp(row + tx * TILE_BYTES, sentRow + tx * TILE_BYTES, TILE_BYTES) != 0) {
+        first = first < 0 ? tx : first;
+        last = tx;
+      }
+    }
+    if (first >= 0) {
+      u8g2.updateDisplayArea(first, ty, last - first + 1, 1);
+      memcpy(sentRow + first * TILE_BYTES, row + first * TILE_BYTES, (last - first + 1) * TILE_BYTES);
+    }
+  }
+  sentFrameValid = true;
+}
 
 void CenterPrintToScreen(char const *str, u8g2_uint_t y) {
   u8g2_uint_t width = u8g2.getStrWidth(str);
@@ -37,152 +73,103 @@ void RightPrintToScreen(char const *str, u8g2_uint_t y)
   u8g2.print(str);
 }
 
-void showMenu(){
-  int prevIndex = (currentMenuItem - 1) % menuItemsCount;
-  int nextIndex = (currentMenuItem + 1) % menuItemsCount;
+void showMenu(const ScaleState &state){
+  int prevIndex = (state.menuItem - 1) % menuItemsCount;
+  int nextIndex = (state.menuItem + 1) % menuItemsCount;
 
   prevIndex = prevIndex < 0 ? prevIndex + menuItemsCount : prevIndex;
-  MenuItem prev = menuItems[prevIndex];
-  MenuItem current = menuItems[currentMenuItem];
-  MenuItem next = menuItems[nextIndex];
-  char buf[3];
   u8g2.clearBuffer();
   u8g2.setFontPosTop();
   u8g2.setFont(u8g2_font_7x14B_tf);
   CenterPrintToScreen("Menu", 0);
   u8g2.setFont(u8g2_font_7x13_tr);
-  LeftPrintToScreen(prev.menuName, 19);
-  LeftPrintActiveToScreen(current.menuName, 35);
-  LeftPrintToScreen(next.menuName, 51);
-
-  u8g2.sendBuffer();
+  LeftPrintToScreen(menuItems[prevIndex].name, 19);
+  LeftPrintActiveToScreen(menuItems[state.menuItem].name, 35);
+  LeftPrintToScreen(menuItems[nextIndex].name, 51);
 }
 
-void showOffsetMenu(){
-  char buf[16];
+// title of a setting, leaves the font for its lines
+void showSettingTitle(const MenuItem &item) {
   u8g2.clearBuffer();
   u8g2.setFontPosTop();
   u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Adjust offset", 0);
+  CenterPrintToScreen(item.title, 0);
   u8g2.setFont(u8g2_font_7x13_tr);
-  snprintf(buf, sizeof(buf), "%3.2fg", offset);
-  CenterPrintToScreen(buf, 28);
-  u8g2.sendBuffer();
 }
 
-
-
-void showScaleModeMenu()
-{
-  char buf[16];
-  u8g2.clearBuffer();
-  u8g2.setFontPosTop();
-  u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Set Scale Mode", 0);
-  u8g2.setFont(u8g2_font_7x13_tr);
-  if(scaleMode){
-    LeftPrintToScreen("GBW", 19);
-    LeftPrintActiveToScreen("Scale only", 35);
+// line row of item, from describe if it has one for it
+const char *settingLine(const MenuItem &item, const ScaleState &state, uint8_t row, char *buf, size_t size) {
+  if (item.describe && item.describe(state, row, buf, size)) {
+    return buf;
   }
-  else{
-    LeftPrintActiveToScreen("GBW", 19);
-    LeftPrintToScreen("Scale only", 35);
-  }
-  u8g2.sendBuffer();
+  return item.lines[row];
 }
 
-void showGrindModeMenu()
-{
-  char buf[16];
-  u8g2.clearBuffer();
-  u8g2.setFontPosTop();
-  u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Set Grinder ", 0);
-  CenterPrintToScreen("Sart/Stop Mode", 19);
-  u8g2.setFont(u8g2_font_7x13_tr);
-  if (grindMode)
-  {
-    LeftPrintActiveToScreen("Continuous", 35);
-    LeftPrintToScreen("Impulse", 51);
-  }
-  else
-  {
-    LeftPrintToScreen("Continuous", 35);
-    LeftPrintActiveToScreen("Impulse", 51);
+void showNothing(const MenuItem &item, const ScaleState &state) {}
+
+void showAction(const MenuItem &item, const ScaleState &state) {
+  char buf[32];
+  showSettingTitle(item);
+  for (uint8_t row = 0; row < 3; row++) {
+    const char *line = settingLine(item, state, row, buf, sizeof(buf));
+    if (line) {
+      CenterPrintToScreen(line, 19 + 16 * row);
+    }
   }
-  u8g2.sendBuffer();
 }
 
-void showCupMenu()
-{
+void showValue(const MenuItem &item, const ScaleState &state) {
   char buf[16];
-  u8g2.clearBuffer();
-  u8g2.setFontPosTop();
-  u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Cup Weight", 0);
-  u8g2.setFont(u8g2_font_7x13_tr);
-  snprintf(buf, sizeof(buf), "%3.1fg", scaleWeight);
-  CenterPrintToScreen(buf, 19);
-  LeftPrintToScreen("Place cup on scale", 35);
-  LeftPrintToScreen("and press button", 51);
-  u8g2.sendBuffer();
-}
-
-void showCalibrationMenu(){
-  u8g2.clearBuffer();
-  u8g2.setFontPosTop();
-  u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Calibration", 0);
-  u8g2.setFont(u8g2_font_7x13_tr);
-  CenterPrintToScreen("Place 100g weight", 19);
-  CenterPrintToScreen("on scale and", 35);
-  CenterPrintToScreen("press button", 51);
-  u8g2.sendBuffer();
+  showSettingTitle(item);
+  snprintf(buf, sizeof(buf), "%3.2fg", state.menuValue.toFloat());
+  CenterPrintToScreen(buf, 28);
 }
 
-void showResetMenu()
-{
-  char buf[16];
-  u8g2.clearBuffer();
-  u8g2.setFontPosTop();
-  u8g2.setFont(u8g2_font_7x14B_tf);
-  CenterPrintToScreen("Reset to defaults?", 0);
-  u8g2.setFont(u8g2_font_7x13_tr);
-  if (greset)
-  {
-    LeftPrintActiveToScreen("Confirm", 19);
-    LeftPrintToScreen("Cancel", 35);
+// the true and false labels with the one picked highlighted, then describe's last line
+void showToggle(const MenuItem &item, const ScaleState &state) {
+  char buf[32];
+  showSettingTitle(item);
+  if (state.menuFlag) {
+    LeftPrintActiveToScreen(item.lines[0], 19);
+    LeftPrintToScreen(item.lines[1], 35);
+  } else {
+    LeftPrintToScreen(item.lines[0], 19);
+    LeftPrintActiveToScreen(item.lines[1], 35);
   }
-  else
-  {
-    LeftPrintToScreen("Confirm", 19);
-    LeftPrintActiveToScreen("Cancel", 35);
+  const char *line = settingLine(item, state, 2, buf, sizeof(buf));
+  if (line) {
+    LeftPrintToScreen(line, 51);
   }
-  u8g2.sendBuffer();
 }
 
-void showSetting(){
-  if(currentSetting == 2){
-    showOffsetMenu();
-  }
-  else if(currentSetting == 0){
-    showCupMenu();
-  }
-  else if (currentSetting == 1)
-  {
-    showCalibrationMenu();
-  }
-  else if (currentSetting == 3)
-  {
-    showScaleModeMenu();
-  }
-  else if (currentSetting == 4)
-  {
-    showGrindModeMenu();
+// describe's lines, the first one is what was chosen
+void showChoice(const MenuItem &item, const ScaleState &state) {
+  char buf[32];
+  showSettingTitle(item);
+  for (uint8_t row = 0; row < 3; row++) {
+    const char *line = settingLine(item, state, row, buf, sizeof(buf));
+    if (line && row == 0) {
+      LeftPrintActiveToScreen(line, 19);
+    } else if (line) {
+      LeftPrintToScreen(line, 19 + 16 * row);
+    }
   }
-  else if (currentSetting == 6)
-  {
-    showResetMenu();
+}
+
+// by MenuItem::editor
+void (*const settingScreens[MENU_EDITORS])(const MenuItem &item, const ScaleState &state) = {
+  /* MENU_COMMAND */ showNothing,
+  /* MENU_ACTION */  showAction,
+  /* MENU_VALUE */   showValue,
+  /* MENU_TOGGLE */  showToggle,
+  /* MENU_CONFIRM */ showToggle,
+  /* MENU_CHOICE */  showChoice,
+};
+
+void showSetting(const ScaleState &state){
+  if (state.setting >= 0 && state.setting < menuItemsCount) {
+    const MenuItem &item = menuItems[state.setting];
+    settingScreens[item.editor](item, state);
   }
 }
 
@@ -190,22 +177,29 @@ void updateDisplay( void * parameter) {
   char buf[64];
   char buf2[64];
 
+  // the I2C driver takes its interrupt on the core that installs it, keep it off the acquisition core
+  u8g2.begin();
+  u8g2.setFont(u8g2_font_7x13_tr);
+  u8g2.setFontPosTop();
+  u8g2.drawStr(0, 20, "Hello");
+
   for(;;) {
+    ScaleState state = readScaleState();
     u8g2.clearBuffer();
-    if (millis() - lastSignificantWeightChangeAt > SLEEP_AFTER_MS) {
-      u8g2.sendBuffer();
-      delay(50);
+    if (millis() - state.lastSignificantWeightChangeAt > SLEEP_AFTER_MS) {
+      sendChangedTiles();
+      delay(REFRESH_INTERVAL);
       continue;
     }
 
-    if (scaleLastUpdatedAt == 0) {
+    if (state.updatedAt == 0) {
       u8g2.setFontPosTop();
       u8g2.drawStr(0, 20, "Initializing...");
-    } else if (!scaleReady) {
+    } else if (!state.ready) {
       u8g2.setFontPosTop();
       u8g2.drawStr(0, 20, "SCALE ERROR");
     } else {
-      if (scaleStatus == STATUS_GRINDING_IN_PROGRESS) {
+      if (state.status == STATUS_GRINDING_IN_PROGRESS) {
         u8g2.setFontPosTop();
         u8g2.setFont(u8g2_font_7x13_tr);
         CenterPrintToScreen("Grinding...", 0);
@@ -214,7 +208,7 @@ void updateDisplay( void * parameter) {
         u8g2.setFontPosCenter();
         u8g2.setFont(u8g2_font_7x14B_tf);
         u8g2.setCursor(3, 32);
-        snprintf(buf, sizeof(buf), "%3.1fg", scaleWeight - cupWeightEmpty);
+        snprintf(buf, sizeof(buf), "%3.1fg", (state.weight - state.cupWeight).toFloat());
         u8g2.print(buf);
 
         u8g2.setFontPosCenter();
@@ -224,14 +218,14 @@ void updateDisplay( void * parameter) {
         u8g2.setFontPosCenter();
         u8g2.setFont(u8g2_font_7x14B_tf);
         u8g2.setCursor(84, 32);
-        snprintf(buf, sizeof(buf), "%3.1fg", setWeight);
+        snprintf(buf, sizeof(buf), "%3.1fg", state.setWeight.toFloat());
         u8g2.print(buf);
 
         u8g2.setFontPosBottom();
         u8g2.setFont(u8g2_font_7x13_tr);
-        snprintf(buf, sizeof(buf), "%3.1fs", startedGrindingAt > 0 ? (double)(millis() - startedGrindingAt) / 1000 : 0);
+        snprintf(buf, sizeof(buf), "%3.1fs", state.startedGrindingAt > 0 ? (double)(millis() - state.startedGrindingAt) / 1000 : 0);
         CenterPrintToScreen(buf, 64);
-      } else if (scaleStatus == STATUS_EMPTY) {
+      } else if (state.status == STATUS_EMPTY) {
         u8g2.setFontPosTop();
         u8g2.setFont(u8g2_font_7x13_tr);
         CenterPrintToScreen("Weight:", 0);
@@ -239,17 +233,18 @@ void updateDisplay( void * parameter) {
         u8g2.setFont(u8g2_font_7x14B_tf);
         u8g2.setFontPosCenter();
         u8g2.setCursor(0, 28);
-        snprintf(buf, sizeof(buf), "%3.1fg", abs(scaleWeight));
+        snprintf(buf, sizeof(buf), "%3.1fg", state.weight.absolute().toFloat());
         CenterPrintToScreen(buf, 32);
 
         u8g2.setFont(u8g2_font_7x13_tf);
         u8g2.setFontPosCenter();
         u8g2.setCursor(5, 50);
-        snprintf(buf2, sizeof(buf2), "Set: %3.1fg", setWeight);
+        snprintf(buf2, sizeof(buf2), "Set: %3.1fg", state.setWeight.toFloat());
         LeftPrintToScreen(buf2, 50);
+        RightPrintToScreen(state.beanName, 50);
 
         
-      } else if (scaleStatus == STATUS_GRINDING_FAILED) {
+      } else if (state.status == STATUS_GRINDING_FAILED) {
 
         u8g2.setFontPosTop();
         u8g2.setFont(u8g2_font_7x14B_tf);
@@ -259,17 +254,17 @@ void updateDisplay( void * parameter) {
         u8g2.setFont(u8g2_font_7x13_tr);
         CenterPrintToScreen("Press the balance", 32);
         CenterPrintToScreen("to reset", 42);
-      } else if (scaleStatus == STATUS_GRINDING_FINISHED) {
+      } else if (state.status == STATUS_GRINDING_FINISHED || state.status == STATUS_TOPPING_UP) {
 
         u8g2.setFontPosTop();
         u8g2.setFont(u8g2_font_7x13_tr);
         u8g2.setCursor(0, 0);
-        CenterPrintToScreen("Grinding finished", 0);
+        CenterPrintToScreen(state.status == STATUS_TOPPING_UP ? "Topping up..." : "Grinding finished", 0);
 
         u8g2.setFontPosCenter();
         u8g2.setFont(u8g2_font_7x14B_tf);
         u8g2.setCursor(3, 32);
-        snprintf(buf, sizeof(buf), "%3.1fg", scaleWeight - cupWeightEmpty);
+        snprintf(buf, sizeof(buf), "%3.1fg", (state.weight - state.cupWeight).toFloat());
         u8g2.print(buf);
 
         u8g2.setFontPosCenter();
@@ -279,41 +274,33 @@ void updateDisplay( void * parameter) {
         u8g2.setFontPosCenter();
         u8g2.setFont(u8g2_font_7x14B_tf);
         u8g2.setCursor(84, 32);
-        snprintf(buf, sizeof(buf), "%3.1fg", setWeight);
+        snprintf(buf, sizeof(buf), "%3.1fg", state.setWeight.toFloat());
         u8g2.print(buf);
 
         u8g2.setFontPosBottom();
         u8g2.setFont(u8g2_font_7x13_tr);
         u8g2.setCursor(64, 64);
-        snprintf(buf, sizeof(buf), "%3.1fs", (double)(finishedGrindingAt - startedGrindingAt) / 1000);
+        if (state.sessionMode) {
+          snprintf(buf, sizeof(buf), "#%u  %3.1fs", (unsigned)sessionStats().started, (double)(state.finishedGrindingAt - state.startedGrindingAt) / 1000);
+        } else {
+          snprintf(buf, sizeof(buf), "%3.1fs", (double)(state.finishedGrindingAt - state.startedGrindingAt) / 1000);
+        }
         CenterPrintToScreen(buf, 64);
       }
-      else if (scaleStatus == STATUS_IN_MENU)
+      else if (state.status == STATUS_IN_MENU)
       {
-        showMenu();
+        showMenu(state);
       }
-      else if (scaleStatus == STATUS_IN_SUBMENU)
+      else if (state.status == STATUS_IN_SUBMENU)
       {
-        showSetting();
+        showSetting(state);
       }
     }
-    u8g2.sendBuffer();
-    delay(50);
+    sendChangedTiles();
+    delay(state.status == STATUS_GRINDING_IN_PROGRESS ? GRINDING_REFRESH_INTERVAL : REFRESH_INTERVAL);
   }
 }
 
 void setupDisplay() {
-  u8g2.begin();
-  u8g2.setFont(u8g2_font_7x13_tr);
-  u8g2.setFontPosTop();
-  u8g2.drawStr(0, 20, "Hello");
-
-  xTaskCreatePinnedToCore(
-      updateDisplay, /* Function to implement the task */
-      "Display", /* Name of the task */
-      10000,  /* Stack size in words */
-      NULL,  /* Task input parameter */
-      0,  /* Priority of the task */
-      &DisplayTask,  /* Task handle. */
-      1); /* Core where the task should run */
+  startTask(TASK_DISPLAY, updateDisplay, &DisplayTask);
 }
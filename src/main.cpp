@@ -5,14 +5,68 @@
 
 #include "display.hpp"
 #include "scale.hpp"
+#include "shots.hpp"
+#include "capture.hpp"
+#include "tasks.hpp"
+#include "settings.hpp"
+#include "telemetry.hpp"
+#include "session.hpp"
 
-WiFiClient espClient;
-PubSubClient client(espClient);
+// Telemetry is off unless the build names a broker, e.g.
+// -DTELEMETRY_BROKER=\"192.168.1.201\" -DWIFI_SSID=\"ssid\" -DWIFI_PASSWORD=\"pw\"
+#ifndef WIFI_SSID
+#define WIFI_SSID "ssid"
+#endif
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD "pw"
+#endif
+#ifndef TELEMETRY_PORT
+#define TELEMETRY_PORT 1883
+#endif
 
-//wifi not used for now. Maybe OTA later
-const char *ssid = "ssid"; // Change this to your WiFi SSID
-const char *password = "pw"; // Change this to your WiFi password
-long lastReconnectAttempt = 0;
+// MQTT over WiFi with PubSubClient, only used from TelemetryTask
+class MqttLink : public TelemetryLink {
+public:
+  MqttLink() : client(wifiClient) {}
+
+  bool connected() override {
+    return client.connected();
+  }
+
+  bool connect() override {
+    if (WiFi.status() != WL_CONNECTED) {
+      if (!wifiStarted) {
+        WiFi.begin(WIFI_SSID, WIFI_PASSWORD); // joins in the background
+        wifiStarted = true;
+      }
+      return false;
+    }
+#ifdef TELEMETRY_BROKER
+    client.setServer(TELEMETRY_BROKER, TELEMETRY_PORT);
+#endif
+    client.setBufferSize(TELEMETRY_PAYLOAD_SIZE + 64); // header and topic on top of the payload
+    if (!client.connect("coffee-scale")) {
+      return false;
+    }
+    Serial.println("Connected to MQTT");
+    return true;
+  }
+
+  bool publish(const char *topic, const char *payload, size_t length) override {
+    return client.publish(topic, (const uint8_t *)payload, length);
+  }
+
+  void poll() override {
+    client.loop();
+  }
+
+private:
+  WiFiClient wifiClient;
+  PubSubClient client;
+  bool wifiStarted = false;
+};
+
+MqttLink mqttLink;
 
 
 void setup() {
@@ -25,45 +79,42 @@ void setup() {
 
   Serial.println();
   Serial.println("******************************************************");
-  // Serial.print("Connecting to ");
-  // Serial.println(ssid);
-
-  // WiFi.begin(ssid, password);
-
-  // while (WiFi.status() != WL_CONNECTED) {
-  //   delay(500);
-  //   Serial.print(".");
-  // }
-
-  // Serial.println("");
-  // Serial.println("WiFi connected");
-  // Serial.println("IP address: ");
-  // Serial.println(WiFi.localIP());
-  // lastReconnectAttempt = 0;
-  // client.setServer("192.168.1.201", 1883);
-}
-
-boolean reconnect() {
-  if (client.connect("coffee-scale")) {
-    // Once connected, publish an announcement...
-    Serial.println("Connected to MQTT");
-  }
-  return client.connected();
+#ifdef TELEMETRY_BROKER
+  setupTelemetry(mqttLink);
+#endif
 }
 
 void loop() {
-  // if (!client.connected()) {
-  //   long now = millis();
-  //   if (now - lastReconnectAttempt > 5000) {
-  //     lastReconnectAttempt = now;
-  //     // Attempt to reconnect
-  //     if (reconnect()) {
-  //       lastReconnectAttempt = 0;
-  //     }
-  //   }
-  // } else {
-  //   client.loop();
-  // }
   //rotary_loop();
+  while (Serial.available() > 0) {
+    int command = Serial.read();
+    if (command == 't') {
+      printLatencySummary(Serial);
+    } else if (command == 'd') {
+      dumpLatencyTrace(Serial);
+    } else if (command == 's') {
+      printTaskSummary(Serial);
+    } else if (command == 'm') {
+      printTelemetrySummary(Serial);
+    } else if (command == 'c') {
+      printSessionSummary(Serial);
+    } else if (command == 'h') {
+      exportShots(Serial);
+    } else if (command == 'n') {
+      // n<name> renames the active bean
+      String name = Serial.readStringUntil('\n');
+      name.trim();
+      if (name.length() > 0) {
+        saveBeanName(name.c_str());
+      }
+    } else if (command == 'r') {
+      if (capturing()) {
+        stopCapture();
+        Serial.printf("Capture stopped, %u records dropped\n", (unsigned)captureDropped());
+      } else {
+        startCapture(Serial);
+      }
+    }
+  }
   delay(1000);
 }
@@ -1,262 +1,253 @@
 #include "scale.hpp"
+#include "settings.hpp"
+#include "shots.hpp"
+#include "capture.hpp"
+#include "tasks.hpp"
+#include "telemetry.hpp"
+#include "session.hpp"
 #include <MathBuffer.h>
+#include <SpscQueue.h>
+#include <DosePredictor.h>
+#include <BurstModel.h>
+#include <LatencyTrace.h>
+#include <SampleClock.h>
+#include <Seqlock.h>
 #include <AiEsp32RotaryEncoder.h>
-#include <Preferences.h>
+#include <esp_timer.h>
 
 HX711 loadcell;
-SimpleKalmanFilter kalmanFilter(0.02, 0.02, 0.01);
-
-Preferences preferences;
+GrindingFilter grindingFilter = makeGrindingFilter();
+ScaleFilter scaleFilter = makeScaleFilter();
+bool filterScaleMode = false; // mode the filters were last run for
+int32_t gramsPerCount = 0; // grams per HX711 count, with 32 fraction bits
 
 
 AiEsp32RotaryEncoder rotaryEncoder = AiEsp32RotaryEncoder(ROTARY_ENCODER_A_PIN, ROTARY_ENCODER_B_PIN, ROTARY_ENCODER_BUTTON_PIN, ROTARY_ENCODER_VCC_PIN, ROTARY_ENCODER_STEPS);
 
 #define ABS(a) (((a) > 0) ? (a) : ((a) * -1))
 
+TaskHandle_t LoadcellTask;
 TaskHandle_t ScaleTask;
 TaskHandle_t ScaleStatusTask;
 
-double scaleWeight = 0; //current weight
-double setWeight = 0; //desired amount of coffee
-double setCupWeight = 0; //cup weight set by user
-double offset = 0; //stop x grams prios to set weight
+Weight scaleWeight = 0; //current weight
+Weight setWeight = 0; //desired amount of coffee
+Weight setCupWeight = 0; //cup weight set by user
+Weight offset = 0; //stop x grams prios to set weight
 bool scaleMode = false; //use as regular scale with timer if true
 bool grindMode = false;  //false for impulse to start/stop grinding, true for continuous on while grinding
+bool sessionMode = false; // cups back to back, not kept over a restart
 bool grinderActive = false; //needed for continuous mode
-MathBuffer<double, 100> weightHistory;
+uint8_t activeBean = 0; // bean profile setWeight, setCupWeight, offset and predictor belong to
+#define HISTORY_MS 10000 // longest window over weightHistory
+SharedMathBuffer<Weight, samplesIn(HISTORY_MS) + samplesIn(1000), 5> weightHistory; // a second to spare for a fast oscillator
+int window10s, window1s, window500ms, window200ms, windowCupStable; // sliding windows over weightHistory
+SpscQueue<LoadcellSample, SAMPLE_QUEUE_SIZE> sampleQueue; // raw conversions from LoadcellTask to ScaleTask
+SampleClock sampleClock(1000000 / LOADCELL_SPS); // only used by LoadcellTask
+uint32_t samplePeriodUs = 0; // last measured period ScaleTask saw
+volatile int64_t loadcellReadyAtUs = 0;
+volatile bool loadcellReading = false;
+StabilityDetector<Weight, samplesIn(TARE_WINDOW_MS)> restDetector{Weight(LOADCELL_NOISE)}; // on unfiltered grams
+bool taring = false; // waiting for restDetector to find the new zero
+bool zeroed = false; // false until the boot tare, there is no weight to report before
+unsigned long tareStartedAt = 0;
+
+DosePredictor predictor(STOP_LATENCY_DEFAULT, IN_FLIGHT_DEFAULT);
+static_assert(samplesIn(DosePredictor::flowWindowMs) < DosePredictor::maxSamples, "flow window needs more samples at this rate");
+bool stoppedByPrediction = false;
+bool learnPending = false; // the last stop waits for its settled weight to learn from
+Weight stopAim = 0; // where the last stop was meant to leave the cup
+Weight stopFlow = 0; // flow rate the dose was stopped at, bursts run at it
+
+// Grind programs as data, the status handlers run them a stage at a time.
+// TOPPING_UP covers every stage after the first that doesn't grind continuously.
+constexpr GrindProgram grindPrograms[GRIND_PROGRAMS] = {
+  /* GRIND_PROGRAM_SINGLE */ {"single", 1, {{GRIND_RUN, 1000, 0, 0}}},
+  /* GRIND_PROGRAM_PULSE */  {"pulse", 3, {{GRIND_RUN, 1000, -(int16_t)(TOPUP_MARGIN * 100), 0},
+                                           {GRIND_SETTLE, 1000, 0, 0},
+                                           {GRIND_PULSE, 1000, 0, TOPUP_MAX_BURSTS}}},
+  /* GRIND_PROGRAM_BULK */   {"bulk", 5, {{GRIND_RUN, BULK_PERMILLE, 0, 0},
+                                          {GRIND_SETTLE, 1000, 0, 0},
+                                          {GRIND_PULSE, 1000, -(int16_t)(TOPUP_MARGIN * 100), 1},
+                                          {GRIND_SETTLE, 1000, 0, 0},
+                                          {GRIND_PULSE, 1000, 0, TOPUP_MAX_BURSTS}}},
+};
+static_assert(grindPrograms[GRIND_PROGRAM_SINGLE].valid() && grindPrograms[GRIND_PROGRAM_PULSE].valid() &&
+              grindPrograms[GRIND_PROGRAM_BULK].valid(), "a grind program has to start with a run");
+uint8_t impulseProgram = IMPULSE_PROGRAM;
+const GrindProgram *grindProgram = &grindPrograms[GRIND_PROGRAM_SINGLE]; // running
+uint8_t grindStage = 0;
+unsigned long stageStartedAt = 0;
+int stageBursts = 0;
+
+BurstModel burstModel(TOPUP_DEAD_MS, TOPUP_MIN_MS, TOPUP_MAX_MS);
+SettleDetector<Weight, samplesIn(SETTLE_WINDOW_MS)> settleDetector{Weight(LOADCELL_NOISE), Weight(SETTLE_MAX_SLOPE), SETTLE_TAIL_MS,
+                                                                  SETTLE_MIN_TAIL_MS, SETTLE_MAX_TAIL_MS}; // after the last stop or burst
+int topUpBursts = 0; // run for the current dose
+bool burstRunning = false;
+uint32_t burstMs = 0;
+unsigned long burstStoppedAt = 0;
+Weight burstStartWeight = 0; // settled weight before the burst
+
+DosePredictor::Model beanModels[BEAN_PROFILES]; // stop models of the other beans, as learned since boot
+bool beanModelLearned[BEAN_PROFILES] = {};
+
+LatencyTrace latencyTrace;
+const char *const traceStageNames[TRACE_STAGES] = {"hx711 ready", "raw read", "filter", "history push", "decision", "relay"};
+volatile uint16_t traceSample = 0; // number of the last conversion signalled by the HX711
+uint16_t decidingSample = 0; // sample behind the status machine's current decision
+
+QueueHandle_t statusEvents; // wakes up scaleStatusLoop
+int64_t statusDeadline = NO_DEADLINE; // when to send EVENT_DEADLINE to the current status
 
-unsigned long scaleLastUpdatedAt = 0;
 unsigned long lastSignificantWeightChangeAt = 0;
 unsigned long lastTareAt = 0; // if 0, should tare load cell, else represent when it was last tared
-bool scaleReady = false;
 int scaleStatus = STATUS_EMPTY;
-double cupWeightEmpty = 0; //measured actual cup weight
+Weight cupWeightEmpty = 0; //measured actual cup weight
 unsigned long startedGrindingAt = 0;
 unsigned long finishedGrindingAt = 0;
 int encoderDir = 1;
-bool greset = false;
-
-bool newOffset = false;
-unsigned long lastWeightStableAt = 0;
-double lastStableWeight = 0;
-
-int currentMenuItem = 0;
-int currentSetting;
 int encoderValue = 0;
-int menuItemsCount = 7;
-MenuItem menuItems[7] = {
-    {1, false, "Cup weight", 1, &setCupWeight},
-    {2, false, "Calibrate", 0},
-    {3, false, "Offset", 0.1, &offset},
-    {4, false, "Scale Mode", 0},
-    {5, false, "Grinding Mode", 0},
-    {6, false, "Exit", 0},
-    {7, false, "Reset", 0}}; // structure is mostly useless for now, plan on making menu easier to customize later
-
-// Helper functions for safe parameter storage/retrieval
-uint16_t calculateChecksum(const ScaleSettings& settings) {
-  return settings.offsetTenths + settings.cupWeightTenths + settings.setWeightTenths + 
-         (settings.calibrationHundredths & 0xFFFF) + ((settings.calibrationHundredths >> 16) & 0xFFFF) +
-         settings.scaleMode + settings.grindMode + 0xABCD;
-}
-
-void saveOffset(double newOffset) {
-  // Validate reasonable range
-  if (newOffset < MIN_OFFSET || newOffset > MAX_OFFSET) {
-    Serial.print("Invalid offset ");
-    Serial.print(newOffset);
-    Serial.println(", using default");
-    newOffset = COFFEE_DOSE_OFFSET;
-  }
-  
-  preferences.begin("scale", false);
-  preferences.putShort("offsetHuns", (int16_t)(newOffset * 100));
-  preferences.end();
-  
-  Serial.print("Saved offset: ");
-  Serial.println(newOffset);
-}
 
-void saveCupWeight(double newCupWeight) {
-  if (newCupWeight < MIN_CUP_WEIGHT || newCupWeight > MAX_CUP_WEIGHT) {
-    Serial.print("Invalid cup weight ");
-    Serial.print(newCupWeight);
-    Serial.println(", using default");
-    newCupWeight = CUP_WEIGHT;
-  }
-  
-  preferences.begin("scale", false);
-  preferences.putShort("cupWeightTenths", (int16_t)(newCupWeight * 10));
-  preferences.end();
-  
-  Serial.print("Saved cup weight: ");
-  Serial.println(newCupWeight);
+// converted once here so samples only take an integer multiply
+void setCalibration(double countsPerGram) {
+  loadcell.set_scale(countsPerGram);
+  gramsPerCount = (int32_t)constrain(llround(4294967296.0 / countsPerGram), (long long)INT32_MIN, (long long)INT32_MAX);
 }
 
-void saveSetWeight(double newSetWeight) {
-  if (newSetWeight < MIN_SET_WEIGHT || newSetWeight > MAX_SET_WEIGHT) {
-    Serial.print("Invalid set weight ");
-    Serial.print(newSetWeight);
-    Serial.println(", using default");
-    newSetWeight = COFFEE_DOSE_WEIGHT;
+// Makes bean the active profile: its dose settings and the stop model learned for it
+void applyBean(uint8_t bean) {
+  beanModels[activeBean] = predictor.learned();
+  beanModelLearned[activeBean] = true;
+  activeBean = bean % BEAN_PROFILES;
+  saveActiveBean(activeBean);
+
+  setWeight = loadSetWeight();
+  offset = loadOffset();
+  setCupWeight = loadCupWeight();
+  if (beanModelLearned[activeBean]) {
+    predictor.setModel(beanModels[activeBean]);
+  } else {
+    double stopLatency, inFlight;
+    loadStopModel(stopLatency, inFlight);
+    predictor.setModel(stopLatency, inFlight);
   }
-  
-  preferences.begin("scale", false);
-  preferences.putShort("setWeightTenths", (int16_t)(newSetWeight * 10));
-  preferences.end();
-  
-  Serial.print("Saved set weight: ");
-  Serial.println(newSetWeight);
+  Serial.printf("Bean %u: set weight %.1fg, latency %.3fs, in flight %.2fg\n", activeBean + 1, setWeight.toFloat(),
+                predictor.latency(), predictor.inFlight());
 }
 
-void saveCalibration(double newCalibration) {  
-  preferences.begin("scale", false);
-  preferences.putInt("calibration", (int32_t)(newCalibration * 100));
-  preferences.end();
-  
-  Serial.print("Saved calibration: ");
-  Serial.println(newCalibration);
+// Menu entries, run by ScaleStatusTask. done returns false to stay on the screen.
+
+bool saveCupSetting() {
+  if (scaleWeight <= 15) { // prevent accidental setting with no cup
+    return false;
+  }
+  setCupWeight = scaleWeight;
+  saveCupWeight(setCupWeight);
+  return true;
 }
 
-void saveScaleMode(bool mode) {
-  preferences.begin("scale", false);
-  preferences.putBool("scaleMode", mode);
-  preferences.end();
+bool calibrate() {
+  double newCalibrationValue = loadCalibration() * (scaleWeight.toDouble() / 100);
+  saveCalibration(newCalibrationValue);
+  setCalibration(newCalibrationValue);
+  return true;
 }
 
-void saveGrindMode(bool mode) {
-  preferences.begin("scale", false);
-  preferences.putBool("grindMode", mode);
-  preferences.end();
+bool saveOffsetSetting() {
+  saveOffset(offset);
+  return true;
 }
 
-double loadOffset() {
-  preferences.begin("scale", true);
-  int16_t offsetHuns = preferences.getShort("offsetHuns", (int16_t)(COFFEE_DOSE_OFFSET * 100));
-  preferences.end();
-  
-  double offset = offsetHuns / 100.0;
-  
-  // Validate loaded value
-  if (offset < MIN_OFFSET || offset > MAX_OFFSET) {
-    Serial.println("Loaded offset out of range, using default");
-    offset = COFFEE_DOSE_OFFSET;
-    saveOffset(offset); // Save corrected value
-  }
-  
-  return offset;
+bool saveScaleModeSetting() {
+  saveScaleMode(scaleMode);
+  return true;
 }
 
-double loadCupWeight() {
-  preferences.begin("scale", true);
-  int16_t cupWeightTenths = preferences.getShort("cupWeightTenths", (int16_t)(CUP_WEIGHT * 10));
-  preferences.end();
-  
-  double cupWeight = cupWeightTenths / 10.0;
-  
-  if (cupWeight < MIN_CUP_WEIGHT || cupWeight > MAX_CUP_WEIGHT) {
-    Serial.println("Loaded cup weight out of range, using default");
-    cupWeight = CUP_WEIGHT;
-    saveCupWeight(cupWeight);
-  }
-  
-  return cupWeight;
+bool saveGrindModeSetting() {
+  saveGrindMode(grindMode);
+  return true;
 }
 
-double loadSetWeight() {
-  preferences.begin("scale", true);
-  int16_t setWeightTenths = preferences.getShort("setWeightTenths", (int16_t)(COFFEE_DOSE_WEIGHT * 10));
-  preferences.end();
-  
-  double setWeight = setWeightTenths / 10.0;
-  
-  if (setWeight < MIN_SET_WEIGHT || setWeight > MAX_SET_WEIGHT) {
-    Serial.println("Loaded set weight out of range, using default");
-    setWeight = COFFEE_DOSE_WEIGHT;
-    saveSetWeight(setWeight);
+bool resetSettings() {
+  resetToDefaults();
+  setWeight = COFFEE_DOSE_WEIGHT;
+  offset = Weight(COFFEE_DOSE_OFFSET);
+  setCupWeight = CUP_WEIGHT;
+  scaleMode = false;
+  grindMode = false;
+  activeBean = 0;
+  for (bool &learned : beanModelLearned) {
+    learned = false;
   }
-  
-  return setWeight;
+  predictor.setModel(STOP_LATENCY_DEFAULT, IN_FLIGHT_DEFAULT);
+  setCalibration(LOADCELL_SCALE_FACTOR);
+  return true;
 }
 
-double loadCalibration() {
-  preferences.begin("scale", true);
-  int32_t calibrationHundredths = preferences.getInt("calibration", (int32_t)(LOADCELL_SCALE_FACTOR * 100));
-  preferences.end();
-  
-  double calibration = calibrationHundredths / 100.0;
-  
-  return calibration;
+// the bean is switched and saved while turning
+void selectBean(int steps) {
+  applyBean((activeBean + BEAN_PROFILES + steps % BEAN_PROFILES) % BEAN_PROFILES);
 }
 
-bool loadScaleMode() {
-  preferences.begin("scale", true);
-  bool mode = preferences.getBool("scaleMode", false);
-  preferences.end();
-  return mode;
+bool describeBean(const ScaleState &state, uint8_t row, char *buf, size_t size) {
+  if (row == 0) {
+    snprintf(buf, size, "%u: %s", state.bean + 1, state.beanName);
+  } else if (row == 1) {
+    snprintf(buf, size, "Set: %3.1fg", state.setWeight.toFloat());
+  } else {
+    snprintf(buf, size, "Cup: %3.1fg", state.setCupWeight.toFloat());
+  }
+  return true;
 }
 
-bool loadGrindMode() {
-  preferences.begin("scale", true);
-  bool mode = preferences.getBool("grindMode", false);
-  preferences.end();
-  return mode;
+bool describeCup(const ScaleState &state, uint8_t row, char *buf, size_t size) {
+  if (row == 0) {
+    snprintf(buf, size, "%3.1fg", state.weight.toFloat());
+  }
+  return row == 0;
 }
 
-void resetToDefaults() {
-  Serial.println("Resetting all parameters to defaults");
-  saveOffset(COFFEE_DOSE_OFFSET);
-  saveCupWeight(CUP_WEIGHT);
-  saveSetWeight(COFFEE_DOSE_WEIGHT);
-  saveCalibration(LOADCELL_SCALE_FACTOR);
-  saveScaleMode(false);
-  saveGrindMode(false);
+bool switchSession() {
+  if (sessionMode) {
+    startSession(); // also starts over a session that was on
+  } else {
+    stopSession();
+  }
+  return true;
 }
 
-bool validateAndLoadSettings() {
-  ScaleSettings settings;
-  
-  preferences.begin("scale", true);
-  
-  // Try to load settings structure
-  size_t schLen = preferences.getBytesLength("settings");
-  if (schLen == sizeof(ScaleSettings)) {
-    preferences.getBytes("settings", &settings, sizeof(ScaleSettings));
-    
-    // Verify checksum
-    uint16_t expectedChecksum = calculateChecksum(settings);
-    if (settings.checksum == expectedChecksum) {
-      Serial.println("Settings loaded and validated successfully");
-      preferences.end();
-      return true;
-    } else {
-      Serial.println("Settings checksum mismatch, using individual parameters");
-    }
-  } else {
-    Serial.println("Settings structure not found or wrong size, using individual parameters");
+bool describeSession(const ScaleState &state, uint8_t row, char *buf, size_t size) {
+  SessionStats stats = sessionStats();
+  if (row == 2 && stats.doses > 0) {
+    snprintf(buf, size, "%u cups so far", (unsigned)stats.doses);
+    return true;
   }
-  
-  preferences.end();
   return false;
 }
 
-void saveSettingsStructure() {
-  ScaleSettings settings;
-  
-  settings.offsetTenths = (int16_t)(offset * 10);
-  settings.cupWeightTenths = (int16_t)(setCupWeight * 10);
-  settings.setWeightTenths = (int16_t)(setWeight * 10);
-  settings.calibrationHundredths = (int32_t)(loadCalibration() * 100);
-  settings.scaleMode = scaleMode ? 1 : 0;
-  settings.grindMode = grindMode ? 1 : 0;
-  settings.checksum = calculateChecksum(settings);
-  
-  preferences.begin("scale", false);
-  preferences.putBytes("settings", &settings, sizeof(ScaleSettings));
-  preferences.end();
-  
-  Serial.println("Settings structure saved with checksum");
-}
+// In the order of the list. The sim finds Beans, Exit and Session by index.
+constexpr MenuItem menuItems[] = {
+    menuAction<Weight, ScaleState>("Cup weight", "Cup Weight", saveCupSetting, nullptr, "Place cup on scale",
+                                   "and press button", describeCup),
+    menuAction<Weight, ScaleState>("Calibrate", "Calibration", calibrate, "Place 100g weight", "on scale and",
+                                   "press button"),
+    menuValue<Weight, ScaleState>("Offset", "Adjust offset", &offset, Weight(0.01), Weight(MIN_OFFSET),
+                                  Weight(MAX_OFFSET), saveOffsetSetting),
+    menuToggle<Weight, ScaleState>("Scale Mode", "Set Scale Mode", &scaleMode, "Scale only", "GBW",
+                                   saveScaleModeSetting),
+    menuToggle<Weight, ScaleState>("Grinding Mode", "Start/Stop Mode", &grindMode, "Continuous", "Impulse",
+                                   saveGrindModeSetting),
+    menuCommand<Weight, ScaleState>("Exit"),
+    menuConfirm<Weight, ScaleState>("Reset", "Reset to defaults?", resetSettings),
+    menuChoice<Weight, ScaleState>("Beans", "Select Beans", selectBean, describeBean),
+    menuToggle<Weight, ScaleState>("Session", "Session Mode", &sessionMode, "Cups in a row", "Off", switchSession,
+                                   describeSession),
+};
+const int menuItemsCount = sizeof(menuItems) / sizeof(menuItems[0]);
+static_assert(menuValid(menuItems), "a menu entry lacks what its editor needs");
+
+Menu<Weight, ScaleState> menu(menuItems);
 
 void rotary_onButtonClick()
 {
@@ -266,161 +257,43 @@ void rotary_onButtonClick()
   {
     return;
   }
-  if(scaleStatus == STATUS_EMPTY){
+  if (scaleStatus == STATUS_EMPTY) {
     scaleStatus = STATUS_IN_MENU;
-    currentMenuItem = 0;
+    menu.open();
     rotaryEncoder.setAcceleration(0);
+    return;
   }
-  else if(scaleStatus == STATUS_IN_MENU){
-    if(currentMenuItem == 5){
-      scaleStatus = STATUS_EMPTY;
-      rotaryEncoder.setAcceleration(150);
-      Serial.println("Exited Menu");
-    }
-    else if (currentMenuItem == 2){
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 2;
-      Serial.println("Offset Menu");
-    }
-    else if (currentMenuItem == 0)
-    {
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 0;
-      Serial.println("Cup Menu");
-    }
-    else if (currentMenuItem == 1)
-    {
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 1;
-      Serial.println("Calibration Menu");
-    }
-    else if (currentMenuItem == 3)
-    {
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 3;
-      Serial.println("Scale Mode Menu");
-    }
-    else if (currentMenuItem == 4)
-    {
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 4;
-      Serial.println("Grind Mode Menu");
-    }
-    else if (currentMenuItem == 6)
-    {
-      scaleStatus = STATUS_IN_SUBMENU;
-      currentSetting = 6;
-      greset = false;
-      Serial.println("Reset Menu");
-    }
-  }
-  else if(scaleStatus == STATUS_IN_SUBMENU){
-    if(currentSetting == 2){
-      saveOffset(offset);
-      scaleStatus = STATUS_IN_MENU;
-      currentSetting = -1;
-    }
-    else if (currentSetting == 0)
-    {
-      if(scaleWeight > 15){       //prevent accidental setting with no cup
-        setCupWeight = scaleWeight;
-        saveCupWeight(setCupWeight);
-        scaleStatus = STATUS_IN_MENU;
-        currentSetting = -1;
-      }
-    }
-    else if (currentSetting == 1)
-    {
-      double currentCalibration = loadCalibration();
-      double newCalibrationValue = currentCalibration * (scaleWeight / 100);
-      saveCalibration(newCalibrationValue);
-      loadcell.set_scale(newCalibrationValue);
-      scaleStatus = STATUS_IN_MENU;
-      currentSetting = -1;
-    }
-    else if (currentSetting == 3)
-    {
-      saveScaleMode(scaleMode);
-      scaleStatus = STATUS_IN_MENU;
-      currentSetting = -1;
-    }
-    else if (currentSetting == 4)
-    {
-      saveGrindMode(grindMode);
-      scaleStatus = STATUS_IN_MENU;
-      currentSetting = -1;
-    }
-    else if (currentSetting == 6)
-    {
-      if(greset){
-        resetToDefaults();
-        setWeight = COFFEE_DOSE_WEIGHT;
-        offset = COFFEE_DOSE_OFFSET;
-        setCupWeight = CUP_WEIGHT;
-        scaleMode = false;
-        grindMode = false;
-        loadcell.set_scale(LOADCELL_SCALE_FACTOR);
-      }
-      
-      scaleStatus = STATUS_IN_MENU;
-      currentSetting = -1;
+  uint8_t result = menu.click();
+  if (result == MENU_CLOSED) {
+    scaleStatus = STATUS_EMPTY;
+    rotaryEncoder.setAcceleration(150);
+    Serial.println("Exited Menu");
+  } else if (result == MENU_EDITING) {
+    if (scaleStatus == STATUS_IN_MENU) {
+      Serial.printf("%s Menu\n", menu.current().name);
     }
+    scaleStatus = STATUS_IN_SUBMENU;
+  } else {
+    scaleStatus = STATUS_IN_MENU;
   }
 }
 
-
-
 void rotary_loop()
 {
   if (rotaryEncoder.encoderChanged())
   {
-    if(scaleStatus == STATUS_EMPTY){
-        int newValue = rotaryEncoder.readEncoder();
-        Serial.print("Value: ");
-
-        setWeight += ((float)newValue - (float)encoderValue) / 10 * encoderDir;
-
-        encoderValue = newValue;
-        Serial.println(newValue);
-        saveSetWeight(setWeight);
-      }
-    else if(scaleStatus == STATUS_IN_MENU){
-      int newValue = rotaryEncoder.readEncoder();
-      int encoderDiff = newValue - encoderValue;
-      
-      // Only move one menu item at a time to prevent skipping
-      if (encoderDiff > 0) {
-        currentMenuItem = (currentMenuItem + 1 * encoderDir) % menuItemsCount;
-      } else if (encoderDiff < 0) {
-        currentMenuItem = (currentMenuItem - 1 * encoderDir) % menuItemsCount;
-      }
-      
-      currentMenuItem = currentMenuItem < 0 ? menuItemsCount + currentMenuItem : currentMenuItem;
-      encoderValue = newValue;
-      Serial.println(currentMenuItem);
-    }
-    else if(scaleStatus == STATUS_IN_SUBMENU){
-      if(currentSetting == 2){ //offset menu
-        int newValue = rotaryEncoder.readEncoder();
-        Serial.print("Value: ");
-
-        offset += ((float)newValue - (float)encoderValue) * encoderDir / 100;
-        encoderValue = newValue;
-
-        if(abs(offset) >= setWeight){
-          offset = setWeight;     //prevent nonsensical offsets
-        }
-      }
-      else if(currentSetting == 3){
-        scaleMode = !scaleMode;
-      }
-      else if (currentSetting == 4)
-      {
-        grindMode = !grindMode;
-      }
-      else if (currentSetting == 6)
-      {
-        greset = !greset;
+    int newValue = rotaryEncoder.readEncoder();
+    int detents = (newValue - encoderValue) * encoderDir;
+    encoderValue = newValue;
+    if (scaleStatus == STATUS_EMPTY) {
+      Serial.print("Value: ");
+      setWeight += Weight(detents) / 10;
+      Serial.println(newValue);
+      saveSetWeight(setWeight);
+    } else if (scaleStatus == STATUS_IN_MENU || scaleStatus == STATUS_IN_SUBMENU) {
+      menu.turn(detents);
+      if (scaleStatus == STATUS_IN_MENU) {
+        Serial.println(menu.index());
       }
     }
   }
@@ -430,37 +303,183 @@ void rotary_loop()
   }
 }
 
-void readEncoderISR()
+void postStatusEvent(uint8_t type, int64_t timestampMs, Weight weight, uint16_t sample = 0) {
+  StatusEvent event = {type, timestampMs, weight, sample};
+  if (xQueueSend(statusEvents, &event, 0) != pdPASS) {
+    Serial.println("Status event queue full");
+  }
+}
+
+void IRAM_ATTR postStatusEventFromISR(uint8_t type) {
+  StatusEvent event = {type, 0, 0, 0};
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  xQueueSendFromISR(statusEvents, &event, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+void IRAM_ATTR readEncoderISR()
 {
   rotaryEncoder.readEncoder_ISR();
+  postStatusEventFromISR(EVENT_INPUT);
+}
+
+void IRAM_ATTR encoderButtonISR()
+{
+  postStatusEventFromISR(EVENT_INPUT);
 }
 
 void tareScale() {
+  // processSample zeroes the scale the next time it is at rest
   Serial.println("Taring scale");
-  loadcell.tare(TARE_MEASURES);
-  lastTareAt = millis();
+  restDetector.reset();
+  tareStartedAt = millis();
+  taring = true;
 }
 
-void updateScale( void * parameter) {
-  float lastEstimate;
+void IRAM_ATTR loadcellReadyISR() {
+  if (loadcellReading) {
+    return; // DOUT also toggles while the bits are being clocked out
+  }
+  loadcellReadyAtUs = esp_timer_get_time();
+  traceSample = traceSample + 1;
+  latencyTrace.record(TRACE_HX711_READY, traceSample);
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(LoadcellTask, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
 
+void readLoadcell(void *parameter) {
+  for (;;) {
+    bool signalled = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOADCELL_READY_TIMEOUT)) > 0;
+    if (!signalled && !loadcell.is_ready()) {
+      continue; // updateScale notices the missing samples
+    }
+
+    // without an edge (e.g. DOUT was already low at boot) the best timestamp we have is now
+    LoadcellSample sample;
+    sample.timestampUs = sampleClock.update(signalled ? loadcellReadyAtUs : esp_timer_get_time());
+    sample.periodUs = sampleClock.locked() ? sampleClock.periodUs() : 0;
+    sample.sample = traceSample;
+    loadcellReading = true;
+    sample.raw = loadcell.read();
+    loadcellReading = false;
+    latencyTrace.record(TRACE_RAW_READ, sample.sample);
+
+    if (sampleQueue.push(sample)) {
+      xTaskNotifyGive(ScaleTask);
+    } else {
+      Serial.println("Sample queue overflow");
+    }
+  }
+}
+
+Weight filterWeight(Weight units) {
+  if (scaleMode != filterScaleMode) {
+    // carry on from the current reading rather than the other filter's stale state
+    filterScaleMode = scaleMode;
+    if (filterScaleMode) {
+      scaleFilter.reset(scaleWeight);
+    } else {
+      grindingFilter.reset(scaleWeight);
+    }
+  }
+  return filterScaleMode ? scaleFilter.update(units) : grindingFilter.update(units);
+}
+
+// Adapts to the conversion period the sample clock measured
+void setSamplePeriod(uint32_t periodUs) {
+  if (samplePeriodUs == 0) {
+    Serial.printf("Load cell at %.1f SPS\n", 1e6 / periodUs);
+    if (periodUs * LOADCELL_SPS < 750000 || periodUs * LOADCELL_SPS > 1250000) {
+      Serial.printf("Expected %d SPS, check the HX711 RATE pin\n", LOADCELL_SPS);
+    }
+  }
+  samplePeriodUs = periodUs;
+  scaleFilter.stage<1>().setProcessNoise(Weight(SCALE_PROCESS_NOISE) * (int64_t)periodUs / 1000000);
+}
+
+long loadcellZero() {
+  return loadcell.get_offset();
+}
+
+// Moves the zero by grams, in whole counts
+void shiftZero(Weight grams) {
+  if (gramsPerCount != 0) {
+    loadcell.set_offset(loadcell.get_offset() + (long)(((int64_t)grams.raw() << 16) / gramsPerCount));
+  }
+}
+
+// Finishes a pending tare or follows a slowly drifting zero, whenever the
+// unfiltered reading is at rest. Returns false while there is no zero yet.
+bool trackZero(const LoadcellSample &sample, Weight &units) {
+  if (!zeroed && restDetector.empty()) {
+    // the first reading will do until the tare found the real zero, it keeps
+    // grams far from the end of the Weight range
+    loadcell.set_offset(sample.raw);
+    units = 0;
+  }
+  restDetector.update(units);
+  Weight mean;
+  if (taring) {
+    if (!restDetector.stable(mean) || (zeroed && ABS(mean) > AUTO_TARE_MAX)) {
+      return zeroed; // retares carry on with the old zero meanwhile
+    }
+    shiftZero(mean);
+    units -= mean;
+    grindingFilter.reset(0);
+    scaleFilter.reset(0);
+    taring = false;
+    zeroed = true;
+    lastTareAt = millis();
+    Serial.printf("Tared in %lu ms\n", lastTareAt - tareStartedAt);
+    restDetector.reset();
+  } else if (restDetector.full()) {
+    if (restDetector.stable(mean) && ABS(mean) < Weight(AUTO_ZERO_BAND)) {
+      shiftZero(mean / AUTO_ZERO_RATE);
+    }
+    restDetector.reset();
+  }
+  return true;
+}
+
+void processSample(const LoadcellSample &sample) {
+  captureSample(sample);
+  if (sample.periodUs != samplePeriodUs && sample.periodUs != 0) {
+    setSamplePeriod(sample.periodUs);
+  }
+
+  Weight units = Weight::fromRaw((int32_t)(((int64_t)sample.raw - loadcell.get_offset()) * gramsPerCount >> 16));
+  if (!trackZero(sample, units)) {
+    return;
+  }
+  scaleWeight = filterWeight(units);
+  latencyTrace.record(TRACE_FILTER, sample.sample);
+  weightHistory.push(scaleWeight, sample.timestampUs / 1000);
+  latencyTrace.record(TRACE_HISTORY_PUSH, sample.sample);
+  postStatusEvent(EVENT_SAMPLE, sample.timestampUs / 1000, scaleWeight, sample.sample);
+}
+
+void updateScale( void * parameter) {
+  LoadcellSample batch[SAMPLE_QUEUE_SIZE];
 
   for (;;) {
-    if (lastTareAt == 0) {
+    if (lastTareAt == 0 && !taring) {
       Serial.println("retaring scale");
       Serial.println("current offset");
-      Serial.println(offset);
+      Serial.println(offset.toFloat());
       tareScale();
     }
-    if (loadcell.wait_ready_timeout(300)) {
-      lastEstimate = kalmanFilter.updateEstimate(loadcell.get_units(1));
-      scaleWeight = lastEstimate;
-      scaleLastUpdatedAt = millis();
-      weightHistory.push(scaleWeight);
-      scaleReady = true;
-    } else {
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOADCELL_READY_TIMEOUT)) == 0 && sampleQueue.empty()) {
       Serial.println("HX711 not found.");
-      scaleReady = false;
+      postStatusEvent(EVENT_SCALE_ERROR, millis(), scaleWeight);
+      continue;
+    }
+
+    size_t count;
+    while ((count = sampleQueue.popBatch(batch, SAMPLE_QUEUE_SIZE)) > 0) {
+      for (size_t i = 0; i < count; i++) {
+        processSample(batch[i]);
+      }
     }
   }
 }
@@ -471,166 +490,449 @@ void grinderToggle()
     if(grindMode){
       grinderActive = !grinderActive;
       digitalWrite(GRINDER_ACTIVE_PIN, grinderActive);
+      latencyTrace.record(TRACE_RELAY, decidingSample);
     }
     else{
       digitalWrite(GRINDER_ACTIVE_PIN, 1);
+      latencyTrace.record(TRACE_RELAY, decidingSample);
       delay(100);
       digitalWrite(GRINDER_ACTIVE_PIN, 0);
     }
   }
 }
 
-void scaleStatusLoop(void *p) {
-  double tenSecAvg;
-  for (;;) {
-    tenSecAvg = weightHistory.averageSince((int64_t)millis() - 10000);
-    
+// Where the current stage has to leave the cup
+Weight stageAim() {
+  return cupWeightEmpty + grindProgram->aim(grindStage, setWeight);
+}
 
-    if (ABS(tenSecAvg - scaleWeight) > SIGNIFICANT_WEIGHT_CHANGE) {
-      
-      lastSignificantWeightChangeAt = millis();
+uint8_t stageAction() {
+  return grindProgram->stages[grindStage].action;
+}
+
+void startGrinding() {
+  stageStartedAt = millis();
+  predictor.reset();
+  scaleStatus = STATUS_GRINDING_IN_PROGRESS;
+  int64_t commandUs = esp_timer_get_time();
+  grinderToggle();
+  captureGrinder(commandUs, true);
+}
+
+// Learns the stop model and the static offset from where the last stop settled
+void learnFromStop(Weight currentWeight) {
+  learnPending = false;
+  Weight weightError = stopAim - currentWeight;
+
+  if (predictor.learn(currentWeight, MAX_AUTO_OFFSET_CHANGE)) {
+    saveStopModel(predictor.latency(), predictor.inFlight());
+    Serial.printf("Stop model: latency %.3fs, in flight %.2fg\n", predictor.latency(), predictor.inFlight());
+  }
+
+  // Only adjust if error is reasonable (not due to sensor noise or cup removal)
+  if (stoppedByPrediction) {
+    // the offset only drives the fallback threshold, which didn't stop this dose
+  } else if (ABS(weightError) <= Weight(MAX_AUTO_OFFSET_CHANGE) && ABS(weightError) >= Weight(MIN_AUTO_OFFSET_CHANGE)) {
+    Weight proposedOffset = offset + weightError;
+
+    // Clamp to reasonable bounds
+    if (proposedOffset >= Weight(MIN_OFFSET) && proposedOffset <= Weight(MAX_OFFSET)) {
+      offset = proposedOffset;
+      saveOffset(offset);
+      Serial.print("Auto-adjusted offset by ");
+      Serial.print(weightError.toFloat());
+      Serial.print("g, new offset: ");
+      Serial.println(offset.toFloat());
+    } else {
+      Serial.println("Proposed offset out of bounds, skipping auto-adjustment");
     }
+  } else {
+    Serial.print("Weight error too large for auto-adjustment: ");
+    Serial.println(weightError.toFloat());
+  }
+}
 
-    if (scaleStatus == STATUS_EMPTY) {
-      if (millis() - lastTareAt > TARE_MIN_INTERVAL && ABS(tenSecAvg) > 0.2 && tenSecAvg < 3 && scaleWeight < 3) {
-        // tare if: not tared recently, more than 0.2 away from 0, less than 3 grams total (also works for negative weight)
-        lastTareAt = 0;
-      }
+// Runs the grinder for long enough to deliver what the settled dose is missing
+void startBurst(Weight settledWeight) {
+  burstStartWeight = settledWeight;
+  burstMs = burstModel.burstMs(stageAim() - settledWeight, stopFlow);
+  stageBursts++;
+  topUpBursts++;
+  Serial.printf("Top-up burst %d: %u ms for %.2fg\n", topUpBursts, burstMs, (stageAim() - settledWeight).toFloat());
+  burstRunning = true;
+  statusDeadline = (int64_t)millis() + burstMs;
+  int64_t commandUs = esp_timer_get_time();
+  grinderToggle();
+  captureGrinder(commandUs, true);
+}
 
-      if (ABS(weightHistory.minSince((int64_t)millis() - 1000) - setCupWeight) < CUP_DETECTION_TOLERANCE &&
-          ABS(weightHistory.maxSince((int64_t)millis() - 1000) - setCupWeight) < CUP_DETECTION_TOLERANCE)
-      {
-        // using average over last 500ms as empty cup weight
-        Serial.println("Starting grinding");
-        cupWeightEmpty = weightHistory.averageSince((int64_t)millis() - 500);
-        scaleStatus = STATUS_GRINDING_IN_PROGRESS;
-        
-        if(!scaleMode){
-          newOffset = true;
-          startedGrindingAt = millis();
-        }
-        
-        grinderToggle();
-        continue;
-      }
-    } else if (scaleStatus == STATUS_GRINDING_IN_PROGRESS) {
-      if (!scaleReady) {
-        
-        grinderToggle();
-        scaleStatus = STATUS_GRINDING_FAILED;
-      }
-      //Serial.printf("Scale mode: %d\n", scaleMode);
-      //Serial.printf("Started grinding at: %d\n", startedGrindingAt);
-      //Serial.printf("Weight: %f\n", cupWeightEmpty - scaleWeight);
-      if (scaleMode && startedGrindingAt == 0 && scaleWeight - cupWeightEmpty >= 0.1)
-      {
-        Serial.printf("Started grinding at: %d\n", millis());
-        startedGrindingAt = millis();
-        continue;
-      }
+void stopBurst() {
+  int64_t commandUs = esp_timer_get_time();
+  grinderToggle();
+  captureGrinder(commandUs, false);
+  burstRunning = false;
+  burstStoppedAt = millis();
+  settleDetector.stopped(burstStoppedAt);
+}
 
-      if (millis() - startedGrindingAt > MAX_GRINDING_TIME && !scaleMode) {
-        Serial.println("Failed because grinding took too long");
-        
-        grinderToggle();
-        scaleStatus = STATUS_GRINDING_FAILED;
-        continue;
-      }
+void pulseOrNext(Weight settledWeight);
 
-      if (
-          millis() - startedGrindingAt > WEIGHT_CHECK_TIME &&                                  // started grinding at least 2s ago
-          scaleWeight - weightHistory.firstValueOlderThan(millis() - WEIGHT_CHECK_TIME) < 1 && // less than a gram has been grinded in the last 2 second
-          !scaleMode)
-      {
-        Serial.println("Failed because no change in weight was detected");
-        
-        grinderToggle();
-        scaleStatus = STATUS_GRINDING_FAILED;
-        continue;
-      }
+// Moves on from the stage that just ended, weight is the settled weight if settled
+void nextStage(bool settled, Weight weight) {
+  grindStage++;
+  stageStartedAt = millis();
+  stageBursts = 0;
+  if (grindStage >= grindProgram->stageCount) {
+    if (settled) {
+      shotFinished(weight, SHOT_FINISHED | SHOT_SETTLED | (topUpBursts > 0 ? SHOT_TOPPED_UP : 0));
+    }
+    scaleStatus = STATUS_GRINDING_FINISHED; // logs the dose once it settled otherwise
+    return;
+  }
+  if (stageAction() == GRIND_RUN) {
+    startGrinding();
+    return;
+  }
+  scaleStatus = STATUS_TOPPING_UP;
+  if (stageAction() == GRIND_PAUSE) {
+    statusDeadline = (int64_t)stageStartedAt + grindProgram->stages[grindStage].limit;
+  } else if (stageAction() == GRIND_PULSE && settled) {
+    pulseOrNext(weight); // no need to wait for it again
+  }
+}
 
-      if (weightHistory.minSince((int64_t)millis() - 200) < cupWeightEmpty - CUP_DETECTION_TOLERANCE && !scaleMode) {
-        Serial.printf("Failed because weight too low, min: %f, min value: %f\n", weightHistory.minSince((int64_t)millis() - 200), CUP_WEIGHT + CUP_DETECTION_TOLERANCE);
-        
-        grinderToggle();
-        scaleStatus = STATUS_GRINDING_FAILED;
-        continue;
-      }
-      double currentOffset = offset;
-      if(scaleMode){
-        currentOffset = 0;
-      }
-      if (weightHistory.maxSince((int64_t)millis() - 200) >= cupWeightEmpty + setWeight + currentOffset) {
-        Serial.println("Finished grinding");
-        finishedGrindingAt = millis();
-        
-        grinderToggle();
-        scaleStatus = STATUS_GRINDING_FINISHED;
-        continue;
-      }
-    } else if (scaleStatus == STATUS_GRINDING_FINISHED) {
-      double currentWeight = weightHistory.averageSince((int64_t)millis() - 500);
-      if (scaleWeight < 5) {
-        Serial.println("Going back to empty");
-        startedGrindingAt = 0;
-        scaleStatus = STATUS_EMPTY;
-        // Save settings structure periodically for data integrity
-        saveSettingsStructure();
-        continue;
-      }
-      else if (currentWeight != setWeight + cupWeightEmpty && millis() - finishedGrindingAt > 1500 && newOffset)
-      {
-        // Check if weight has been stable for at least 1 second
-        if (ABS(currentWeight - lastStableWeight) < MIN_AUTO_OFFSET_CHANGE) {
-          if (lastWeightStableAt == 0) {
-            lastWeightStableAt = millis();
-            lastStableWeight = currentWeight;
-          } else if (millis() - lastWeightStableAt > 1000) {
-            // Weight has been stable for 1+ seconds, safe to adjust offset
-            double weightError = setWeight + cupWeightEmpty - currentWeight;
-            
-            // Only adjust if error is reasonable (not due to sensor noise or cup removal)
-            if (ABS(weightError) <= MAX_AUTO_OFFSET_CHANGE && ABS(weightError) >= MIN_AUTO_OFFSET_CHANGE) {
-              double proposedOffset = offset + weightError;
-              
-              // Clamp to reasonable bounds
-              if (proposedOffset >= MIN_OFFSET && proposedOffset <= MAX_OFFSET) {
-                offset = proposedOffset;
-                saveOffset(offset);
-                Serial.print("Auto-adjusted offset by ");
-                Serial.print(weightError);
-                Serial.print("g, new offset: ");
-                Serial.println(offset);
-              } else {
-                Serial.println("Proposed offset out of bounds, skipping auto-adjustment");
-              }
-            } else {
-              Serial.print("Weight error too large for auto-adjustment: ");
-              Serial.println(weightError);
-            }
-            
-            newOffset = false;
-            lastWeightStableAt = 0;
-          }
-        } else {
-          // Weight not stable, reset stability timer
-          lastWeightStableAt = 0;
-          lastStableWeight = currentWeight;
-        }
-      }
-    } else if (scaleStatus == STATUS_GRINDING_FAILED) {
-      if (scaleWeight >= GRINDING_FAILED_WEIGHT_TO_RESET) {
-        Serial.println("Going back to empty");
-        scaleStatus = STATUS_EMPTY;
-        continue;
-      }
+// Another burst while the pulse stage misses its aim and has bursts left
+void pulseOrNext(Weight settledWeight) {
+  const GrindStage &stage = grindProgram->stages[grindStage];
+  if (stageAim() - settledWeight > Weight(TOPUP_TOLERANCE) && stageBursts < stage.limit) {
+    startBurst(settledWeight);
+  } else {
+    nextStage(true, settledWeight);
+  }
+}
+
+void finishGrinding(bool predicted) {
+  Serial.println(predicted ? "Finished grinding (predicted)" : "Finished grinding");
+  finishedGrindingAt = millis();
+  stopFlow = predictor.flowRate();
+  stopAim = stageAim();
+  predictor.stopped(finishedGrindingAt);
+  stoppedByPrediction = predicted;
+  learnPending = !scaleMode;
+  shotStopped(predicted, predictor.flowRate(), predictor.latency(), predictor.inFlight());
+  settleDetector.stopped(finishedGrindingAt);
+
+  int64_t commandUs = esp_timer_get_time();
+  grinderToggle();
+  captureGrinder(commandUs, false);
+  nextStage(false, scaleWeight);
+}
+
+void failGrinding() {
+  int64_t commandUs = esp_timer_get_time();
+  grinderToggle();
+  captureGrinder(commandUs, false);
+  shotStopped(false, predictor.flowRate(), predictor.latency(), predictor.inFlight());
+  shotFinished(scaleWeight, 0);
+  scaleStatus = STATUS_GRINDING_FAILED;
+}
+
+void onEmptySample(const StatusEvent &event) {
+  Weight oneSecAvg = weightHistory.windowAverage(window1s);
+  if (millis() - lastTareAt > TARE_MIN_INTERVAL && ABS(oneSecAvg) > Weight(AUTO_ZERO_BAND) && weightHistory.windowMax(window1s) < AUTO_TARE_MAX) {
+    // tare if: not tared recently, further from 0 than zero tracking follows, less than 3 grams total (also works for negative weight).
+    // A second is enough, the tare itself waits for the scale to be at rest
+    lastTareAt = 0;
+  }
+
+  // a session starts as soon as the cup is at rest, otherwise a second near the cup weight will do
+  int cupWindow = sessionMode ? windowCupStable : window1s;
+  Weight cupMin = weightHistory.windowMin(cupWindow);
+  Weight cupMax = weightHistory.windowMax(cupWindow);
+  if (ABS(cupMin - setCupWeight) < CUP_DETECTION_TOLERANCE && ABS(cupMax - setCupWeight) < CUP_DETECTION_TOLERANCE &&
+      (!sessionMode || cupMax - cupMin < Weight(SESSION_CUP_SPREAD)))
+  {
+    // using average over last 500ms as empty cup weight
+    Serial.println("Starting grinding");
+    cupWeightEmpty = weightHistory.windowAverage(sessionMode ? windowCupStable : window500ms);
+    grindProgram = &grindPrograms[scaleMode || grindMode ? GRIND_PROGRAM_SINGLE : impulseProgram];
+    grindStage = 0;
+    topUpBursts = 0;
+    learnPending = false;
+    shotStarted(event.timestampMs, setWeight, cupWeightEmpty);
+
+    if(!scaleMode){
+      startedGrindingAt = millis();
     }
-    rotary_loop();
-    delay(50);
+    startGrinding();
   }
 }
 
+void onGrindingSample(const StatusEvent &event) {
+  shotSample(event.timestampMs, event.weight);
+  if (scaleMode && startedGrindingAt == 0 && scaleWeight - cupWeightEmpty >= Weight(0.1))
+  {
+    Serial.printf("Started grinding at: %d\n", millis());
+    startedGrindingAt = millis();
+    return;
+  }
 
+  if (millis() - startedGrindingAt > MAX_GRINDING_TIME && !scaleMode) {
+    Serial.println("Failed because grinding took too long");
+    failGrinding();
+    return;
+  }
+
+  if (
+      millis() - stageStartedAt > WEIGHT_CHECK_TIME &&                                     // started grinding at least 2s ago
+      scaleWeight - weightHistory.firstValueOlderThan(millis() - WEIGHT_CHECK_TIME) < 1 && // less than a gram has been grinded in the last 2 second
+      !scaleMode)
+  {
+    Serial.println("Failed because no change in weight was detected");
+    failGrinding();
+    return;
+  }
+
+  if (weightHistory.windowMin(window200ms) < cupWeightEmpty - CUP_DETECTION_TOLERANCE && !scaleMode) {
+    Serial.printf("Failed because weight too low, min: %f, min value: %f\n", weightHistory.windowMin(window200ms).toFloat(), CUP_WEIGHT + CUP_DETECTION_TOLERANCE);
+    failGrinding();
+    return;
+  }
+  // the static offset is for a dose ground in one go, later runs wait for a flow estimate
+  Weight currentOffset = offset;
+  if(scaleMode || grindStage > 0){
+    currentOffset = 0;
+  }
+  Weight aim = stageAim();
+  predictor.addSample(event.timestampMs, event.weight);
+  if (!scaleMode && predictor.ready()) {
+    int64_t stopAt = predictor.stopAt(aim);
+    if (stopAt <= (int64_t)millis() || scaleWeight >= aim) {
+      finishGrinding(true);
+    } else {
+      // wake up at the predicted crossing unless a newer sample arrives first
+      statusDeadline = stopAt;
+    }
+  } else if (weightHistory.windowMax(window200ms) >= aim + currentOffset) {
+    // no flow estimate yet, fall back to the static offset
+    finishGrinding(false);
+  } else {
+    statusDeadline = NO_DEADLINE;
+  }
+}
+
+void onGrindingDeadline(const StatusEvent &event) {
+  finishGrinding(true);
+}
+
+void onGrindingScaleError(const StatusEvent &event) {
+  failGrinding();
+}
+
+// Back to empty when the cup is lifted, before the program finished or after
+bool cupLifted() {
+  if (scaleWeight >= (sessionMode ? cupWeightEmpty - CUP_DETECTION_TOLERANCE : Weight(5))) {
+    return false;
+  }
+  Serial.println(sessionMode ? "Cup swap" : "Going back to empty");
+  sessionCupLifted(millis());
+  if (burstRunning) {
+    stopBurst();
+  }
+  shotFinished(weightHistory.windowMax(window1s), SHOT_FINISHED | (topUpBursts > 0 ? SHOT_TOPPED_UP : 0)); // before it settled
+  startedGrindingAt = 0;
+  scaleStatus = STATUS_EMPTY;
+  return true;
+}
+
+// Feeds the settle detector, true once the last stop settled
+bool stopSettled(const StatusEvent &event, Weight &settledWeight) {
+  settleDetector.update(event.timestampMs, event.weight);
+  if (!settleDetector.settled(event.timestampMs, settledWeight)) {
+    return false;
+  }
+  settleDetector.learnTail();
+  Serial.printf("Settled %ld ms after the stop, tail now %ld ms\n", (long)(event.timestampMs - settleDetector.stoppedAtMs()),
+                (long)settleDetector.tailMs());
+  return true;
+}
+
+void onFinishedSample(const StatusEvent &event) {
+  shotSample(event.timestampMs, event.weight);
+  if (cupLifted()) {
+    return;
+  }
+  // a program that ends with a run still has to see its stop settle
+  Weight settledWeight;
+  if (learnPending && stopSettled(event, settledWeight)) {
+    learnFromStop(settledWeight);
+    shotFinished(settledWeight, SHOT_FINISHED | SHOT_SETTLED | (topUpBursts > 0 ? SHOT_TOPPED_UP : 0));
+  }
+}
+
+void onTopUpSample(const StatusEvent &event) {
+  shotSample(event.timestampMs, event.weight);
+  if (cupLifted()) {
+    return;
+  }
+  if (burstRunning) {
+    if (scaleWeight >= stageAim()) {
+      stopBurst(); // delivered more than the model expected
+    }
+    return;
+  }
+  if (stageAction() == GRIND_PAUSE) {
+    settleDetector.update(event.timestampMs, event.weight);
+    return; // onTopUpDeadline moves on
+  }
+
+  Weight currentWeight;
+  if (!stopSettled(event, currentWeight)) {
+    return;
+  }
+  if (learnPending) {
+    learnFromStop(currentWeight);
+  }
+  if (stageBursts > 0) {
+    burstModel.delivered(burstMs, currentWeight - burstStartWeight, stopFlow);
+    Serial.printf("Burst delivered %.2fg, dead time now %u ms\n", (currentWeight - burstStartWeight).toFloat(), burstModel.deadMs());
+  }
+  if (stageAction() == GRIND_PULSE) {
+    pulseOrNext(currentWeight);
+  } else {
+    nextStage(true, currentWeight);
+  }
+}
+
+void onTopUpDeadline(const StatusEvent &event) {
+  if (burstRunning) {
+    stopBurst();
+  } else if (stageAction() == GRIND_PAUSE) {
+    nextStage(false, scaleWeight);
+  }
+}
+
+void onTopUpScaleError(const StatusEvent &event) {
+  if (burstRunning) {
+    stopBurst();
+  }
+  shotFinished(scaleWeight, topUpBursts > 0 ? SHOT_TOPPED_UP : 0);
+  scaleStatus = STATUS_GRINDING_FAILED;
+}
+
+void onFailedSample(const StatusEvent &event) {
+  if (scaleWeight >= GRINDING_FAILED_WEIGHT_TO_RESET) {
+    Serial.println("Going back to empty");
+    scaleStatus = STATUS_EMPTY;
+  }
+}
+
+void onInput(const StatusEvent &event) {
+  rotary_loop();
+}
+
+typedef void (*StatusHandler)(const StatusEvent &event);
+
+// Handler for every status and event, NULL means the event is ignored in that status
+const StatusHandler statusTable[][EVENT_TYPES] = {
+  //                                EVENT_SAMPLE      EVENT_INPUT EVENT_DEADLINE      EVENT_SCALE_ERROR
+  /* STATUS_EMPTY */               {onEmptySample,    onInput,    NULL,               NULL},
+  /* STATUS_GRINDING_IN_PROGRESS */{onGrindingSample, onInput,    onGrindingDeadline, onGrindingScaleError},
+  /* STATUS_GRINDING_FINISHED */   {onFinishedSample, onInput,    NULL,               NULL},
+  /* STATUS_GRINDING_FAILED */     {onFailedSample,   onInput,    NULL,               NULL},
+  /* STATUS_IN_MENU */             {NULL,             onInput,    NULL,               NULL},
+  /* STATUS_IN_SUBMENU */          {NULL,             onInput,    NULL,               NULL},
+  /* STATUS_TOPPING_UP */          {onTopUpSample,    onInput,    onTopUpDeadline,    onTopUpScaleError},
+};
+
+Seqlock<ScaleState> scaleState; // published by ScaleStatusTask
+ScaleState publishedState = {}; // only touched by ScaleStatusTask
+
+void publishScaleState(const StatusEvent &event) {
+  ScaleState &state = publishedState;
+  if (event.type == EVENT_SAMPLE) {
+    state.weight = event.weight;
+    state.updatedAt = event.timestampMs;
+    state.ready = true;
+  } else if (event.type == EVENT_SCALE_ERROR) {
+    state.ready = false;
+  }
+  state.cupWeight = cupWeightEmpty;
+  state.setCupWeight = setCupWeight;
+  state.setWeight = setWeight;
+  state.offset = offset;
+  state.lastSignificantWeightChangeAt = lastSignificantWeightChangeAt;
+  state.startedGrindingAt = startedGrindingAt;
+  state.finishedGrindingAt = finishedGrindingAt;
+  state.bean = activeBean;
+  loadBeanName(activeBean, state.beanName);
+  state.menuValue = menu.value();
+  state.menuItem = menu.index();
+  state.setting = menu.isEditing() ? menu.index() : -1;
+  state.status = scaleStatus;
+  state.scaleMode = scaleMode;
+  state.grindMode = grindMode;
+  state.sessionMode = sessionMode;
+  state.menuFlag = menu.flag();
+  scaleState.publish(state);
+}
+
+ScaleState readScaleState() {
+  return scaleState.read();
+}
+
+void scaleStatusLoop(void *p) {
+  StatusEvent event;
+  for (;;) {
+    TickType_t wait = portMAX_DELAY;
+    if (statusDeadline != NO_DEADLINE) {
+      int64_t remaining = statusDeadline - (int64_t)millis();
+      wait = remaining > 0 ? pdMS_TO_TICKS(remaining) : 0;
+    }
+    if (xQueueReceive(statusEvents, &event, wait) != pdTRUE) {
+      event.type = EVENT_DEADLINE;
+      event.timestampMs = millis();
+      event.weight = scaleWeight;
+      statusDeadline = NO_DEADLINE;
+    }
+
+    if (event.type == EVENT_SAMPLE &&
+        ABS(weightHistory.windowAverage(window10s) - event.weight) > SIGNIFICANT_WEIGHT_CHANGE) {
+      lastSignificantWeightChangeAt = millis();
+    }
+
+    if (event.type == EVENT_SAMPLE) {
+      decidingSample = event.sample;
+    }
+    int status = scaleStatus;
+    int64_t deadline = statusDeadline;
+    StatusHandler handler = statusTable[status][event.type];
+    if (handler) {
+      handler(event);
+    }
+    if (event.type == EVENT_SAMPLE) {
+      latencyTrace.record(TRACE_DECISION, event.sample);
+      telemetrySample(event.timestampMs, event.weight);
+    }
+    if (scaleStatus != status && statusDeadline == deadline) {
+      statusDeadline = NO_DEADLINE; // deadlines belong to the status that set them
+    }
+    publishScaleState(event);
+    telemetryOffset(event.timestampMs, offset);
+  }
+}
+
+
+
+void printLatencySummary(Print &out) {
+  latencyTrace.summarize(out, traceStageNames, TRACE_STAGES);
+  out.printf("sample clock: period %u us, jitter %u us, %u conversions missed\n",
+             sampleClock.periodUs(), sampleClock.jitterUs(), sampleClock.missed());
+}
+
+void dumpLatencyTrace(Print &out) {
+  latencyTrace.dump(out);
+}
 
 void setupScale() {
   rotaryEncoder.begin();
@@ -649,45 +951,54 @@ void setupScale() {
   // rotaryEncoder.disableAcceleration(); //acceleration is now enabled by default - disable if you dont need it
   rotaryEncoder.setAcceleration(150); // or set the value - larger number = more accelearation; 0 or 1 means disabled acceleration
 
+  statusEvents = xQueueCreate(STATUS_EVENT_QUEUE_SIZE, sizeof(StatusEvent));
+  attachInterrupt(digitalPinToInterrupt(ROTARY_ENCODER_BUTTON_PIN), encoderButtonISR, CHANGE);
+
 
+#if LOADCELL_RATE_PIN >= 0
+  pinMode(LOADCELL_RATE_PIN, OUTPUT);
+  digitalWrite(LOADCELL_RATE_PIN, LOADCELL_SPS >= 80 ? HIGH : LOW);
+#endif
   loadcell.begin(LOADCELL_DOUT_PIN, LOADCELL_SCK_PIN);
 
   pinMode(GRINDER_ACTIVE_PIN, OUTPUT);
   digitalWrite(GRINDER_ACTIVE_PIN, 0);
 
   // Load all parameters using safe helper functions
+  setupSettings();
+  setupShots();
   double scaleFactor = loadCalibration();
+  activeBean = loadActiveBean();
   setWeight = loadSetWeight();
   offset = loadOffset();
   setCupWeight = loadCupWeight();
   scaleMode = loadScaleMode();
   grindMode = loadGrindMode();
+  double stopLatency, inFlight;
+  loadStopModel(stopLatency, inFlight);
+  predictor.setModel(stopLatency, inFlight);
   
   Serial.println("Loaded parameters:");
+  Serial.print("Bean: "); Serial.println(activeBean + 1);
   Serial.print("Calibration: "); Serial.println(scaleFactor);
-  Serial.print("Set weight: "); Serial.println(setWeight);
-  Serial.print("Offset: "); Serial.println(offset);
-  Serial.print("Cup weight: "); Serial.println(setCupWeight);
+  Serial.print("Set weight: "); Serial.println(setWeight.toFloat());
+  Serial.print("Offset: "); Serial.println(offset.toFloat());
+  Serial.print("Cup weight: "); Serial.println(setCupWeight.toFloat());
   Serial.print("Scale mode: "); Serial.println(scaleMode);
   Serial.print("Grind mode: "); Serial.println(grindMode);
+  Serial.print("Stop latency: "); Serial.println(stopLatency, 3);
+  Serial.print("In flight: "); Serial.println(inFlight);
   
-  loadcell.set_scale(scaleFactor);
-
-  xTaskCreatePinnedToCore(
-      updateScale, /* Function to implement the task */
-      "Scale",     /* Name of the task */
-      10000,       /* Stack size in words */
-      NULL,        /* Task input parameter */
-      0,           /* Priority of the task */
-      &ScaleTask,  /* Task handle. */
-      1);          /* Core where the task should run */
-
-  xTaskCreatePinnedToCore(
-      scaleStatusLoop, /* Function to implement the task */
-      "ScaleStatus", /* Name of the task */
-      10000,  /* Stack size in words */
-      NULL,  /* Task input parameter */
-      0,  /* Priority of the task */
-      &ScaleStatusTask,  /* Task handle. */
-      1);            /* Core where the task should run */
+  setCalibration(scaleFactor);
+
+  window10s = weightHistory.registerWindow(HISTORY_MS);
+  window1s = weightHistory.registerWindow(1000);
+  window500ms = weightHistory.registerWindow(500);
+  window200ms = weightHistory.registerWindow(200);
+  windowCupStable = weightHistory.registerWindow(SESSION_CUP_STABLE_MS);
+
+  startTask(TASK_SCALE, updateScale, &ScaleTask);
+  startTask(TASK_LOADCELL, readLoadcell, &LoadcellTask); // after ScaleTask, which it notifies
+  attachInterrupt(digitalPinToInterrupt(LOADCELL_DOUT_PIN), loadcellReadyISR, FALLING);
+  startTask(TASK_SCALE_STATUS, scaleStatusLoop, &ScaleStatusTask);
 }
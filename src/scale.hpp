@@ -1,17 +1,49 @@
 #pragma once
 
-#include <SimpleKalmanFilter.h>
+#include <FixedPoint.h>
+#include <WeightFilters.h>
+#include <GrindProgram.h>
+#include <Menu.h>
 #include "HX711.h"
 
-class MenuItem
-{
-    public:
-        int id;
-        bool selected;
-        char menuName[16];
-        double increment;
-        double *value;
-};
+typedef Fixed<16> Weight; // grams, Q16.16
+
+#ifndef LOADCELL_SPS
+#define LOADCELL_SPS 10 // HX711 conversions per second as strapped by its RATE pin, 10 or 80
+#endif
+
+// Conversions in ms at LOADCELL_SPS, at least one. Everything that has to span a
+// time (history, tare) is sized with it so it covers the same time at either rate.
+constexpr size_t samplesIn(int64_t ms) {
+  return ms * LOADCELL_SPS / 1000 > 0 ? (size_t)(ms * LOADCELL_SPS / 1000) : 1;
+}
+
+// Weight filter per mode: grinding feeds the dose predictor, which wants spikes
+// removed without smearing the flow, scale mode favours a steady reading at rest.
+// Compare configurations with the native --bench-filters.
+//
+// The median works on conversions: a spike lasts one, so at 80 SPS it delays the
+// flow by 12.5 instead of 100 ms. The average has to span the grinder's own flow
+// fluctuations, which don't get faster with the rate, so it covers a fixed time.
+// Shorter averages at 80 SPS learn a shorter stop latency but dose no better, and
+// worse at high flow, so 80 SPS only gains the median's delay.
+#ifndef GRINDING_AVERAGE_MS
+#define GRINDING_AVERAGE_MS 400
+#endif
+#define LOADCELL_NOISE (LOADCELL_SPS >= 80 ? 0.055 : 0.03) // g rms of one conversion (HX711: 90 vs 50 nV)
+#define SCALE_PROCESS_NOISE 0.005 // adaptive Kalman process noise per second, spread over the samples
+
+typedef FilterChain<MedianFilter<Weight, 3>, MovingAverage<Weight, samplesIn(GRINDING_AVERAGE_MS)>> GrindingFilter;
+typedef FilterChain<MedianFilter<Weight, 5>, AdaptiveKalmanFilter<Weight>> ScaleFilter;
+
+inline GrindingFilter makeGrindingFilter() {
+  return GrindingFilter(MedianFilter<Weight, 3>(), MovingAverage<Weight, samplesIn(GRINDING_AVERAGE_MS)>());
+}
+
+inline ScaleFilter makeScaleFilter() {
+  return ScaleFilter(MedianFilter<Weight, 5>(),
+                     AdaptiveKalmanFilter<Weight>(Weight(LOADCELL_NOISE), Weight(SCALE_PROCESS_NOISE) / LOADCELL_SPS, 4, 1));
+}
 
 #define STATUS_EMPTY 0
 #define STATUS_GRINDING_IN_PROGRESS 1
@@ -19,6 +51,24 @@ class MenuItem
 #define STATUS_GRINDING_FAILED 3
 #define STATUS_IN_MENU 4
 #define STATUS_IN_SUBMENU 5
+#define STATUS_TOPPING_UP 6
+
+// Events driving the status state machine, see statusTable in scale.cpp
+#define EVENT_SAMPLE 0 // a new filtered weight sample
+#define EVENT_INPUT 1 // rotary encoder turned or pressed
+#define EVENT_DEADLINE 2 // the deadline set by the current status expired
+#define EVENT_SCALE_ERROR 3 // the HX711 stopped sending samples
+#define EVENT_TYPES 4
+
+#define STATUS_EVENT_QUEUE_SIZE 16
+#define NO_DEADLINE INT64_MAX
+
+struct StatusEvent {
+  uint8_t type;
+  int64_t timestampMs;
+  Weight weight;
+  uint16_t sample; // trace sample number of EVENT_SAMPLE
+};
 
 #define CUP_WEIGHT 70
 #define CUP_DETECTION_TOLERANCE 5 // 5 grams tolerance above or bellow cup weight to detect it
@@ -26,9 +76,34 @@ class MenuItem
 #define LOADCELL_DOUT_PIN 19
 #define LOADCELL_SCK_PIN 18
 
+#define LOADCELL_RATE_PIN -1 // GPIO wired to the HX711 RATE pin, -1 where the board straps it
+
 #define LOADCELL_SCALE_FACTOR 7351
+#define LOADCELL_READY_TIMEOUT 300 // ms without a conversion before the HX711 is considered missing
+#define SAMPLE_QUEUE_SIZE 16 // raw conversions buffered between acquisition and processing, power of two
+
+// Raw HX711 conversion, timestamped on the sample clock (see SampleClock)
+struct LoadcellSample {
+  int64_t timestampUs;
+  int32_t raw;
+  uint16_t sample; // trace sample number
+  uint32_t periodUs; // measured conversion period, 0 until the sample clock locked
+};
 
-#define TARE_MEASURES 20 // use the average of measure for taring
+// Stages traced from HX711 conversion to grinder relay, see LatencyTrace
+#define TRACE_HX711_READY 0
+#define TRACE_RAW_READ 1
+#define TRACE_FILTER 2
+#define TRACE_HISTORY_PUSH 3
+#define TRACE_DECISION 4
+#define TRACE_RELAY 5
+#define TRACE_STAGES 6
+
+// Tare and zero tracking, both wait for StabilityDetector to find the scale at rest
+#define TARE_WINDOW_MS 500 // a tare takes at least this long
+#define AUTO_ZERO_BAND 0.2 // g, a zero at rest closer than this is followed without a tare
+#define AUTO_ZERO_RATE 2 // corrects 1 / AUTO_ZERO_RATE of the zero error per window
+#define AUTO_TARE_MAX 3 // g, a retare doesn't zero a heavier load
 #define SIGNIFICANT_WEIGHT_CHANGE 5 // 5 grams changes are used to detect a significant change
 #define COFFEE_DOSE_WEIGHT 18
 #define COFFEE_DOSE_OFFSET -2.5
@@ -46,16 +121,44 @@ class MenuItem
 #define MAX_AUTO_OFFSET_CHANGE 5.0
 #define WEIGHT_CHECK_TIME 3000
 
-// Storage settings structure for data integrity
-struct ScaleSettings {
-  int16_t offsetTenths;
-  int16_t cupWeightTenths;
-  int16_t setWeightTenths;
-  int32_t calibrationHundredths;
-  uint8_t scaleMode;
-  uint8_t grindMode;
-  uint16_t checksum;
-};
+// Bean profiles: target, cup, offset and stop model per bean, see BeanProfile
+#define BEAN_PROFILES 4
+#define BEAN_NAME_LENGTH 8 // including the terminating zero
+
+// Predictive stop, see DosePredictor
+#define STOP_LATENCY_DEFAULT 0.5 // s of flow that still ends up in the cup after stopping
+#define IN_FLIGHT_DEFAULT 0.0 // g that end up in the cup after stopping regardless of flow
+#define MAX_STOP_LATENCY 3.0
+#define MAX_IN_FLIGHT 5.0
+#define MIN_IN_FLIGHT -5.0
+
+// Grind programs, see grindPrograms in scale.cpp. Continuous mode runs the single
+// stop, impulse mode IMPULSE_PROGRAM.
+#define GRIND_PROGRAM_SINGLE 0 // one predicted stop at the target
+#define GRIND_PROGRAM_PULSE 1 // stop TOPUP_MARGIN short, settle, bursts for the rest
+#define GRIND_PROGRAM_BULK 2 // stop at BULK_PERMILLE of the target, then a burst to TOPUP_MARGIN short and bursts for the rest
+#define GRIND_PROGRAMS 3
+#define BULK_PERMILLE 850
+
+// When the weight after a stop or a burst has settled, see SettleDetector
+#define SETTLE_WINDOW_MS 800 // filtered weight at rest over this
+#define SETTLE_MAX_SLOPE 0.03 // g/s it may still move
+#define SETTLE_TAIL_MS 1000 // grounds landing after a stop, until a stop was measured
+#define SETTLE_MIN_TAIL_MS 200
+#define SETTLE_MAX_TAIL_MS 3000
+
+// Pulse finishing: short bursts deliver what a stop left short once it settled, see BurstModel
+#ifndef TOPUP_MAX_BURSTS
+#define TOPUP_MAX_BURSTS 3 // per dose, 0 stops at the target in one go
+#endif
+#ifndef IMPULSE_PROGRAM
+#define IMPULSE_PROGRAM (TOPUP_MAX_BURSTS > 0 ? GRIND_PROGRAM_PULSE : GRIND_PROGRAM_SINGLE)
+#endif
+#define TOPUP_MARGIN 0.3 // g, well above the scatter of a predicted stop
+#define TOPUP_TOLERANCE 0.05 // g short of the target that isn't worth a burst
+#define TOPUP_DEAD_MS 150 // ms of a burst that deliver nothing, until bursts were measured
+#define TOPUP_MIN_MS 150 // the start pulse has to be over before the stop pulse
+#define TOPUP_MAX_MS 1500
 
 #define GRINDER_ACTIVE_PIN 33
 
@@ -67,42 +170,55 @@ struct ScaleSettings {
 #define ROTARY_ENCODER_VCC_PIN -1
 #define ROTARY_ENCODER_STEPS 4
 
-extern double scaleWeight;
-extern unsigned long scaleLastUpdatedAt;
-extern unsigned long lastSignificantWeightChangeAt;
-extern unsigned long lastTareAt;
-extern bool scaleReady;
+// What ScaleStatusTask last decided, published after every event it handled.
+// Tasks other than ScaleTask and ScaleStatusTask read it with readScaleState(),
+// which copies all of it consistently without a lock.
+struct ScaleState {
+  Weight weight; // filtered weight of the last sample
+  Weight cupWeight; // cupWeightEmpty
+  Weight setCupWeight;
+  Weight setWeight;
+  Weight offset;
+  unsigned long updatedAt; // millis() of the last sample, 0 before the first
+  unsigned long lastSignificantWeightChangeAt;
+  unsigned long startedGrindingAt;
+  unsigned long finishedGrindingAt;
+  char beanName[BEAN_NAME_LENGTH];
+  uint8_t bean; // active bean profile
+  Weight menuValue; // of the setting being edited, see Menu
+  int8_t menuItem; // selected in the menu
+  int8_t setting; // menuItem while it is edited, -1 otherwise
+  uint8_t status;
+  bool ready; // the HX711 is sending samples
+  bool scaleMode;
+  bool grindMode;
+  bool sessionMode;
+  bool menuFlag; // toggle or confirmation being edited
+};
+
+ScaleState readScaleState();
+
+typedef MenuEntry<Weight, ScaleState> MenuItem;
+
+// Owned by ScaleTask (scaleWeight) and ScaleStatusTask
+extern Weight scaleWeight;
 extern int scaleStatus;
-extern double cupWeightEmpty;
-extern unsigned long startedGrindingAt;
-extern unsigned long finishedGrindingAt;
-extern double setWeight;
-extern double offset;
+extern Weight cupWeightEmpty;
+extern Weight setCupWeight;
+extern Weight setWeight;
+extern Weight offset;
 extern bool scaleMode;
 extern bool grindMode;
-extern bool greset;
-extern int menuItemsCount;
-
-extern MenuItem menuItems[];
-extern int currentMenuItem;
-extern int currentSetting;
-
-// Helper functions for safe parameter storage/retrieval
-void saveOffset(double newOffset);
-void saveCupWeight(double newCupWeight);
-void saveSetWeight(double newSetWeight);
-void saveCalibration(double newCalibration);
-void saveScaleMode(bool mode);
-void saveGrindMode(bool mode);
-double loadOffset();
-double loadCupWeight();
-double loadSetWeight();
-double loadCalibration();
-bool loadScaleMode();
-bool loadGrindMode();
-bool validateAndLoadSettings();
-void saveSettingsStructure();
-void resetToDefaults();
-uint16_t calculateChecksum(const ScaleSettings& settings);
+extern bool sessionMode; // see session.hpp
+extern uint8_t activeBean;
+extern uint8_t impulseProgram; // IMPULSE_PROGRAM, the native build picks others
+extern const GrindProgram grindPrograms[GRIND_PROGRAMS];
+extern const int menuItemsCount;
+
+extern const MenuItem menuItems[];
+
+long loadcellZero(); // tare offset in raw counts
+void printLatencySummary(Print &out);
+void dumpLatencyTrace(Print &out);
 
 void setupScale();
@@ -0,0 +1,96 @@
+#include "session.hpp"
+#include <Seqlock.h>
+
+Seqlock<SessionStats> sessionState; // published by ScaleStatusTask
+SessionStats session = {}; // only touched by ScaleStatusTask
+uint32_t cupLiftedAtMs = 0; // 0 unless a cup came off since the last dose started
+
+void startSession() {
+  session = {};
+  session.startedAtMs = (uint32_t)millis();
+  cupLiftedAtMs = 0;
+  sessionState.publish(session);
+  Serial.println("Session started");
+}
+
+void stopSession() {
+  printSessionSummary(Serial);
+}
+
+void sessionDoseStarted(const ShotRecord &shot) {
+  if (!sessionMode) {
+    return;
+  }
+  if (session.firstDoseAtMs == 0) {
+    session.firstDoseAtMs = shot.startedAtMs;
+  }
+  session.started++;
+  if (cupLiftedAtMs != 0) {
+    session.swaps++;
+    session.swapMsSum += shot.startedAtMs - cupLiftedAtMs;
+    cupLiftedAtMs = 0;
+  }
+  sessionState.publish(session);
+}
+
+void sessionDoseFinished(const ShotRecord &shot) {
+  if (!sessionMode || session.firstDoseAtMs == 0) {
+    return;
+  }
+  if (!(shot.flags & SHOT_FINISHED)) {
+    session.failed++;
+    sessionState.publish(session);
+    return;
+  }
+  session.doses++;
+  session.lastDoseAtMs = (uint32_t)millis();
+  session.grindMsSum += shot.grindMs;
+  if (shot.flags & SHOT_SETTLED) {
+    int32_t error = shot.dosedCg - shot.targetCg;
+    session.settled++;
+    session.errorSumCg += error;
+    session.absErrorSumCg += abs(error);
+    session.squaredErrorSumCg += (int64_t)error * error;
+    if (abs(error) > session.worstErrorCg) {
+      session.worstErrorCg = (int16_t)abs(error);
+    }
+  }
+  sessionState.publish(session);
+}
+
+void sessionCupLifted(uint32_t timestampMs) {
+  if (sessionMode && session.firstDoseAtMs != 0) {
+    cupLiftedAtMs = timestampMs;
+  }
+}
+
+SessionStats sessionStats() {
+  return sessionState.read();
+}
+
+void printSessionSummary(Print &out) {
+  SessionStats stats = sessionStats();
+  if (stats.firstDoseAtMs == 0) {
+    out.println(sessionMode ? "session: no doses yet" : "session off");
+    return;
+  }
+  double minutes = (stats.lastDoseAtMs - stats.firstDoseAtMs) / 60000.0;
+  out.printf("session: %u doses, %u failed in %.1f min", (unsigned)stats.doses, (unsigned)stats.failed, minutes);
+  if (minutes > 0) {
+    out.printf(", %.1f cups/min", stats.doses / minutes);
+  }
+  if (stats.doses > 0) {
+    out.printf(", grinding %.1f s per dose", stats.grindMsSum / 1000.0 / stats.doses);
+  }
+  if (stats.swaps > 0) {
+    out.printf(", cup swap to start %.2f s", stats.swapMsSum / 1000.0 / stats.swaps);
+  }
+  out.println();
+  if (stats.settled > 0) {
+    double mean = (double)stats.errorSumCg / stats.settled;
+    double variance = (double)stats.squaredErrorSumCg / stats.settled - mean * mean;
+    out.printf("session error over %u settled doses: mean %+.3f g, mean abs %.3f g, stddev %.3f g, worst %.2f g\n",
+               (unsigned)stats.settled, mean / 100, (double)stats.absErrorSumCg / stats.settled / 100,
+               sqrt(variance > 0 ? variance : 0) / 100, stats.worstErrorCg / 100.0);
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "scale.hpp"
+#include <ShotLog.h>
+
+// Session mode serves cups back to back. Lifting the full cup is told from the
+// weight dipping below the empty cup, which a quick swap makes even when the
+// filtered weight never gets near zero, and the next dose starts as soon as the
+// new cup rests within SESSION_CUP_SPREAD for SESSION_CUP_STABLE_MS instead of a
+// second of cup detection. Throughput and accuracy are counted from the dose
+// records until the session ends.
+#define SESSION_CUP_STABLE_MS 300
+#define SESSION_CUP_SPREAD 0.1 // g max - min of the filtered weight, so the cup weight is good to a dose
+
+struct SessionStats {
+  uint32_t startedAtMs; // session mode turned on
+  uint32_t firstDoseAtMs; // first dose started, 0 before
+  uint32_t lastDoseAtMs; // last dose finished
+  uint16_t started; // doses, the one running included
+  uint16_t doses; // finished
+  uint16_t failed;
+  uint16_t settled; // finished doses the errors are over
+  uint16_t swaps; // cups lifted with a dose started after
+  int32_t errorSumCg;
+  uint32_t absErrorSumCg;
+  int64_t squaredErrorSumCg;
+  int16_t worstErrorCg;
+  uint32_t grindMsSum; // start to stop of the finished doses
+  uint32_t swapMsSum; // cup lifted to the next dose started
+};
+
+// ScaleStatusTask only
+void startSession();
+void stopSession();
+void sessionDoseStarted(const ShotRecord &shot);
+void sessionDoseFinished(const ShotRecord &shot);
+void sessionCupLifted(uint32_t timestampMs);
+
+SessionStats sessionStats(); // any task
+void printSessionSummary(Print &out);
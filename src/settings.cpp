@@ -0,0 +1,302 @@
+#include "settings.hpp"
+#include "tasks.hpp"
+#include <Preferences.h>
+
+Preferences preferences;
+
+TaskHandle_t SettingsTask = NULL;
+
+ScaleSettings settingsCache = {}; // what flash holds after the next write
+bool settingsDirty = false;
+portMUX_TYPE settingsMux = portMUX_INITIALIZER_UNLOCKED; // guards settingsCache against SettingsTask
+
+uint16_t calculateChecksum(const ScaleSettings& settings) {
+  uint16_t sum = (settings.calibrationHundredths & 0xFFFF) + ((settings.calibrationHundredths >> 16) & 0xFFFF) +
+                 settings.scaleMode + settings.grindMode + settings.activeBean + 0xABCD;
+  for (const BeanProfile &bean : settings.beans) {
+    for (char c : bean.name) {
+      sum += (uint8_t)c;
+    }
+    sum += bean.setWeightTenths + bean.cupWeightTenths + bean.offsetHundredths + bean.stopLatencyMs + bean.inFlightHundredths;
+  }
+  return sum;
+}
+
+BeanProfile &activeProfile() {
+  return settingsCache.beans[settingsCache.activeBean];
+}
+
+// Changes a cached setting and (re)starts the countdown to writing it
+template<typename T>
+void updateSetting(T &field, T value) {
+  portENTER_CRITICAL(&settingsMux);
+  bool changed = field != value;
+  field = value;
+  settingsDirty = settingsDirty || changed;
+  portEXIT_CRITICAL(&settingsMux);
+
+  if (changed && SettingsTask != NULL) {
+    xTaskNotifyGive(SettingsTask);
+  }
+}
+
+void saveOffset(Weight newOffset) {
+  // Validate reasonable range
+  if (newOffset < Weight(MIN_OFFSET) || newOffset > Weight(MAX_OFFSET)) {
+    Serial.print("Invalid offset ");
+    Serial.print(newOffset.toFloat());
+    Serial.println(", using default");
+    newOffset = Weight(COFFEE_DOSE_OFFSET);
+  }
+
+  updateSetting(activeProfile().offsetHundredths, (int16_t)(newOffset * 100).round());
+
+  Serial.print("Saved offset: ");
+  Serial.println(newOffset.toFloat());
+}
+
+void saveCupWeight(Weight newCupWeight) {
+  if (newCupWeight < Weight(MIN_CUP_WEIGHT) || newCupWeight > Weight(MAX_CUP_WEIGHT)) {
+    Serial.print("Invalid cup weight ");
+    Serial.print(newCupWeight.toFloat());
+    Serial.println(", using default");
+    newCupWeight = CUP_WEIGHT;
+  }
+
+  updateSetting(activeProfile().cupWeightTenths, (int16_t)(newCupWeight * 10).round());
+
+  Serial.print("Saved cup weight: ");
+  Serial.println(newCupWeight.toFloat());
+}
+
+void saveSetWeight(Weight newSetWeight) {
+  if (newSetWeight < Weight(MIN_SET_WEIGHT) || newSetWeight > Weight(MAX_SET_WEIGHT)) {
+    Serial.print("Invalid set weight ");
+    Serial.print(newSetWeight.toFloat());
+    Serial.println(", using default");
+    newSetWeight = COFFEE_DOSE_WEIGHT;
+  }
+
+  updateSetting(activeProfile().setWeightTenths, (int16_t)(newSetWeight * 10).round());
+
+  Serial.print("Saved set weight: ");
+  Serial.println(newSetWeight.toFloat());
+}
+
+void saveCalibration(double newCalibration) {
+  updateSetting(settingsCache.calibrationHundredths, (int32_t)lround(newCalibration * 100));
+
+  Serial.print("Saved calibration: ");
+  Serial.println(newCalibration);
+}
+
+void saveScaleMode(bool mode) {
+  updateSetting(settingsCache.scaleMode, (uint8_t)(mode ? 1 : 0));
+}
+
+void saveGrindMode(bool mode) {
+  updateSetting(settingsCache.grindMode, (uint8_t)(mode ? 1 : 0));
+}
+
+void saveStopModel(double latency, double inFlight) {
+  updateSetting(activeProfile().stopLatencyMs, (int16_t)lround(latency * 1000));
+  updateSetting(activeProfile().inFlightHundredths, (int16_t)lround(inFlight * 100));
+}
+
+Weight loadOffset() {
+  return Weight(activeProfile().offsetHundredths) / 100;
+}
+
+Weight loadCupWeight() {
+  return Weight(activeProfile().cupWeightTenths) / 10;
+}
+
+Weight loadSetWeight() {
+  return Weight(activeProfile().setWeightTenths) / 10;
+}
+
+double loadCalibration() {
+  return settingsCache.calibrationHundredths / 100.0;
+}
+
+bool loadScaleMode() {
+  return settingsCache.scaleMode != 0;
+}
+
+bool loadGrindMode() {
+  return settingsCache.grindMode != 0;
+}
+
+void loadStopModel(double &latency, double &inFlight) {
+  latency = activeProfile().stopLatencyMs / 1000.0;
+  inFlight = activeProfile().inFlightHundredths / 100.0;
+}
+
+void saveActiveBean(uint8_t bean) {
+  updateSetting(settingsCache.activeBean, (uint8_t)(bean % BEAN_PROFILES));
+}
+
+uint8_t loadActiveBean() {
+  return settingsCache.activeBean;
+}
+
+void saveBeanName(const char *name) {
+  portENTER_CRITICAL(&settingsMux);
+  char *field = activeProfile().name;
+  bool changed = strncmp(field, name, BEAN_NAME_LENGTH - 1) != 0;
+  strncpy(field, name, BEAN_NAME_LENGTH - 1);
+  field[BEAN_NAME_LENGTH - 1] = 0;
+  settingsDirty = settingsDirty || changed;
+  portEXIT_CRITICAL(&settingsMux);
+
+  if (changed && SettingsTask != NULL) {
+    xTaskNotifyGive(SettingsTask);
+  }
+}
+
+void loadBeanName(uint8_t bean, char *name) {
+  portENTER_CRITICAL(&settingsMux);
+  memcpy(name, settingsCache.beans[bean % BEAN_PROFILES].name, BEAN_NAME_LENGTH);
+  portEXIT_CRITICAL(&settingsMux);
+}
+
+void defaultBeanName(uint8_t bean, char *name) {
+  snprintf(name, BEAN_NAME_LENGTH, "Bean %c", (char)('1' + bean));
+}
+
+void resetToDefaults() {
+  Serial.println("Resetting all parameters to defaults");
+  for (uint8_t bean = BEAN_PROFILES; bean-- > 0;) {
+    char name[BEAN_NAME_LENGTH];
+    defaultBeanName(bean, name);
+    saveActiveBean(bean);
+    saveBeanName(name);
+    saveOffset(Weight(COFFEE_DOSE_OFFSET));
+    saveCupWeight(CUP_WEIGHT);
+    saveSetWeight(COFFEE_DOSE_WEIGHT);
+    saveStopModel(STOP_LATENCY_DEFAULT, IN_FLIGHT_DEFAULT);
+  }
+  saveCalibration(LOADCELL_SCALE_FACTOR);
+  saveScaleMode(false);
+  saveGrindMode(false);
+}
+
+// Fills settingsCache from flash, the only time flash is read
+void readSettings() {
+  bool valid = false;
+
+  preferences.begin("scale", true);
+
+  size_t schLen = preferences.getBytesLength("settings");
+  if (schLen == sizeof(ScaleSettings)) {
+    preferences.getBytes("settings", &settingsCache, sizeof(ScaleSettings));
+
+    // Verify checksum
+    valid = settingsCache.checksum == calculateChecksum(settingsCache);
+    if (valid) {
+      Serial.println("Settings loaded and validated successfully");
+    } else {
+      Serial.println("Settings checksum mismatch, using individual parameters");
+    }
+  } else {
+    Serial.println("Settings structure not found or wrong size, using individual parameters");
+  }
+
+  if (!valid) {
+    // one key per parameter, as written by earlier firmware. Every bean starts
+    // from them and the default stop model, the user tells them apart as they go
+    int16_t offsetHundredths = preferences.getShort("offsetHuns", (int16_t)(COFFEE_DOSE_OFFSET * 100));
+    int16_t cupWeightTenths = preferences.getShort("cupWeightTenths", (int16_t)(CUP_WEIGHT * 10));
+    int16_t setWeightTenths = preferences.getShort("setWeightTenths", (int16_t)(COFFEE_DOSE_WEIGHT * 10));
+    settingsCache.calibrationHundredths = preferences.getInt("calibration", (int32_t)(LOADCELL_SCALE_FACTOR * 100));
+    settingsCache.scaleMode = preferences.getBool("scaleMode", false) ? 1 : 0;
+    settingsCache.grindMode = preferences.getBool("grindMode", false) ? 1 : 0;
+    settingsCache.activeBean = 0;
+    for (uint8_t i = 0; i < BEAN_PROFILES; i++) {
+      BeanProfile &bean = settingsCache.beans[i];
+      defaultBeanName(i, bean.name);
+      bean.setWeightTenths = setWeightTenths;
+      bean.cupWeightTenths = cupWeightTenths;
+      bean.offsetHundredths = offsetHundredths;
+      bean.stopLatencyMs = (int16_t)lround(STOP_LATENCY_DEFAULT * 1000);
+      bean.inFlightHundredths = (int16_t)lround(IN_FLIGHT_DEFAULT * 100);
+    }
+    settingsDirty = true; // store them as a single record from now on
+  }
+
+  preferences.end();
+
+  // Validate loaded values, bean by bean
+  if (settingsCache.activeBean >= BEAN_PROFILES) {
+    settingsCache.activeBean = 0;
+    settingsDirty = true;
+  }
+  uint8_t active = settingsCache.activeBean;
+  for (uint8_t bean = 0; bean < BEAN_PROFILES; bean++) {
+    settingsCache.activeBean = bean;
+    BeanProfile &profile = activeProfile();
+    if (profile.name[0] == 0 || memchr(profile.name, 0, BEAN_NAME_LENGTH) == NULL) {
+      defaultBeanName(bean, profile.name);
+      settingsDirty = true;
+    }
+    if (loadOffset() < Weight(MIN_OFFSET) || loadOffset() > Weight(MAX_OFFSET)) {
+      Serial.printf("%s: loaded offset out of range, using default\n", profile.name);
+      saveOffset(Weight(COFFEE_DOSE_OFFSET));
+    }
+    if (loadCupWeight() < Weight(MIN_CUP_WEIGHT) || loadCupWeight() > Weight(MAX_CUP_WEIGHT)) {
+      Serial.printf("%s: loaded cup weight out of range, using default\n", profile.name);
+      saveCupWeight(CUP_WEIGHT);
+    }
+    if (loadSetWeight() < Weight(MIN_SET_WEIGHT) || loadSetWeight() > Weight(MAX_SET_WEIGHT)) {
+      Serial.printf("%s: loaded set weight out of range, using default\n", profile.name);
+      saveSetWeight(COFFEE_DOSE_WEIGHT);
+    }
+    double latency, inFlight;
+    loadStopModel(latency, inFlight);
+    if (latency < 0 || latency > MAX_STOP_LATENCY || inFlight < MIN_IN_FLIGHT || inFlight > MAX_IN_FLIGHT) {
+      Serial.printf("%s: loaded stop model out of range, using default\n", profile.name);
+      saveStopModel(STOP_LATENCY_DEFAULT, IN_FLIGHT_DEFAULT);
+    }
+  }
+  settingsCache.activeBean = active;
+}
+
+void flushSettings() {
+  portENTER_CRITICAL(&settingsMux);
+  ScaleSettings settings = settingsCache;
+  bool dirty = settingsDirty;
+  settingsDirty = false;
+  portEXIT_CRITICAL(&settingsMux);
+
+  if (!dirty) {
+    return;
+  }
+
+  settings.checksum = calculateChecksum(settings);
+
+  preferences.begin("scale", false);
+  preferences.putBytes("settings", &settings, sizeof(ScaleSettings));
+  preferences.end();
+
+  Serial.println("Settings saved");
+}
+
+void settingsLoop(void *parameter) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // every change restarts the delay, so a burst of encoder turns ends up as one write
+    while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SETTINGS_WRITE_DELAY)) > 0) {
+    }
+    flushSettings();
+  }
+}
+
+void setupSettings() {
+  readSettings();
+
+  startTask(TASK_SETTINGS, settingsLoop, &SettingsTask);
+
+  if (settingsDirty) {
+    xTaskNotifyGive(SettingsTask);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "scale.hpp"
+
+// Settings are kept in RAM and written back to flash by SettingsTask once they
+// stopped changing for SETTINGS_WRITE_DELAY, as a single checksummed record.
+#define SETTINGS_WRITE_DELAY 2000 // ms without changes before the settings are written to flash
+
+// What to dose for one bean (or grinder setting) and how the grinder behaves
+// with it, so switching beans doesn't have to relearn the stop model
+struct BeanProfile {
+  char name[BEAN_NAME_LENGTH];
+  int16_t setWeightTenths;
+  int16_t cupWeightTenths;
+  int16_t offsetHundredths;
+  int16_t stopLatencyMs;
+  int16_t inFlightHundredths;
+};
+
+// Storage settings structure for data integrity
+struct ScaleSettings {
+  int32_t calibrationHundredths;
+  uint8_t scaleMode;
+  uint8_t grindMode;
+  uint8_t activeBean;
+  BeanProfile beans[BEAN_PROFILES];
+  uint16_t checksum;
+};
+
+// Helper functions for safe parameter storage/retrieval. Offset, cup weight, set
+// weight and stop model belong to the active bean.
+void saveOffset(Weight newOffset);
+void saveCupWeight(Weight newCupWeight);
+void saveSetWeight(Weight newSetWeight);
+void saveCalibration(double newCalibration);
+void saveScaleMode(bool mode);
+void saveGrindMode(bool mode);
+Weight loadOffset();
+Weight loadCupWeight();
+Weight loadSetWeight();
+double loadCalibration();
+bool loadScaleMode();
+bool loadGrindMode();
+void saveStopModel(double latency, double inFlight);
+void loadStopModel(double &latency, double &inFlight);
+void saveActiveBean(uint8_t bean);
+uint8_t loadActiveBean();
+void saveBeanName(const char *name); // of the active bean, cut to BEAN_NAME_LENGTH - 1
+void loadBeanName(uint8_t bean, char *name); // BEAN_NAME_LENGTH bytes
+void resetToDefaults();
+uint16_t calculateChecksum(const ScaleSettings& settings);
+
+void flushSettings(); // write pending changes now
+void setupSettings(); // read flash once and start SettingsTask
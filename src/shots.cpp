@@ -0,0 +1,122 @@
+#include "shots.hpp"
+#include "tasks.hpp"
+#include "telemetry.hpp"
+#include "session.hpp"
+
+ShotLog shotLog;
+TaskHandle_t ShotLogTask = NULL;
+QueueHandle_t shotQueue = NULL; // records from ScaleStatusTask to ShotLogTask
+
+static_assert(BEAN_PROFILES <= (SHOT_BEAN_MASK >> SHOT_BEAN_SHIFT) + 1, "bean number doesn't fit the shot flags");
+
+ShotRecord currentShot; // only touched by ScaleStatusTask
+bool shotOpen = false;
+Weight shotCup = 0;
+
+int16_t centigrams(Weight weight) {
+  int64_t value = (Weight::Wide(weight) * 100).round();
+  return (int16_t)constrain(value, (int64_t)INT16_MIN, (int64_t)INT16_MAX);
+}
+
+void shotStarted(int64_t timestampMs, Weight target, Weight cup) {
+  currentShot = {};
+  currentShot.startedAtMs = (uint32_t)timestampMs;
+  currentShot.targetCg = centigrams(target);
+  currentShot.offsetCg = centigrams(offset);
+  currentShot.cupCg = centigrams(cup);
+  currentShot.flags = (scaleMode ? SHOT_SCALE_MODE : 0) | (grindMode ? SHOT_CONTINUOUS : 0) |
+                      ((activeBean << SHOT_BEAN_SHIFT) & SHOT_BEAN_MASK);
+  currentShot.curveIntervalMs = SHOT_CURVE_INTERVAL;
+  shotCup = cup;
+  shotOpen = true;
+  telemetryDoseStarted(currentShot);
+  sessionDoseStarted(currentShot);
+}
+
+void shotSample(int64_t timestampMs, Weight weight) {
+  if (!shotOpen) {
+    return;
+  }
+  int64_t elapsed = timestampMs - (int64_t)currentShot.startedAtMs;
+  while (elapsed >= (int64_t)SHOT_CURVE_POINTS * currentShot.curveIntervalMs) {
+    if (currentShot.curveIntervalMs > UINT16_MAX / 2) {
+      return; // cup left on the scale for ages, the curve has what matters
+    }
+    // full, keep every other point at twice the interval
+    for (size_t i = 0; i < SHOT_CURVE_POINTS / 2; i++) {
+      currentShot.curve[i] = currentShot.curve[2 * i];
+    }
+    currentShot.curvePoints = (currentShot.curvePoints + 1) / 2;
+    currentShot.curveIntervalMs *= 2;
+  }
+
+  int16_t value = centigrams(weight - shotCup);
+  while (currentShot.curvePoints <= elapsed / currentShot.curveIntervalMs) {
+    currentShot.curve[currentShot.curvePoints++] = value;
+  }
+}
+
+void shotStopped(bool predicted, Weight flowRate, double stopLatency, double inFlight) {
+  if (!shotOpen) {
+    return;
+  }
+  currentShot.grindMs = (uint16_t)constrain((int64_t)millis() - (int64_t)currentShot.startedAtMs, (int64_t)0, (int64_t)UINT16_MAX);
+  currentShot.flowCgPerS = centigrams(flowRate);
+  currentShot.stopLatencyMs = (int16_t)lround(stopLatency * 1000);
+  currentShot.inFlightCg = (int16_t)lround(inFlight * 100);
+  currentShot.flags |= predicted ? SHOT_PREDICTED : 0;
+}
+
+void shotFinished(Weight weight, uint8_t flags) {
+  if (!shotOpen) {
+    return;
+  }
+  shotOpen = false;
+  currentShot.dosedCg = centigrams(weight - shotCup);
+  currentShot.flags |= flags;
+  telemetryDoseFinished(currentShot);
+  sessionDoseFinished(currentShot);
+  if (shotQueue == NULL) {
+    return; // no log partition
+  }
+  if (xQueueSend(shotQueue, &currentShot, 0) != pdPASS) {
+    Serial.println("Shot log queue full, dose not logged");
+  }
+}
+
+void exportShots(Print &out) {
+  out.printf("#shots %u %u\n", (unsigned)shotLog.count(), (unsigned)sizeof(ShotRecord));
+  size_t streamed = 0;
+  shotLog.forEach([&out, &streamed](const ShotRecord &record) {
+    const uint8_t *bytes = (const uint8_t *)&record;
+    out.print("#shot ");
+    for (size_t i = 0; i < sizeof(ShotRecord); i++) {
+      out.printf("%02x", bytes[i]);
+    }
+    out.println();
+    if (++streamed % SHOT_EXPORT_CHUNK == 0) {
+      delay(1); // let the UART drain and the scale tasks run
+    }
+  });
+  out.println("#end");
+}
+
+void shotLogLoop(void *parameter) {
+  ShotRecord record;
+  for (;;) {
+    if (xQueueReceive(shotQueue, &record, portMAX_DELAY) == pdTRUE && !shotLog.append(record)) {
+      Serial.println("Shot log write failed");
+    }
+  }
+}
+
+void setupShots() {
+  if (!shotLog.begin(SHOT_LOG_PARTITION)) {
+    Serial.println("Shot log partition not found, doses are not logged");
+    return;
+  }
+  Serial.printf("Shot log: %u of %u doses\n", (unsigned)shotLog.count(), (unsigned)shotLog.capacity());
+
+  shotQueue = xQueueCreate(SHOT_QUEUE_SIZE, sizeof(ShotRecord));
+  startTask(TASK_SHOT_LOG, shotLogLoop, &ShotLogTask);
+}
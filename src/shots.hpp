@@ -0,0 +1,21 @@
+#pragma once
+
+#include "scale.hpp"
+#include <ShotLog.h>
+
+// Every dose is logged to the "shots" flash partition (see partitions.csv) as a
+// ShotRecord. ScaleStatusTask only fills in the record and queues it, ShotLogTask
+// does the flash writes. 'h' on the serial console streams the log out, decode
+// it with tools/shots_to_csv.py.
+#define SHOT_LOG_PARTITION "shots"
+#define SHOT_QUEUE_SIZE 4 // finished records waiting for the flash write
+#define SHOT_CURVE_INTERVAL 100 // ms between curve points, doubled whenever the curve fills up
+#define SHOT_EXPORT_CHUNK 16 // records streamed before other tasks get a turn
+
+void shotStarted(int64_t timestampMs, Weight target, Weight cup); // grinding started
+void shotSample(int64_t timestampMs, Weight weight); // while the dose is open
+void shotStopped(bool predicted, Weight flowRate, double stopLatency, double inFlight);
+void shotFinished(Weight weight, uint8_t flags); // logs the dose
+
+void exportShots(Print &out);
+void setupShots();
@@ -0,0 +1,111 @@
+#include "buffer_bench.hpp"
+
+#include <MathBuffer.h>
+#include <chrono>
+#include <stdio.h>
+
+#include "../scale.hpp"
+
+namespace {
+
+const size_t queries = 2000000;
+
+typedef MathBuffer<Weight, samplesIn(10000) + samplesIn(1000)> History; // like weightHistory
+typedef MathBuffer<Weight, MAX_GRINDING_TIME * 80 / 1000> LongHistory; // a whole dose at 80 SPS
+
+volatile int64_t benchSink; // keeps the timed queries from being optimized away
+
+// averageSince and maxSince as they were built on executeOnSamplesSince
+template<typename Buffer>
+Weight functionAverage(Buffer &history, int64_t cutoffMs) {
+  size_t sampleCount = 0;
+  history.executeOnSamplesSince(cutoffMs, [&sampleCount](Weight value, int64_t ms) { sampleCount++; });
+  Weight average = 0;
+  history.executeOnSamplesSince(cutoffMs, [&average, &sampleCount](Weight value, int64_t ms) {
+    average += value / (int64_t)sampleCount;
+  });
+  return average;
+}
+
+template<typename Buffer>
+Weight functionMax(Buffer &history, int64_t cutoffMs) {
+  Weight max = 0;
+  bool isFirst = true;
+  history.executeOnSamplesSince(cutoffMs, [&max, &isFirst](Weight value, int64_t ms) {
+    if (isFirst || value > max) {
+      max = value;
+      isFirst = false;
+    }
+  });
+  return max;
+}
+
+template<typename Buffer>
+Weight rangeMax(Buffer &history, int64_t cutoffMs) {
+  Weight max = 0;
+  bool isFirst = true;
+  for (auto sample : history.samplesSince(cutoffMs)) {
+    if (isFirst || sample.value > max) {
+      max = sample.value;
+      isFirst = false;
+    }
+  }
+  return max;
+}
+
+template<typename Buffer, typename Query>
+double timeQuery(Buffer &history, int64_t newestMs, Query query) {
+  int64_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries; i++) {
+    sink += query(history, newestMs - (int64_t)(i & 1)).raw(); // a cutoff the compiler can't hoist
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / queries;
+  benchSink = sink;
+  return ns;
+}
+
+// Fills the buffer at sps and times the queries over the last spanMs
+template<typename Buffer>
+void benchSpan(Buffer &history, int sps, int64_t spanMs) {
+  int window = history.registerWindow(spanMs);
+  int64_t newestMs = 0;
+  for (size_t i = 0; i < Buffer::capacity; i++) {
+    newestMs = (int64_t)(i * 1000 / sps);
+    history.push(Weight(70) + Weight((int)(i % 7)) / 100, newestMs);
+  }
+  auto since = [spanMs](int64_t ms) { return ms - spanMs; };
+
+  double function = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return functionAverage(h, since(ms)); });
+  double visitor = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return h.averageSince(since(ms)); });
+  double windowed = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return h.windowAverage(window) + Weight::fromRaw((int32_t)(ms & 1)); });
+  printf("%-8s %7zu %9lld ms %12.1f %12.1f %12s %12.1f\n", "average", Buffer::capacity, (long long)spanMs, function, visitor, "", windowed);
+
+  function = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return functionMax(h, since(ms)); });
+  visitor = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return h.maxSince(since(ms)); });
+  double range = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return rangeMax(h, since(ms)); });
+  windowed = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return h.windowMax(window) + Weight::fromRaw((int32_t)(ms & 1)); });
+  printf("%-8s %7zu %9lld ms %12.1f %12.1f %12.1f %12.1f\n", "max", Buffer::capacity, (long long)spanMs, function, visitor, range, windowed);
+
+  double count = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return Weight::fromRaw((int32_t)h.countSamplesSince(since(ms))); });
+  double older = timeQuery(history, newestMs, [&](Buffer &h, int64_t ms) { return h.firstValueOlderThan(since(ms)); });
+  printf("%-8s %7zu %9lld ms %12s %12.1f\n", "count", Buffer::capacity, (long long)spanMs, "", count);
+  printf("%-8s %7zu %9lld ms %12s %12.1f\n", "older", Buffer::capacity, (long long)spanMs, "", older);
+}
+
+}
+
+int runBufferBench() {
+  static History history;
+  static History history10s;
+  static LongHistory longHistory;
+  static LongHistory longHistory30s;
+
+  printf("ns per query over the samples in the last span\n\n");
+  printf("%-8s %7s %12s %12s %12s %12s %12s\n", "query", "samples", "span", "std::function", "visitor", "range", "window");
+  benchSpan(history, LOADCELL_SPS, 1000);
+  benchSpan(history10s, LOADCELL_SPS, 10000);
+  benchSpan(longHistory, 80, 1000);
+  benchSpan(longHistory30s, 80, MAX_GRINDING_TIME);
+  return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Times the MathBuffer queries over a buffer shaped like weightHistory: the
+// std::function iteration the aggregates used to be built on, the templated
+// visitor and range they use now, and the sliding windows, on this machine.
+int runBufferBench();
@@ -0,0 +1,31 @@
+#include "display_load.hpp"
+
+#include <Arduino.h>
+
+#include "../scale.hpp"
+#include "../tasks.hpp"
+
+namespace {
+
+const uint64_t frameUs = 2000;         // drawing the frame and sending the changed tiles
+const uint32_t refreshMs = 50;         // REFRESH_INTERVAL
+const uint32_t grindingRefreshMs = 20; // GRINDING_REFRESH_INTERVAL
+const unsigned long sleepAfterMs = 60 * 1000;
+
+TaskHandle_t DisplayLoadTask;
+
+void displayLoop(void *parameter) {
+  for (;;) {
+    ScaleState state = readScaleState();
+    if (millis() - state.lastSignificantWeightChangeAt <= sleepAfterMs) {
+      sim::spend(frameUs);
+    }
+    delay(state.status == STATUS_GRINDING_IN_PROGRESS ? grindingRefreshMs : refreshMs);
+  }
+}
+
+}
+
+void setupDisplayLoad() {
+  startTask(TASK_DISPLAY, displayLoop, &DisplayLoadTask);
+}
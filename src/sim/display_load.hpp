@@ -0,0 +1,6 @@
+#pragma once
+
+// Stands in for the display task, which needs U8g2 and is not built natively: it
+// takes as much CPU per frame as rendering and the I2C driver roughly do, at the
+// refresh rates of src/display.cpp, where taskPlacement puts the display.
+void setupDisplayLoad();
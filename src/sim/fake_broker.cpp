@@ -0,0 +1,73 @@
+#include "fake_broker.hpp"
+
+#include <SimScheduler.h>
+#include <string>
+
+bool FakeBroker::down() const {
+  uint64_t now = sim::now();
+  for (const Outage &outage : outages) {
+    if (now >= outage.fromUs && now < outage.toUs) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FakeBroker::connected() {
+  return isConnected;
+}
+
+bool FakeBroker::connect() {
+  if (down()) {
+    sim::sleepFor(timeoutUs);
+    return false;
+  }
+  sim::spend(connectUs);
+  isConnected = true;
+  return true;
+}
+
+bool FakeBroker::publish(const char *topic, const char *payload, size_t length) {
+  if (!isConnected) {
+    return false;
+  }
+  if (down()) {
+    sim::sleepFor(timeoutUs);
+    isConnected = false;
+    return false;
+  }
+  sim::spend(publishUs);
+  receive(payload, length);
+  return true;
+}
+
+// Counts the events of a TelemetryBatch payload
+void FakeBroker::receive(const char *payload, size_t length) {
+  payloads++;
+  largestPayload = length > largestPayload ? length : largestPayload;
+  std::string text(payload, length);
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    std::string line = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    start = end == std::string::npos ? text.size() : end + 1;
+    if (line.empty()) {
+      continue;
+    }
+    if (line[0] == TELEMETRY_SAMPLE) {
+      size_t fields = 0;
+      for (size_t i = 0; i < line.size(); i++) {
+        fields += line[i] == ' ';
+      }
+      samples += fields >= 3 ? fields - 2 : 0; // "w <ms> <interval>" then the weights
+    } else if (line[0] == TELEMETRY_DOSE_STARTED) {
+      started++;
+    } else if (line[0] == TELEMETRY_DOSE_FINISHED) {
+      finished++;
+    } else if (line[0] == TELEMETRY_DOSE_FAILED) {
+      failed++;
+    } else if (line[0] == TELEMETRY_OFFSET) {
+      offsets++;
+    }
+  }
+}
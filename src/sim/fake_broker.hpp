@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "../telemetry.hpp"
+
+// In-process stand-in for an MQTT broker behind the TelemetryLink the firmware
+// publishes through. Publishing costs the telemetry task CPU time like a TCP
+// write over WiFi. While the broker is down a connect attempt or a publish waits
+// for the socket timeout and fails, and the connection is lost.
+//
+// What arrives is decoded again, so a run can check every dose made it.
+class FakeBroker : public TelemetryLink {
+public:
+  struct Outage {
+    uint64_t fromUs;
+    uint64_t toUs;
+  };
+
+  uint64_t publishUs = 2000;
+  uint64_t connectUs = 30000;
+  uint64_t timeoutUs = 3000 * 1000;
+  std::vector<Outage> outages;
+
+  bool connected() override;
+  bool connect() override;
+  bool publish(const char *topic, const char *payload, size_t length) override;
+
+  // received so far
+  uint32_t payloads = 0;
+  uint32_t samples = 0;
+  uint32_t started = 0;
+  uint32_t finished = 0;
+  uint32_t failed = 0;
+  uint32_t offsets = 0;
+  size_t largestPayload = 0;
+
+private:
+  bool down() const;
+  void receive(const char *payload, size_t length);
+
+  bool isConnected = false;
+};
@@ -0,0 +1,221 @@
+#include "filter_bench.hpp"
+
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#include "../scale.hpp"
+#include "replay.hpp"
+
+namespace {
+
+const double rampSlope = 0.5;     // g/s, samples climbing faster than this measure lag
+const double stepSlope = 20;      // g/s, faster than this is a step (cup on/off), not a ramp
+const double restSlope = 0.01;    // g/s, below this the weight is at rest
+const int64_t settleMs = 1000;    // rest only counts this long after the last movement
+const size_t timedSamples = 200000;
+const int64_t referenceMs = 500;  // each side of the centered average standing in for a missing truth
+
+volatile int64_t benchSink; // keeps the timed filter runs from being optimized away
+
+struct TracePoint {
+  int64_t ms;
+  double measured;
+  double truth;
+  double slope;    // g/s of the truth
+  bool ramp;
+  bool rest;
+};
+
+// Three doses of 18 g at 1, 2 and 3 g/s into a 70 g cup, sampled at 10 SPS
+std::vector<TracePoint> synthesizeTrace(uint32_t seed) {
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0, 0.03);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<TracePoint> trace;
+
+  double weight = 0;
+  double speed = 0;
+  int64_t ms = 0;
+  auto run = [&](int64_t durationMs, double flow, bool motor) {
+    for (int64_t end = ms + durationMs; ms < end; ms++) {
+      speed += ((motor ? 1.0 : 0.0) - speed) / (motor ? 200.0 : 90.0);
+      weight += flow * speed / 1000;
+      if (ms % 100 == 0) {
+        double spike = uniform(random) < 0.01 ? (uniform(random) < 0.5 ? -3 : 3) : 0;
+        trace.push_back({ms, weight + noise(random) + spike, weight, 0, false, false});
+      }
+    }
+  };
+
+  for (double flow : {1.0, 2.0, 3.0}) {
+    run(3000, 0, false);
+    weight += 70;
+    run(3000, 0, false);
+    double start = weight;
+    while (weight - start < 18 - flow * 0.09) {
+      run(1, flow, true);
+    }
+    run(5000, flow, false);
+    weight = 0;
+    run(2000, 0, false);
+  }
+  return trace;
+}
+
+bool loadTrace(const char *path, std::vector<TracePoint> &trace, bool &hasTruth) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("cannot open %s\n", path);
+    return false;
+  }
+
+  hasTruth = true;
+  if (fgetc(file) == 0) {
+    // raw capture, frames start with a zero
+    fclose(file);
+    RecordedTrace recorded;
+    if (!loadRecordedTrace(path, recorded)) {
+      return false;
+    }
+    for (const RecordedTrace::Sample &sample : recorded.samples) {
+      double grams = recorded.gramsOf(sample.raw);
+      trace.push_back({(sample.us - recorded.samples[0].us) / 1000, grams, grams, 0, false, false});
+    }
+    hasTruth = false;
+  } else {
+    rewind(file);
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      long long ms;
+      double measured, truth;
+      int fields = sscanf(line, "%lld,%lf,%lf", &ms, &measured, &truth);
+      if (fields < 2) {
+        continue; // header or comment
+      }
+      hasTruth = hasTruth && fields == 3;
+      trace.push_back({(int64_t)ms, measured, fields == 3 ? truth : measured, 0, false, false});
+    }
+    fclose(file);
+  }
+
+  if (!hasTruth) {
+    // zero phase reference: centered average over a second, at any sample rate
+    std::vector<TracePoint> reference = trace;
+    size_t from = 0, to = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+      while (trace[i].ms - trace[from].ms > referenceMs) {
+        from++;
+      }
+      while (to + 1 < trace.size() && trace[to + 1].ms - trace[i].ms <= referenceMs) {
+        to++;
+      }
+      double sum = 0;
+      for (size_t j = from; j <= to; j++) {
+        sum += reference[j].measured;
+      }
+      trace[i].truth = sum / (to - from + 1);
+    }
+  }
+  return !trace.empty();
+}
+
+// The slope is taken between the neighbours spanMs / 2 away, or the adjacent
+// samples with spanMs 0. A noisy reference needs the longer span to find rest.
+void classify(std::vector<TracePoint> &trace, int64_t spanMs) {
+  int64_t movedAt = INT64_MIN / 2;
+  for (size_t i = 0; i < trace.size(); i++) {
+    size_t previous = i > 0 ? i - 1 : i;
+    while (previous > 0 && trace[i].ms - trace[previous].ms < spanMs / 2) {
+      previous--;
+    }
+    size_t next = i + 1 < trace.size() ? i + 1 : i;
+    while (next + 1 < trace.size() && trace[next].ms - trace[i].ms < spanMs / 2) {
+      next++;
+    }
+    int64_t neighbourMs = trace[next].ms - trace[previous].ms;
+    TracePoint &point = trace[i];
+    point.slope = neighbourMs > 0 ? (trace[next].truth - trace[previous].truth) * 1000 / neighbourMs : 0;
+
+    double steepness = fabs(point.slope);
+    point.ramp = steepness >= rampSlope && steepness < stepSlope;
+    if (steepness >= restSlope) {
+      movedAt = point.ms;
+    }
+    point.rest = point.ms - movedAt >= settleMs;
+  }
+}
+
+template<typename Filter>
+void benchFilter(const char *name, Filter filter, const std::vector<TracePoint> &trace) {
+  std::vector<Weight> input;
+  for (const TracePoint &point : trace) {
+    input.push_back(Weight(point.measured));
+  }
+  Filter timed = filter;
+
+  double lagMs = 0, restSquares = 0, restWorst = 0;
+  size_t ramps = 0, rests = 0;
+  for (size_t i = 0; i < trace.size(); i++) {
+    double error = filter.update(input[i]).toDouble() - trace[i].truth;
+    if (trace[i].ramp) {
+      lagMs += -error / trace[i].slope * 1000;
+      ramps++;
+    }
+    if (trace[i].rest) {
+      restSquares += error * error;
+      restWorst = fmax(restWorst, fabs(error));
+      rests++;
+    }
+  }
+
+  int64_t sink = 0;
+  size_t samples = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (samples < timedSamples) {
+    for (Weight value : input) {
+      sink += timed.update(value).raw();
+    }
+    samples += input.size();
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+  benchSink = sink;
+
+  printf("%-28s %8.1f %11.4f %11.3f %9.1f\n", name, ramps ? lagMs / ramps : NAN,
+         rests ? sqrt(restSquares / rests) : NAN, restWorst, ns);
+}
+
+}
+
+int runFilterBench(const char *tracePath, uint32_t seed) {
+  std::vector<TracePoint> trace;
+  bool hasTruth = true;
+  if (tracePath) {
+    if (!loadTrace(tracePath, trace, hasTruth)) {
+      return 1;
+    }
+  } else {
+    trace = synthesizeTrace(seed);
+  }
+  classify(trace, hasTruth ? 0 : 2 * referenceMs);
+
+  size_t ramps = 0, rests = 0;
+  for (const TracePoint &point : trace) {
+    ramps += point.ramp;
+    rests += point.rest;
+  }
+  printf("%zu samples, %zu on ramps, %zu at rest\n\n", trace.size(), ramps, rests);
+  printf("%-28s %8s %11s %11s %9s\n", "filter", "lag ms", "rest rms g", "rest max g", "ns/sample");
+
+  benchFilter("kalman 0.02/0.02/0.01", KalmanFilter<Weight>(Weight(0.02), Weight(0.02), Weight(0.01)), trace);
+  benchFilter("median 3", MedianFilter<Weight, 3>(), trace);
+  benchFilter("median 5", MedianFilter<Weight, 5>(), trace);
+  benchFilter("ema 0.3", ExponentialFilter<Weight>(Weight(0.3)), trace);
+  benchFilter("moving average 4", MovingAverage<Weight, 4>(), trace);
+  benchFilter("adaptive kalman", makeScaleFilter().stage<1>(), trace);
+  benchFilter("grinding chain", makeGrindingFilter(), trace);
+  benchFilter("scale chain", makeScaleFilter(), trace);
+  return 0;
+}
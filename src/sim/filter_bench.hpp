@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// Replays a load cell trace through the weight filters and reports, per
+// configuration, how far each lags behind a ramp, how much noise it lets
+// through at rest and how long it takes per sample on this machine.
+//
+// Without tracePath a trace of three doses at 1, 2 and 3 g/s is synthesized,
+// with the true weight known. A recorded trace is a raw capture (see
+// src/capture.hpp) or a CSV of "ms,grams" or "ms,grams,truth" lines; without a
+// truth column the average of the measurements within referenceMs (500 ms) on
+// either side stands in for it, whatever the sample rate.
+int runFilterBench(const char *tracePath, uint32_t seed);
@@ -0,0 +1,138 @@
+#include "grinder.hpp"
+#include <HX711.h>
+
+Grinder::Grinder(const GrinderConfig &config) :
+    config(config), random(config.seed), normal(0, 1), uniform(0, 1),
+    steppedUntil(0), pinLevel(0), command(false), stopCommandAt(0), starts(0), pending(false), pendingState(false), pendingAt(0),
+    speed(0), noise(0), chute(0), falling{}, fallIndex(0), landingRate(0), cup(0), dosed(0), load(0), drift(0),
+    watchLevel(0), watchAt(0) {
+  fallSlots = constrain((size_t)config.fallMs, (size_t)1, sizeof(falling) / sizeof(falling[0]));
+}
+
+void Grinder::attach() {
+  steppedUntil = sim::now();
+  sim::onPinWrite([this](uint8_t pin, uint8_t val) { onPin(pin, val); });
+  sim::setLoadCellSignal([this]() { return sample(); });
+}
+
+void Grinder::setFlowRate(double gramsPerSecond) {
+  config.flowRate = gramsPerSecond;
+}
+
+void Grinder::setRetention(double ms) {
+  config.retentionMs = ms;
+}
+
+void Grinder::placeCup(double grams) {
+  advance();
+  cup = grams;
+  dosed = 0;
+}
+
+void Grinder::removeCup() {
+  advance();
+  cup = 0;
+  dosed = 0;
+}
+
+void Grinder::setLoad(double grams) {
+  advance();
+  load = grams;
+}
+
+double Grinder::dosedGrams() {
+  advance();
+  return dosed;
+}
+
+double Grinder::inFlightGrams() {
+  advance();
+  double sum = chute;
+  for (size_t i = 0; i < fallSlots; i++) {
+    sum += falling[i];
+  }
+  return sum;
+}
+
+double Grinder::trueWeight() {
+  advance();
+  return cup + dosed + load + drift + landingRate * config.impactPerFlow;
+}
+
+void Grinder::watch(double level) {
+  watchLevel = level;
+  watchAt = 0;
+}
+
+void Grinder::onPin(uint8_t pin, uint8_t val) {
+  if (pin != config.pin) {
+    return;
+  }
+  advance();
+  bool rising = val && !pinLevel;
+  pinLevel = val;
+
+  bool target = config.pushButton ? (rising ? !command : command) : val != 0;
+  if (target == command) {
+    return;
+  }
+  command = target;
+  if (!command) {
+    stopCommandAt = sim::now();
+  } else {
+    starts++;
+  }
+  pending = true;
+  pendingState = command;
+  pendingAt = sim::now() + (uint64_t)(config.relayLatencyMs * 1000);
+}
+
+void Grinder::advance() {
+  uint64_t now = sim::now();
+  const double dt = 0.001;
+
+  while (steppedUntil + 1000 <= now) {
+    steppedUntil += 1000;
+
+    if (pending && steppedUntil >= pendingAt) {
+      pending = false;
+    }
+    bool running = pending ? !pendingState : command;
+
+    double tau = (running ? config.spinUpMs : config.spinDownMs) / 1000;
+    speed += ((running ? 1.0 : 0.0) - speed) * dt / tau;
+    if (speed < 1e-4 && !running) {
+      speed = 0;
+    }
+
+    // Ornstein-Uhlenbeck flow fluctuation with a 100 ms correlation time
+    noise += -noise * dt / 0.1 + config.flowNoise * sqrt(2 * dt / 0.1) * normal(random);
+    double produced = config.flowRate * speed * (1 + noise) * dt;
+    chute += produced > 0 ? produced : 0;
+
+    double released = chute * dt / (config.retentionMs / 1000);
+    chute -= released;
+
+    double landed = falling[fallIndex];
+    falling[fallIndex] = released;
+    fallIndex = (fallIndex + 1) % fallSlots;
+
+    if (cup > 0) {
+      dosed += landed;
+    }
+    landingRate = landed / dt;
+    drift += config.zeroDriftPerMinute * dt / 60;
+
+    if (watchLevel > 0 && watchAt == 0 && cup + dosed + load + drift + landingRate * config.impactPerFlow >= watchLevel) {
+      watchAt = steppedUntil;
+    }
+  }
+}
+
+long Grinder::sample() {
+  double grams = trueWeight() + config.sensorNoise * normal(random);
+  if (config.spikeChance > 0 && uniform(random) < config.spikeChance) {
+    grams += (uniform(random) < 0.5 ? -1 : 1) * config.spikeGrams;
+  }
+  return config.zeroCounts + lround(grams * config.countsPerGram);
+}
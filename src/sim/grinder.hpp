@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <random>
+
+// Physical model of a grinder dosing into a cup on the load cell.
+//
+// Grounds leave the burrs at the motor's current flow rate, are held up briefly
+// in the chute (exponential retention) and then fall into the cup. The scale
+// sees the landed mass, the impact force of the falling stream, sensor noise
+// and occasional spikes. Everything is stepped in 1 ms increments of virtual time.
+struct GrinderConfig {
+  double flowRate = 1.6;           // g/s at full motor speed
+  double flowNoise = 0.08;         // relative flow fluctuation
+  double spinUpMs = 200;           // motor time constant when starting
+  double spinDownMs = 90;          // motor time constant when stopping
+  double retentionMs = 60;         // chute retention time constant
+  double fallMs = 150;             // time from chute exit to the cup
+  double relayLatencyMs = 12;      // relay pull-in / release time
+  double impactPerFlow = 0.08;     // apparent grams per g/s hitting the cup
+  double sensorNoise = 0.03;       // g rms
+  double spikeChance = 0.0;        // probability of a spike per conversion
+  double spikeGrams = 3;           // amplitude of a spike
+  double zeroDriftPerMinute = 0;   // load cell creep / temperature drift in g
+  double countsPerGram = 7351;     // true calibration of the load cell
+  long zeroCounts = 84213;         // raw reading with nothing on the scale
+  bool pushButton = true;          // true: a pulse toggles the motor, false: motor runs while the pin is high
+  uint8_t pin = 33;
+  uint32_t seed = 1;
+};
+
+class Grinder {
+public:
+  explicit Grinder(const GrinderConfig &config);
+
+  void attach();                   // connect to the simulated load cell and relay pin
+  void setFlowRate(double gramsPerSecond);
+  void setRetention(double ms);    // chute retention, which depends on the beans
+
+  void placeCup(double grams);
+  void removeCup();
+  void setLoad(double grams);      // anything else on the scale, e.g. a hand pressing it
+
+  double dosedGrams();             // grounds that have landed in the cup
+  double inFlightGrams();          // grounds between the burrs and the cup
+  double trueWeight();             // noise free weight the load cell sees
+  bool motorOn() const { return command; }
+  uint64_t lastStopCommandAt() const { return stopCommandAt; }
+  uint32_t startCommands() const { return starts; }
+
+  // remember when the noise free weight first reaches level, 0 until then
+  void watch(double level);
+  uint64_t watchReachedAt() const { return watchAt; }
+
+private:
+  void advance();
+  void onPin(uint8_t pin, uint8_t val);
+  long sample();
+
+  GrinderConfig config;
+  std::mt19937 random;
+  std::normal_distribution<double> normal;
+  std::uniform_real_distribution<double> uniform;
+
+  uint64_t steppedUntil;
+  uint8_t pinLevel;
+  bool command;                    // motor state the relay has been asked for
+  uint64_t stopCommandAt;
+  uint32_t starts;
+  bool pending;                    // command waiting for the relay to switch
+  bool pendingState;
+  uint64_t pendingAt;
+
+  double speed;
+  double noise;
+  double chute;
+  double falling[1000];            // grounds in the air, one slot per ms
+  size_t fallIndex;
+  size_t fallSlots;
+  double landingRate;
+  double cup;
+  double dosed;
+  double load;
+  double drift;
+
+  double watchLevel;
+  uint64_t watchAt;
+};
@@ -0,0 +1,416 @@
+// Native entry point: runs the scale firmware against a simulated grinder rig in
+// virtual time and reports dosing accuracy and stop latency.
+//
+//   pio run -e native && .pio/build/native/program --doses 50 --flow 2.2
+
+#include <Arduino.h>
+#include <AiEsp32RotaryEncoder.h>
+#include <Preferences.h>
+#include <chrono>
+#include <math.h>
+#include <vector>
+
+#include "../scale.hpp"
+#include "../shots.hpp"
+#include "../session.hpp"
+#include "grinder.hpp"
+#include "filter_bench.hpp"
+#include "buffer_bench.hpp"
+#include "replay.hpp"
+#include "display_load.hpp"
+#include "fake_broker.hpp"
+#include "../capture.hpp"
+#include "../tasks.hpp"
+
+struct SimOptions {
+  int doses = 20;
+  double target = 0;         // 0 keeps the firmware default
+  int dial = 0;              // encoder detents turned before the first dose, 0.1 g each
+  double flowJitter = 0.05;  // relative bean to bean flow variation
+  int sps = LOADCELL_SPS;    // rate the simulated HX711 converts at, whatever the firmware expects
+  bool continuous = false;
+  bool verbose = false;
+  bool trace = false;        // print the latency trace summary at the end
+  bool benchFilters = false; // compare the weight filters instead of dosing
+  bool benchBuffer = false;  // time the MathBuffer queries instead of dosing
+  bool sharedCore = false;   // run the tasks the way they were placed before taskPlacement
+  int switchBeans = 0;       // alternate between two beans every that many doses
+  bool singleBean = false;   // ... without selecting their bean profile
+  bool telemetry = false;    // publish to an in-process broker
+  int program = IMPULSE_PROGRAM; // grind program of impulse mode
+  bool session = false;      // turn on session mode from the menu first
+  int swapMs = 0;            // swap cups as soon as a dose is done, with the cup off this long; 0 waits for the scale
+  std::vector<FakeBroker::Outage> brokerOutages;
+  const char *benchTrace = nullptr; // recorded trace for the filter benchmark
+  const char *shotsPath = nullptr;  // where to export the shot log at the end
+  const char *capturePath = nullptr; // raw trace of the doses, as 'r' streams it
+  const char *replayPath = nullptr;  // replay a raw trace instead of simulating a grinder
+  GrinderConfig grinder;
+};
+
+struct DoseResult {
+  bool failed;
+  double target;
+  double dosed;
+  double shown;
+  double seconds;
+  double stopLeadMs;     // how long before the cup actually reached the target the stop was commanded
+  int bursts;            // top-up bursts after the stop
+};
+
+static bool parseOptions(int argc, char **argv, SimOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--verbose")) {
+      options.verbose = true;
+    } else if (!strcmp(arg, "--trace")) {
+      options.trace = true;
+    } else if (!strcmp(arg, "--bench-buffer")) {
+      options.benchBuffer = true;
+    } else if (!strcmp(arg, "--bench-filters")) {
+      options.benchFilters = true;
+    } else if (value && !strcmp(arg, "--bench-trace")) {
+      options.benchFilters = true;
+      options.benchTrace = value; i++;
+    } else if (!strcmp(arg, "--shared-core")) {
+      options.sharedCore = true;
+    } else if (value && !strcmp(arg, "--switch-beans")) {
+      options.switchBeans = atoi(value); i++;
+    } else if (!strcmp(arg, "--single-bean")) {
+      options.singleBean = true;
+    } else if (value && !strcmp(arg, "--program")) {
+      options.program = -1;
+      for (int p = 0; p < GRIND_PROGRAMS; p++) {
+        options.program = strcmp(value, grindPrograms[p].name) ? options.program : p;
+      }
+      if (options.program < 0) {
+        printf("--program takes single, pulse or bulk\n");
+        return false;
+      }
+      i++;
+    } else if (!strcmp(arg, "--session")) {
+      options.session = true;
+      options.swapMs = options.swapMs > 0 ? options.swapMs : 400;
+    } else if (value && !strcmp(arg, "--swap")) {
+      options.swapMs = atoi(value); i++;
+    } else if (!strcmp(arg, "--telemetry")) {
+      options.telemetry = true;
+    } else if (value && !strcmp(arg, "--broker-outage")) {
+      double from = 0, to = 0;
+      if (sscanf(value, "%lf,%lf", &from, &to) != 2 || to <= from) {
+        printf("--broker-outage takes from,to in seconds\n");
+        return false;
+      }
+      options.telemetry = true;
+      options.brokerOutages.push_back({(uint64_t)(from * 1e6), (uint64_t)(to * 1e6)});
+      i++;
+    } else if (!strcmp(arg, "--continuous")) {
+      options.continuous = true;
+    } else if (value && !strcmp(arg, "--doses")) {
+      options.doses = atoi(value); i++;
+    } else if (value && !strcmp(arg, "--target")) {
+      options.target = atof(value); i++;
+    } else if (value && !strcmp(arg, "--dial")) {
+      options.dial = atoi(value); i++;
+    } else if (value && !strcmp(arg, "--flow")) {
+      options.grinder.flowRate = atof(value); i++;
+    } else if (value && !strcmp(arg, "--flow-jitter")) {
+      options.flowJitter = atof(value); i++;
+    } else if (value && !strcmp(arg, "--noise")) {
+      options.grinder.sensorNoise = atof(value); i++;
+    } else if (value && !strcmp(arg, "--drift")) {
+      options.grinder.zeroDriftPerMinute = atof(value); i++;
+    } else if (value && !strcmp(arg, "--spikes")) {
+      options.grinder.spikeChance = atof(value); i++;
+    } else if (value && !strcmp(arg, "--capture")) {
+      options.capturePath = value; i++;
+    } else if (value && !strcmp(arg, "--replay")) {
+      options.replayPath = value; i++;
+    } else if (value && !strcmp(arg, "--shots")) {
+      options.shotsPath = value; i++;
+    } else if (value && !strcmp(arg, "--sps")) {
+      options.sps = atoi(value); i++;
+    } else if (value && !strcmp(arg, "--seed")) {
+      options.grinder.seed = (uint32_t)atol(value); i++;
+    } else {
+      printf("usage: %s [--doses n] [--target g] [--dial n] [--flow g/s] [--flow-jitter r] [--noise g] [--spikes p]\n"
+             "          [--drift g/min] [--sps n] [--seed n] [--continuous] [--program name] [--switch-beans n [--single-bean]] [--trace] [--shared-core]\n"
+             "          [--session] [--swap ms] [--telemetry] [--broker-outage from,to] [--shots file] [--capture file] [--verbose]\n"
+             "       %s --replay file [--verbose]\n"
+             "       %s --bench-filters [--bench-trace file] [--seed n]\n"
+             "       %s --bench-buffer\n", argv[0], argv[0], argv[0], argv[0]);
+      return false;
+    }
+  }
+  options.grinder.pushButton = !options.continuous;
+  options.grinder.pin = GRINDER_ACTIVE_PIN;
+  return true;
+}
+
+// Print into a file, to capture what the firmware would send over serial
+class FilePrint : public Print {
+public:
+  explicit FilePrint(const char *path) : file(fopen(path, "w")) {}
+  ~FilePrint() { if (file) fclose(file); }
+  size_t write(uint8_t c) override { return file && fputc(c, file) != EOF ? 1 : 0; }
+
+private:
+  FILE *file;
+};
+
+// Every task on the acquisition core at priority 0 but Loadcell, to compare the
+// acquisition latency against the placement table
+static void useSharedCore() {
+  for (uint8_t task = 0; task < TASK_COUNT; task++) {
+    taskPlacement[task].core = ACQUISITION_CORE;
+    taskPlacement[task].priority = task == TASK_LOADCELL ? taskPlacement[task].priority : 0;
+  }
+}
+
+static bool waitFor(std::function<bool()> condition, uint64_t timeoutMs) {
+  return sim::runUntil(condition, timeoutMs * 1000);
+}
+
+// One detent at a time, the menu moves a single item per event
+static void turnSlowly(int detents) {
+  for (int i = 0; i < abs(detents); i++) {
+    sim::turnEncoder(detents > 0 ? 1 : -1);
+    sim::run(100 * 1000);
+  }
+}
+
+static void click() {
+  sim::clickEncoder();
+  sim::run(100 * 1000);
+}
+
+// What a user switching beans does: menu, "Beans", turn to the bean, back out
+// through "Exit"
+static void selectBean(uint8_t bean) {
+  const int beansItem = 7, exitItem = 5;
+  click();
+  turnSlowly(beansItem - menuItemsCount); // backwards past the first item
+  click();
+  turnSlowly((int)bean - activeBean);
+  click();
+  turnSlowly(exitItem - beansItem);
+  click();
+}
+
+// What a user starting a session does: menu, "Session", turn it on, back out
+// through "Exit"
+static void turnOnSession() {
+  const int sessionItem = 8, exitItem = 5;
+  click();
+  turnSlowly(sessionItem - menuItemsCount); // backwards past the first item
+  click();
+  turnSlowly(1);
+  click();
+  turnSlowly(exitItem - sessionItem);
+  click();
+}
+
+static const uint64_t baristaReactionMs = 700; // from "Grinding finished" to the cup coming off
+
+static DoseResult runDose(Grinder &grinder, double cupGrams, int swapMs) {
+  DoseResult result = {};
+  result.target = setWeight.toDouble();
+
+  uint32_t starts = grinder.startCommands();
+  grinder.placeCup(cupGrams);
+  if (!waitFor([] { return scaleStatus == STATUS_GRINDING_IN_PROGRESS; }, 5000)) {
+    result.failed = true;
+    return result;
+  }
+  grinder.watch((cupWeightEmpty + setWeight).toDouble());
+  uint64_t startedAt = sim::now();
+
+  // the first stop, later stages of the program may top up after it
+  waitFor([] { return scaleStatus != STATUS_GRINDING_IN_PROGRESS; }, MAX_GRINDING_TIME + 5000);
+  result.failed = scaleStatus == STATUS_GRINDING_IN_PROGRESS || scaleStatus == STATUS_GRINDING_FAILED;
+  uint64_t stoppedAt = grinder.lastStopCommandAt();
+
+  if (swapMs > 0) {
+    // a barista in a rush takes the cup a moment after the display says it is done
+    waitFor([] { return scaleStatus != STATUS_TOPPING_UP; }, MAX_GRINDING_TIME);
+    sim::run(baristaReactionMs * 1000);
+  } else {
+    // leave the cup long enough for the firmware to learn from the dose and top it up
+    sim::run(5000 * 1000);
+    waitFor([] { return scaleStatus != STATUS_TOPPING_UP; }, MAX_GRINDING_TIME);
+  }
+  result.failed = result.failed || scaleStatus == STATUS_GRINDING_FAILED;
+  result.seconds = (grinder.lastStopCommandAt() - startedAt) / 1e6;
+  result.bursts = grinder.startCommands() - starts - 1;
+  result.stopLeadMs = grinder.watchReachedAt() > 0 ? ((double)grinder.watchReachedAt() - stoppedAt) / 1e3 : NAN;
+  result.dosed = grinder.dosedGrams();
+  result.shown = (scaleWeight - cupWeightEmpty).toDouble();
+
+  if (result.failed) {
+    grinder.setLoad(GRINDING_FAILED_WEIGHT_TO_RESET + 50);
+    waitFor([] { return scaleStatus == STATUS_EMPTY; }, 5000);
+    grinder.setLoad(0);
+  } else if (swapMs > 0) {
+    grinder.removeCup(); // and the next cup goes on right after
+    sim::run((uint64_t)swapMs * 1000);
+    return result;
+  }
+  grinder.removeCup();
+  waitFor([] { return scaleStatus == STATUS_EMPTY && scaleWeight < 1; }, 5000);
+  sim::run(1500 * 1000);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  SimOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+  if (options.benchBuffer) {
+    return runBufferBench();
+  }
+  if (options.benchFilters) {
+    return runFilterBench(options.benchTrace, options.grinder.seed);
+  }
+  if (options.replayPath) {
+    return runReplay(options.replayPath, options.verbose);
+  }
+  sim::setSerialEcho(options.verbose);
+
+  // settings the firmware finds in flash on its first boot
+  Preferences preferences;
+  preferences.begin("scale", false);
+  preferences.putBool("grindMode", options.continuous);
+  if (options.target > 0) {
+    preferences.putShort("setWeightTenths", (int16_t)lround(options.target * 10));
+  }
+  preferences.end();
+
+  // --noise is for 10 SPS; the HX711 datasheet has 50 nV rms there and 90 nV at 80 SPS
+  options.grinder.sensorNoise *= pow(options.sps / 10.0, log(90.0 / 50) / log(8.0));
+  sim::setLoadCellRate(options.sps);
+
+  if (options.sharedCore) {
+    useSharedCore();
+  }
+  impulseProgram = (uint8_t)options.program;
+  Grinder grinder(options.grinder);
+  grinder.attach();
+  setupDisplayLoad();
+  setupScale();
+  FakeBroker broker;
+  broker.outages = options.brokerOutages;
+  if (options.telemetry) {
+    setupTelemetry(broker);
+  }
+  sim::run(3000 * 1000); // boot and tare
+  FilePrint *capture = nullptr;
+  if (options.capturePath) {
+    capture = new FilePrint(options.capturePath);
+    startCapture(*capture);
+  }
+
+  // adjust the target like a user would, one detent at a time
+  for (int i = 0; i < abs(options.dial); i++) {
+    sim::turnEncoder(options.dial > 0 ? 1 : -1);
+    sim::run(80 * 1000);
+  }
+
+  std::mt19937 random(options.grinder.seed);
+  std::normal_distribution<double> beans(0, options.flowJitter);
+  if (options.session) {
+    turnOnSession();
+  }
+  std::vector<DoseResult> results;
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t dosesStart = sim::now();
+
+  for (int i = 0; i < options.doses; i++) {
+    // the second bean is ground finer: slower and it clumps in the chute
+    int bean = options.switchBeans > 0 ? i / options.switchBeans % 2 : 0;
+    if (options.switchBeans > 0 && i % options.switchBeans == 0) {
+      grinder.setRetention(options.grinder.retentionMs * (bean ? 4 : 1));
+      if (!options.singleBean) {
+        selectBean(bean);
+      }
+      printf("bean %d (profile %d)\n", bean + 1, activeBean + 1);
+    }
+    grinder.setFlowRate(options.grinder.flowRate * (bean ? 0.7 : 1) * (1 + beans(random)));
+    DoseResult result = runDose(grinder, setCupWeight.toDouble(), options.swapMs);
+    results.push_back(result);
+    printf("dose %3d: %s %6.2f g (target %5.2f, error %+5.2f, shown %6.2f) in %5.2f s, stop lead %6.1f ms, offset %+5.2f",
+           i + 1, result.failed ? "FAILED" : "ok    ", result.dosed, result.target, result.dosed - result.target,
+           result.shown, result.seconds, result.stopLeadMs, offset.toDouble());
+    printf(result.bursts > 0 ? ", %d top-up bursts\n" : "\n", result.bursts);
+  }
+
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  double sum = 0, sumSquares = 0, sumAbs = 0, worst = 0, lead = 0, seconds = 0;
+  int ok = 0, reached = 0, bursts = 0, toppedUp = 0;
+  for (const DoseResult &result : results) {
+    if (result.failed) {
+      continue;
+    }
+    double error = result.dosed - result.target;
+    sum += error;
+    sumSquares += error * error;
+    sumAbs += fabs(error);
+    worst = fmax(worst, fabs(error));
+    seconds += result.seconds;
+    bursts += result.bursts;
+    toppedUp += result.bursts > 0;
+    if (!isnan(result.stopLeadMs)) {
+      lead += result.stopLeadMs;
+      reached++;
+    }
+    ok++;
+  }
+
+  printf("\n%d/%zu doses finished\n", ok, results.size());
+  if (ok > 0) {
+    double mean = sum / ok;
+    printf("error: mean %+.3f g, mean abs %.3f g, stddev %.3f g, worst %.3f g\n",
+           mean, sumAbs / ok, sqrt(fmax(0, sumSquares / ok - mean * mean)), worst);
+    printf("stop lead: mean %.1f ms before the target was reached (%d doses reached it)\n", reached ? lead / reached : 0, reached);
+    printf("grinding: mean %.2f s from start to the last stop, %d top-up bursts in %d doses\n", seconds / ok, bursts, toppedUp);
+  }
+  double minutes = (sim::now() - dosesStart) / 60e6;
+  printf("throughput: %.2f cups/min, %.1f s per cup\n", results.size() / minutes, minutes * 60 / results.size());
+  if (options.session) {
+    sim::setSerialEcho(true);
+    printSessionSummary(Serial);
+    sim::setSerialEcho(options.verbose);
+  }
+  if (capture) {
+    sim::run(2 * CAPTURE_DRAIN_MS * 1000); // what CaptureTask still has queued
+    stopCapture();
+    delete capture;
+  }
+  printf("nvs writes: %u, flash sector erases: %u\n", sim::nvsWrites(), sim::flashErases());
+  if (options.telemetry) {
+    sim::run((TELEMETRY_FLUSH_MS + 100) * 1000); // the last batch
+    TelemetryStats stats = telemetryStats();
+    printf("telemetry: %u events queued, %u published in %u batches, %u samples shed, %u dropped, %u connects\n",
+           stats.queued, stats.published, stats.batches, stats.shed, stats.dropped, stats.connects);
+    printf("broker: %u doses started, %u finished, %u failed, %u offsets, %u samples in %u payloads of up to %zu bytes\n",
+           broker.started, broker.finished, broker.failed, broker.offsets, broker.samples, broker.payloads, broker.largestPayload);
+  }
+  if (options.shotsPath) {
+    FilePrint shots(options.shotsPath);
+    exportShots(shots); // what 'h' sends over serial, for tools/shots_to_csv.py
+  }
+  if (options.trace) {
+    sim::setSerialEcho(true);
+    printLatencySummary(Serial); // covers the last doses the ring still holds
+    printTaskSummary(Serial);    // stack use of the host frames, only a rough guide for the ESP32
+  }
+  sim::forEachTask([](const char *name, int core, uint64_t busyUs) {
+    printf("cpu %-12s core %d %8.4f%%\n", name, core, 100.0 * busyUs / sim::now());
+  });
+  printf("simulated %.1f s in %.2f s wall time (%.0fx real time)\n",
+         sim::now() / 1e6, wallSeconds, sim::now() / 1e6 / fmax(wallSeconds, 1e-6));
+
+  sim::shutdown();
+  return ok == (int)results.size() ? 0 : 2;
+}
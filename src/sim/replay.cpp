@@ -0,0 +1,287 @@
+#include "replay.hpp"
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+#include "../scale.hpp"
+#include "../capture.hpp"
+#include "../settings.hpp"
+#include "display_load.hpp"
+
+namespace {
+
+const uint64_t preludeUs = 3000 * 1000;  // empty scale fed before the trace, for the boot tare
+const int64_t matchUs = 1000 * 1000;     // replayed start this close to a recorded one is the same dose
+const int64_t cupWindowUs = 500 * 1000;  // before the start, like cupWeightEmpty
+const int64_t flowWindowUs = 800 * 1000; // before the stop, like DosePredictor
+const int64_t settleFromUs = 1500 * 1000;
+const int64_t settleToUs = 2500 * 1000;
+const int64_t burstSettleFromUs = 800 * 1000; // the cup may be lifted once the last burst settled
+const int64_t burstSettleToUs = burstSettleFromUs + 1000 * 1000;
+
+// Unwraps the 32 bit timestamps of a record stream, which may step back a little
+// where the frames of two tasks crossed
+struct Unwrapper {
+  bool started = false;
+  int64_t last = 0;
+
+  int64_t operator()(uint32_t timestampUs) {
+    last = started ? last + (int32_t)(timestampUs - (uint32_t)last) : timestampUs;
+    started = true;
+    return last;
+  }
+};
+
+// Collects the grinder commands the replayed firmware captures
+class CommandLog : public Print {
+public:
+  size_t write(uint8_t c) override {
+    RawTraceRecord record;
+    if (decoder.push(c, record) && record.type == RAW_TRACE_GRINDER) {
+      commands.push_back({unwrap(record.timestampUs), record.value != 0});
+    }
+    return 1;
+  }
+
+  std::vector<RecordedTrace::Command> commands;
+
+private:
+  RawTraceDecoder decoder;
+  Unwrapper unwrap;
+};
+
+// Stop command following the start at index, -1 without one before the next start
+int64_t stopAfter(const std::vector<RecordedTrace::Command> &commands, size_t index) {
+  return index + 1 < commands.size() && !commands[index + 1].on ? commands[index + 1].us : -1;
+}
+
+double meanGrams(const RecordedTrace &trace, int64_t fromUs, int64_t toUs, size_t &count) {
+  double sum = 0;
+  count = 0;
+  for (const RecordedTrace::Sample &sample : trace.samples) {
+    if (sample.us >= fromUs && sample.us < toUs) {
+      sum += trace.gramsOf(sample.raw);
+      count++;
+    }
+  }
+  return count ? sum / count : NAN;
+}
+
+// A top-up burst starts with the dose already in the cup
+bool isBurst(const RecordedTrace &trace, size_t index) {
+  const RecordedTrace::Command &command = trace.grinder[index];
+  size_t samples;
+  double before = meanGrams(trace, command.us - cupWindowUs, command.us, samples);
+  return command.on && samples && before > trace.settings.cupWeightCg / 100.0 + CUP_DETECTION_TOLERANCE;
+}
+
+double flowBefore(const RecordedTrace &trace, int64_t us) {
+  double sumT = 0, sumW = 0, sumTT = 0, sumTW = 0;
+  size_t n = 0;
+  for (const RecordedTrace::Sample &sample : trace.samples) {
+    if (sample.us >= us - flowWindowUs && sample.us < us) {
+      double t = (sample.us - us) / 1e6;
+      double w = trace.gramsOf(sample.raw);
+      sumT += t;
+      sumW += w;
+      sumTT += t * t;
+      sumTW += t * w;
+      n++;
+    }
+  }
+  double denominator = n * sumTT - sumT * sumT;
+  return n >= 3 && denominator > 0 ? (n * sumTW - sumT * sumW) / denominator : NAN;
+}
+
+}
+
+double RecordedTrace::gramsOf(int32_t raw) const {
+  return (raw - settings.zeroCounts) * 100.0 / settings.calibrationHundredths;
+}
+
+bool loadRecordedTrace(const char *path, RecordedTrace &trace) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    printf("cannot open %s\n", path);
+    return false;
+  }
+  RawTraceDecoder decoder;
+  RawTraceRecord record;
+  Unwrapper unwrap;
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    if (!decoder.push((uint8_t)c, record)) {
+      continue;
+    }
+    int64_t us = unwrap(record.timestampUs);
+    if (record.type == RAW_TRACE_SETTINGS && !trace.hasSettings) {
+      trace.hasSettings = true;
+      trace.settings = record.settings;
+    } else if (record.type == RAW_TRACE_SAMPLE) {
+      trace.samples.push_back({us, record.value});
+    } else if (record.type == RAW_TRACE_GRINDER) {
+      trace.grinder.push_back({us, record.value != 0});
+    }
+  }
+  fclose(file);
+  trace.dropped = decoder.dropped();
+
+  if (trace.samples.empty()) {
+    printf("no load cell samples in %s\n", path);
+    return false;
+  }
+  if (!trace.hasSettings) {
+    // the settings frame got lost, carry on with the firmware defaults
+    printf("no settings in %s, assuming the defaults and an empty scale at the start\n", path);
+    trace.settings.sps = LOADCELL_SPS;
+    trace.settings.zeroCounts = trace.samples[0].raw;
+    trace.settings.calibrationHundredths = LOADCELL_SCALE_FACTOR * 100;
+    trace.settings.setWeightCg = COFFEE_DOSE_WEIGHT * 100;
+    trace.settings.cupWeightCg = CUP_WEIGHT * 100;
+    trace.settings.offsetCg = (int16_t)lround(COFFEE_DOSE_OFFSET * 100);
+    trace.settings.stopLatencyMs = (int16_t)lround(STOP_LATENCY_DEFAULT * 1000);
+    trace.settings.inFlightCg = (int16_t)lround(IN_FLIGHT_DEFAULT * 100);
+  }
+  return true;
+}
+
+int runReplay(const char *path, bool verbose) {
+  RecordedTrace trace;
+  if (!loadRecordedTrace(path, trace)) {
+    return 1;
+  }
+  const RawTraceSettings &settings = trace.settings;
+  if (settings.sps != LOADCELL_SPS) {
+    printf("trace was recorded at %u SPS, this build expects %d\n", settings.sps, LOADCELL_SPS);
+  }
+  printf("%zu samples over %.1f s, %zu grinder commands, %u corrupt frames\n",
+         trace.samples.size(), (trace.samples.back().us - trace.samples.front().us) / 1e6,
+         trace.grinder.size(), trace.dropped);
+  sim::setSerialEcho(verbose);
+
+  // what the firmware found in flash when the trace was recorded, in every bean
+  ScaleSettings stored = {};
+  stored.calibrationHundredths = settings.calibrationHundredths;
+  stored.scaleMode = settings.flags & RAW_TRACE_SCALE_MODE ? 1 : 0;
+  stored.grindMode = settings.flags & RAW_TRACE_CONTINUOUS ? 1 : 0;
+  for (BeanProfile &bean : stored.beans) {
+    bean.setWeightTenths = (int16_t)lround(settings.setWeightCg / 10.0);
+    bean.cupWeightTenths = (int16_t)lround(settings.cupWeightCg / 10.0);
+    bean.offsetHundredths = settings.offsetCg;
+    bean.stopLatencyMs = settings.stopLatencyMs;
+    bean.inFlightHundredths = settings.inFlightCg;
+  }
+  stored.checksum = calculateChecksum(stored);
+  Preferences preferences;
+  preferences.begin("scale", false);
+  preferences.putBytes("settings", &stored, sizeof(ScaleSettings));
+  preferences.end();
+  // the grind program it was recorded with
+  if (!(settings.flags & RAW_TRACE_TOP_UP)) {
+    impulseProgram = GRIND_PROGRAM_SINGLE;
+  } else {
+    impulseProgram = settings.flags & RAW_TRACE_BULK ? GRIND_PROGRAM_BULK : GRIND_PROGRAM_PULSE;
+  }
+
+  // the recording starts after the prelude, in virtual time
+  int64_t shift = (int64_t)preludeUs - trace.samples.front().us;
+  uint32_t periodUs = 1000000 / (settings.sps ? settings.sps : LOADCELL_SPS);
+  size_t next = 0;
+  sim::setLoadCellConversions([&](uint64_t &atUs, long &raw) {
+    if (atUs + periodUs < preludeUs) {
+      atUs += periodUs;
+      raw = settings.zeroCounts;
+      return true;
+    }
+    if (next >= trace.samples.size()) {
+      return false;
+    }
+    uint64_t recordedAt = (uint64_t)(trace.samples[next].us + shift);
+    atUs = recordedAt > atUs ? recordedAt : atUs + 1;
+    raw = trace.samples[next++].raw;
+    return true;
+  });
+
+  CommandLog replayed;
+  auto wallStart = std::chrono::steady_clock::now();
+  setupDisplayLoad();
+  setupScale();
+  startCapture(replayed);
+  sim::run((uint64_t)(trace.samples.back().us + shift) + settleToUs);
+  stopCapture();
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  double target = settings.setWeightCg / 100.0;
+  double latency = settings.stopLatencyMs / 1000.0;
+  double recordedErrors = 0, replayedErrors = 0;
+  int doses = 0, compared = 0, unmatched = 0, late = 0;
+  for (size_t i = 0; i < trace.grinder.size(); i++) {
+    if (!trace.grinder[i].on || isBurst(trace, i)) {
+      continue;
+    }
+    int64_t startUs = trace.grinder[i].us + shift;
+    int64_t stopUs = stopAfter(trace.grinder, i);
+    if (stopUs < 0) {
+      continue; // the recording ended while grinding
+    }
+    // the dose is weighed after its last burst, stops are compared without them
+    int64_t lastStopUs = stopUs;
+    for (size_t j = i + 2; j < trace.grinder.size() && isBurst(trace, j) && stopAfter(trace.grinder, j) >= 0; j += 2) {
+      lastStopUs = stopAfter(trace.grinder, j);
+    }
+    stopUs += shift;
+    doses++;
+
+    size_t cupSamples, settledSamples;
+    double cup = meanGrams(trace, startUs - shift - cupWindowUs, startUs - shift, cupSamples);
+    bool burst = lastStopUs != stopUs - shift;
+    double settled = meanGrams(trace, lastStopUs + (burst ? burstSettleFromUs : settleFromUs),
+                               lastStopUs + (burst ? burstSettleToUs : settleToUs), settledSamples);
+    double flow = flowBefore(trace, stopUs - shift);
+    double dosed = settled - cup;
+
+    int64_t replayStopUs = -1;
+    for (size_t j = 0; j < replayed.commands.size(); j++) {
+      if (replayed.commands[j].on && llabs(replayed.commands[j].us - startUs) < matchUs) {
+        replayStopUs = stopAfter(replayed.commands, j);
+        break;
+      }
+    }
+
+    printf("dose %3d: recorded %6.2f g (error %+5.2f)", doses, dosed, dosed - target);
+    if (!cupSamples || !settledSamples || isnan(flow)) {
+      printf(", not weighable\n");
+      continue;
+    }
+    if (replayStopUs < 0) {
+      printf(", replay did not grind this dose\n");
+      unmatched++;
+      continue;
+    }
+    double shiftSeconds = (replayStopUs - stopUs) / 1e6;
+    if (shiftSeconds > latency) {
+      printf(", replay stops %.0f ms later, not comparable\n", shiftSeconds * 1000);
+      late++;
+      continue;
+    }
+    double estimated = dosed + flow * shiftSeconds;
+    recordedErrors += fabs(dosed - target);
+    replayedErrors += fabs(estimated - target);
+    compared++;
+    printf(", replay stops %+6.1f ms later, estimated %6.2f g (error %+5.2f)\n", shiftSeconds * 1000, estimated, estimated - target);
+  }
+
+  printf("\n%d doses recorded, %d compared, %d not ground by the replay, %d stopped too late to compare\n",
+         doses, compared, unmatched, late);
+  if (compared > 0) {
+    printf("mean abs error of the compared doses: recorded %.3f g, replay %.3f g (estimated)\n",
+           recordedErrors / compared, replayedErrors / compared);
+  }
+  printf("replayed %.1f s in %.2f s wall time (%.0fx real time)\n",
+         sim::now() / 1e6, wallSeconds, sim::now() / 1e6 / fmax(wallSeconds, 1e-6));
+  sim::shutdown();
+  return 0;
+}
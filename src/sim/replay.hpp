@@ -0,0 +1,38 @@
+#pragma once
+
+#include <RawTrace.h>
+#include <stdint.h>
+#include <vector>
+
+// A raw load cell trace as captured with 'r' (see src/capture.hpp), with the
+// timestamps unwrapped to 64 bits
+struct RecordedTrace {
+  struct Sample {
+    int64_t us;
+    int32_t raw;
+  };
+  struct Command {
+    int64_t us;
+    bool on;
+  };
+
+  bool hasSettings = false;
+  RawTraceSettings settings = {};
+  std::vector<Sample> samples;
+  std::vector<Command> grinder;
+  uint32_t dropped = 0; // chunks that failed to decode
+
+  double gramsOf(int32_t raw) const;
+};
+
+bool loadRecordedTrace(const char *path, RecordedTrace &trace);
+
+// Feeds a recorded trace through the firmware in virtual time, with the settings
+// it was recorded with, and compares where the replay stops every dose with
+// where the recording did.
+//
+// The recording only has grounds up to its own stop, so a different stop can't
+// be weighed: the replayed dose is estimated from the recorded settled weight and
+// the flow at the stop. A stop later than the recorded one by more than the stop
+// latency sees the flow already ending and is reported as not comparable.
+int runReplay(const char *path, bool verbose);
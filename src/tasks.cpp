@@ -0,0 +1,51 @@
+#include "tasks.hpp"
+
+#ifdef ARDUINO_RUNNING_CORE
+static_assert(ARDUINO_RUNNING_CORE == ACQUISITION_CORE, "setup() has to attach the GPIO interrupts on the acquisition core");
+#endif
+
+// ScaleStatus sits above Scale so a decision isn't queued behind filtering. That
+// doesn't keep shared data consistent: ScaleStatus also wakes on deadlines and
+// encoder input, so it can preempt Scale half way through a push. Readers retry
+// on the sequence counter instead, see Seqlock.h and SharedMathBuffer. Stack
+// sizes are what the tasks were given before they were measured, check them with
+// 's' after a few doses and a trip through the menu.
+TaskPlacement taskPlacement[TASK_COUNT] = {
+  /* TASK_LOADCELL */     {"Loadcell",    ACQUISITION_CORE, 5, 4096},
+  /* TASK_SCALE */        {"Scale",       ACQUISITION_CORE, 3, 10000},
+  /* TASK_SCALE_STATUS */ {"ScaleStatus", ACQUISITION_CORE, 4, 10000},
+  /* TASK_DISPLAY */      {"Display",     UI_CORE,          1, 10000},
+  /* TASK_SETTINGS */     {"Settings",    UI_CORE,          1, 4096},
+  /* TASK_SHOT_LOG */     {"ShotLog",     UI_CORE,          1, 4096},
+  /* TASK_TELEMETRY */    {"Telemetry",   UI_CORE,          1, 6144},
+  /* TASK_CAPTURE */      {"Capture",     UI_CORE,          1, 4096},
+};
+
+TaskHandle_t taskHandles[TASK_COUNT] = {};
+
+void startTask(uint8_t task, TaskFunction_t function, TaskHandle_t *handle) {
+  const TaskPlacement &placement = taskPlacement[task];
+  xTaskCreatePinnedToCore(
+      function,             /* Function to implement the task */
+      placement.name,       /* Name of the task */
+      placement.stackBytes, /* Stack size in bytes */
+      NULL,                 /* Task input parameter */
+      placement.priority,   /* Priority of the task */
+      handle,               /* Task handle. */
+      placement.core);      /* Core where the task should run */
+  taskHandles[task] = *handle;
+}
+
+void printTaskSummary(Print &out) {
+  out.printf("%-12s %4s %4s %6s %6s\n", "task", "core", "prio", "stack", "free");
+  for (uint8_t task = 0; task < TASK_COUNT; task++) {
+    const TaskPlacement &placement = taskPlacement[task];
+    if (taskHandles[task] == NULL) {
+      out.printf("%-12s not running\n", placement.name);
+      continue;
+    }
+    UBaseType_t free = uxTaskGetStackHighWaterMark(taskHandles[task]);
+    out.printf("%-12s %4d %4u %6u %6u%s\n", placement.name, (int)placement.core, (unsigned)placement.priority,
+               (unsigned)placement.stackBytes, (unsigned)free, free < TASK_STACK_MARGIN ? "  low" : "");
+  }
+}
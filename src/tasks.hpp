@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Where the firmware tasks run, see taskPlacement in tasks.cpp.
+//
+// The acquisition core runs everything from the HX711 to the grinder relay, above
+// the Arduino loop task (priority 1), so nothing else there can delay a conversion
+// or a stop. Rendering and flash writes run on the UI core next to WiFi; flash
+// writes still halt both cores while the cache is off, wherever they are issued.
+//
+// GPIO interrupts are serviced on the core that attached the first one, which is
+// setup() on the loop task's core. That has to be the acquisition core: the DOUT
+// ISR starts every LatencyTrace sample and cycle counters are per core.
+#if CONFIG_FREERTOS_UNICORE
+#define ACQUISITION_CORE 0
+#define UI_CORE 0
+#else
+#define ACQUISITION_CORE 1
+#define UI_CORE 0
+#endif
+
+#define TASK_LOADCELL 0
+#define TASK_SCALE 1
+#define TASK_SCALE_STATUS 2
+#define TASK_DISPLAY 3
+#define TASK_SETTINGS 4
+#define TASK_SHOT_LOG 5
+#define TASK_TELEMETRY 6
+#define TASK_CAPTURE 7
+#define TASK_COUNT 8
+
+#define TASK_STACK_MARGIN 1024 // bytes a task should have left at its deepest
+
+struct TaskPlacement {
+  const char *name;
+  BaseType_t core;
+  UBaseType_t priority;
+  uint32_t stackBytes; // ESP-IDF counts stacks in bytes, not words
+};
+
+extern TaskPlacement taskPlacement[TASK_COUNT]; // the native build rearranges it for comparisons
+
+void startTask(uint8_t task, TaskFunction_t function, TaskHandle_t *handle); // where taskPlacement puts it
+void printTaskSummary(Print &out); // placement and stack high-water mark of every started task
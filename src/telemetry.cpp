@@ -0,0 +1,138 @@
+#include "telemetry.hpp"
+#include "tasks.hpp"
+#include <SpscQueue.h>
+
+TaskHandle_t TelemetryTask = NULL;
+TelemetryLink *telemetryLink = NULL; // set once TelemetryTask runs
+SpscQueue<TelemetryEvent, TELEMETRY_QUEUE_SIZE> telemetryQueue; // ScaleStatusTask to TelemetryTask
+TelemetryBatch<TELEMETRY_PAYLOAD_SIZE> telemetryBatch(TELEMETRY_SAMPLE_MS); // only touched by TelemetryTask
+
+// Each counter has a single writer, the task named
+volatile uint32_t telemetryQueued = 0; // ScaleStatusTask
+volatile uint32_t telemetryShed = 0; // ScaleStatusTask
+volatile uint32_t telemetryQueueFull = 0; // ScaleStatusTask
+volatile uint32_t telemetryDropped = 0; // TelemetryTask
+volatile uint32_t telemetryPublished = 0; // TelemetryTask
+volatile uint32_t telemetryBatches = 0; // TelemetryTask
+volatile uint32_t telemetryConnects = 0; // TelemetryTask
+
+uint32_t samplesSinceTelemetry = 0; // only touched by ScaleStatusTask
+bool offsetReported = false;
+Weight reportedOffset = 0;
+
+int32_t telemetryCentigrams(Weight weight) {
+  return (int32_t)(Weight::Wide(weight) * 100).round();
+}
+
+void queueTelemetry(const TelemetryEvent &event) {
+  if (telemetryLink == NULL) {
+    return;
+  }
+  if (event.type == TELEMETRY_SAMPLE && telemetryQueue.size() >= TELEMETRY_QUEUE_SIZE / 2) {
+    telemetryShed = telemetryShed + 1;
+  } else if (telemetryQueue.push(event)) {
+    telemetryQueued = telemetryQueued + 1;
+  } else {
+    telemetryQueueFull = telemetryQueueFull + 1;
+  }
+}
+
+void telemetrySample(int64_t timestampMs, Weight weight) {
+  if (TELEMETRY_SAMPLE_MS == 0 || ++samplesSinceTelemetry < samplesIn(TELEMETRY_SAMPLE_MS)) {
+    return;
+  }
+  samplesSinceTelemetry = 0;
+  queueTelemetry({(uint32_t)timestampMs, telemetryCentigrams(weight), 0, TELEMETRY_SAMPLE, activeBean, 0});
+}
+
+void telemetryOffset(int64_t timestampMs, Weight offset) {
+  if (offsetReported && offset == reportedOffset) {
+    return;
+  }
+  offsetReported = true;
+  reportedOffset = offset;
+  queueTelemetry({(uint32_t)timestampMs, telemetryCentigrams(offset), 0, TELEMETRY_OFFSET, activeBean, 0});
+}
+
+void telemetryDoseStarted(const ShotRecord &shot) {
+  uint8_t bean = (shot.flags & SHOT_BEAN_MASK) >> SHOT_BEAN_SHIFT;
+  queueTelemetry({shot.startedAtMs, shot.targetCg, shot.cupCg, TELEMETRY_DOSE_STARTED, bean, 0});
+}
+
+void telemetryDoseFinished(const ShotRecord &shot) {
+  uint8_t bean = (shot.flags & SHOT_BEAN_MASK) >> SHOT_BEAN_SHIFT;
+  uint8_t type = shot.flags & SHOT_FINISHED ? TELEMETRY_DOSE_FINISHED : TELEMETRY_DOSE_FAILED;
+  queueTelemetry({(uint32_t)millis(), shot.dosedCg, shot.grindMs, type, bean, shot.flags});
+}
+
+TelemetryStats telemetryStats() {
+  TelemetryStats stats;
+  stats.queued = telemetryQueued;
+  stats.shed = telemetryShed;
+  stats.dropped = telemetryQueueFull + telemetryDropped;
+  stats.published = telemetryPublished;
+  stats.batches = telemetryBatches;
+  stats.connects = telemetryConnects;
+  return stats;
+}
+
+void printTelemetrySummary(Print &out) {
+  if (telemetryLink == NULL) {
+    out.println("telemetry off");
+    return;
+  }
+  TelemetryStats stats = telemetryStats();
+  out.printf("telemetry %s: %u events queued, %u published in %u batches, %u samples shed, %u dropped, %u connects\n",
+             telemetryLink->connected() ? "connected" : "offline", (unsigned)stats.queued, (unsigned)stats.published,
+             (unsigned)stats.batches, (unsigned)stats.shed, (unsigned)stats.dropped, (unsigned)stats.connects);
+}
+
+// Publishes the batch, which is kept for the next try if that failed
+bool flushTelemetry() {
+  if (telemetryBatch.empty()) {
+    return true;
+  }
+  if (!telemetryLink->publish(TELEMETRY_TOPIC, telemetryBatch.payload(), telemetryBatch.length())) {
+    return false;
+  }
+  telemetryPublished = telemetryPublished + telemetryBatch.events();
+  telemetryBatches = telemetryBatches + 1;
+  telemetryBatch.clear();
+  return true;
+}
+
+void telemetryLoop(void *parameter) {
+  TelemetryLink &link = *telemetryLink;
+  unsigned long lastConnectAt = 0;
+  bool tried = false;
+  for (;;) {
+    delay(TELEMETRY_FLUSH_MS);
+    if (link.connected()) {
+      link.poll();
+    } else if (!tried || millis() - lastConnectAt >= TELEMETRY_RECONNECT_MS) {
+      tried = true;
+      lastConnectAt = millis();
+      if (link.connect()) {
+        telemetryConnects = telemetryConnects + 1;
+      }
+    }
+
+    bool online = link.connected();
+    TelemetryEvent event;
+    while (telemetryQueue.pop(event)) {
+      if (!online && event.type == TELEMETRY_SAMPLE) {
+        telemetryDropped = telemetryDropped + 1; // stale by the time the broker is back
+      } else if (!telemetryBatch.add(event) && !(online && flushTelemetry() && telemetryBatch.add(event))) {
+        telemetryDropped = telemetryDropped + 1;
+      }
+    }
+    if (online) {
+      flushTelemetry();
+    }
+  }
+}
+
+void setupTelemetry(TelemetryLink &link) {
+  telemetryLink = &link;
+  startTask(TASK_TELEMETRY, telemetryLoop, &TelemetryTask);
+}
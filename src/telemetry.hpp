@@ -0,0 +1,49 @@
+#pragma once
+
+#include "scale.hpp"
+#include <ShotLog.h>
+#include <TelemetryBatch.h>
+
+// Dose events, offset changes and decimated weight samples published in batches
+// (see TelemetryBatch for the payload). ScaleStatusTask only pushes events onto a
+// lock-free queue, TelemetryTask on the UI core batches them and talks to the
+// broker through a TelemetryLink, so a slow or unreachable broker never holds up
+// a dose. When the queue runs half full, samples are shed to keep room for dose
+// events; while the broker is unreachable samples are dropped and dose events
+// wait in the batch as long as it has room.
+#ifndef TELEMETRY_SAMPLE_MS
+#define TELEMETRY_SAMPLE_MS 200 // one weight sample per this, 0 sends none
+#endif
+#define TELEMETRY_QUEUE_SIZE 64 // events waiting for TelemetryTask, a power of two
+#define TELEMETRY_PAYLOAD_SIZE 512 // bytes per batch
+#define TELEMETRY_FLUSH_MS 2000 // between batches
+#define TELEMETRY_RECONNECT_MS 5000 // between connection attempts
+#define TELEMETRY_TOPIC "opengbw/telemetry"
+
+// The way to the broker. Only TelemetryTask calls it, so it may block.
+class TelemetryLink {
+public:
+  virtual bool connected() = 0;
+  virtual bool connect() = 0;
+  virtual bool publish(const char *topic, const char *payload, size_t length) = 0;
+  virtual void poll() {} // keepalive and incoming packets, while connected
+};
+
+struct TelemetryStats {
+  uint32_t queued; // events accepted from ScaleStatusTask
+  uint32_t shed; // samples not queued to keep room for dose events
+  uint32_t dropped; // events lost to a full queue or batch, or samples while offline
+  uint32_t published; // events the broker took
+  uint32_t batches;
+  uint32_t connects;
+};
+
+// ScaleStatusTask only
+void telemetrySample(int64_t timestampMs, Weight weight); // every sample, decimated here
+void telemetryOffset(int64_t timestampMs, Weight offset); // queued when it changed
+void telemetryDoseStarted(const ShotRecord &shot);
+void telemetryDoseFinished(const ShotRecord &shot); // finished or failed, as the flags tell
+
+TelemetryStats telemetryStats();
+void printTelemetrySummary(Print &out);
+void setupTelemetry(TelemetryLink &link);
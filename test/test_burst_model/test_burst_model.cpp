@@ -0,0 +1,62 @@
+#include <unity.h>
+#include <BurstModel.h>
+
+typedef BurstModel::Grams Grams;
+
+void setUp() {}
+void tearDown() {}
+
+void test_burst_is_dead_time_plus_missing_over_flow() {
+  BurstModel model(150, 50, 2000);
+  TEST_ASSERT_EQUAL_UINT32(400, model.burstMs(Grams(0.5), Grams(2)));
+}
+
+void test_burst_is_clamped() {
+  BurstModel model(150, 50, 2000);
+  TEST_ASSERT_EQUAL_UINT32(50, model.burstMs(Grams(-1), Grams(2))); // already over
+  TEST_ASSERT_EQUAL_UINT32(2000, model.burstMs(Grams(5), Grams(2)));
+}
+
+void test_burst_flow_has_a_floor() {
+  BurstModel model(150, 50, 2000);
+  TEST_ASSERT_EQUAL_UINT32(983, model.burstMs(Grams(0.25), Grams(0.125))); // at 0.3 g/s
+  TEST_ASSERT_EQUAL_UINT32(983, model.burstMs(Grams(0.25), Grams(0)));
+}
+
+void test_delivered_ignores_bursts_that_never_started() {
+  BurstModel model(150, 50, 2000);
+  model.delivered(500, Grams(0.5), Grams(0.125));
+  model.delivered(500, Grams(0), Grams(2));
+  TEST_ASSERT_EQUAL_UINT32(150, model.deadMs());
+}
+
+void test_dead_time_converges_to_the_measured_one() {
+  BurstModel model(150, 50, 2000);
+  // 375 ms delivering 0.25 g at 2 g/s lost 250 ms; until averageBursts the prior
+  // is one sample of a plain average
+  const uint32_t averages[3] = {200, 216, 225};
+  for (uint32_t expected : averages) {
+    model.delivered(375, Grams(0.25), Grams(2));
+    TEST_ASSERT_INT32_WITHIN(1, expected, model.deadMs());
+  }
+  for (int i = 0; i < 20; i++) {
+    model.delivered(375, Grams(0.25), Grams(2));
+  }
+  TEST_ASSERT_INT32_WITHIN(1, 250, model.deadMs());
+
+  // then a running average that follows wear
+  for (int i = 0; i < 20; i++) {
+    model.delivered(425, Grams(0.25), Grams(2));
+  }
+  TEST_ASSERT_INT32_WITHIN(1, 300, model.deadMs());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_is_dead_time_plus_missing_over_flow);
+  RUN_TEST(test_burst_is_clamped);
+  RUN_TEST(test_burst_flow_has_a_floor);
+  RUN_TEST(test_delivered_ignores_bursts_that_never_started);
+  RUN_TEST(test_dead_time_converges_to_the_measured_one);
+  return UNITY_END();
+}
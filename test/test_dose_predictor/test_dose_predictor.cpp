@@ -0,0 +1,102 @@
+#include <unity.h>
+#include <DosePredictor.h>
+
+typedef DosePredictor::Grams Grams;
+
+void setUp() {}
+void tearDown() {}
+
+// samples every 100 ms from 0 g, returns the newest timestamp
+int64_t ramp(DosePredictor &predictor, double gramsPerSecond, int samples) {
+  predictor.reset();
+  int64_t ms = 0;
+  for (int i = 0; i < samples; i++) {
+    ms = 1000 + i * 100;
+    predictor.addSample(ms, Grams(gramsPerSecond * i / 10));
+  }
+  return ms;
+}
+
+// 65 raw per ms, so the fit and flowOver are exact
+int64_t exactRamp(DosePredictor &predictor) {
+  predictor.reset();
+  int64_t ms = 0;
+  for (int i = 0; i < 20; i++) {
+    ms = i * 100;
+    predictor.addSample(ms, Grams::fromRaw((int32_t)(65 * ms)));
+  }
+  return ms;
+}
+
+void test_flow_fit_on_a_ramp() {
+  DosePredictor predictor(0.5, 0.3);
+  ramp(predictor, 2, 20);
+  TEST_ASSERT_TRUE(predictor.ready());
+  TEST_ASSERT_INT32_WITHIN(Grams(0.001).raw(), Grams(2).raw(), predictor.flowRate().raw());
+}
+
+void test_stop_at_rounds_towards_the_earlier_stop() {
+  DosePredictor predictor(0, 0);
+  int64_t last = exactRamp(predictor);
+  Grams now = Grams::fromRaw(65 * 1900);
+  TEST_ASSERT_EQUAL_INT32(65000, predictor.flowRate().raw());
+  TEST_ASSERT_EQUAL_INT32(last + 1, predictor.stopAt(now + Grams::fromRaw(100)));
+  TEST_ASSERT_EQUAL_INT32(last - 2, predictor.stopAt(now - Grams::fromRaw(100))); // -1.5 ms, not -1
+  TEST_ASSERT_EQUAL_INT32(last - 2, predictor.stopAt(now - Grams::fromRaw(130))); // exactly -2 ms
+}
+
+void test_not_ready_below_min_flow_rate() {
+  DosePredictor predictor(0.5, 0.3);
+  ramp(predictor, 2, 2);
+  TEST_ASSERT_FALSE(predictor.ready()); // too few samples
+  ramp(predictor, 0.2, 20);
+  TEST_ASSERT_FALSE(predictor.ready());
+  TEST_ASSERT_TRUE(predictor.stopAt(Grams(18)) == INT64_MAX);
+  ramp(predictor, 0.4, 20);
+  TEST_ASSERT_TRUE(predictor.ready());
+}
+
+void test_learn_rejects_a_large_error() {
+  DosePredictor predictor(0.5, 0.3);
+  int64_t last = ramp(predictor, 2, 20);
+  TEST_ASSERT_FALSE(predictor.learn(Grams(5), 0.5)); // no stop yet
+
+  Grams weight = predictor.predictFinal(last) - Grams(1.3); // what the ramp reached at last
+  predictor.stopped(last);
+  TEST_ASSERT_FALSE(predictor.learn(weight + Grams(1.3 + 1), 0.5));
+  TEST_ASSERT_TRUE(predictor.latency() == 0.5);
+  TEST_ASSERT_TRUE(predictor.inFlight() == 0.3);
+
+  predictor.stopped(last);
+  TEST_ASSERT_TRUE(predictor.learn(weight + Grams(1.3 + 0.2), 0.5));
+  TEST_ASSERT_TRUE(predictor.inFlight() + 2 * predictor.latency() > 1.3);
+}
+
+void test_covariance_stays_positive_definite_at_one_flow_rate() {
+  DosePredictor predictor(0.5, 0.3);
+  for (int dose = 0; dose < 5000; dose++) {
+    int64_t last = ramp(predictor, 2, 20);
+    Grams weight = predictor.predictFinal(last) - Grams(predictor.inFlight() + 2 * predictor.latency());
+    predictor.stopped(last);
+    double noise = dose % 2 ? 0.02 : -0.02;
+    TEST_ASSERT_TRUE(predictor.learn(weight + Grams(0.4 + 2 * 0.6 + noise), 1));
+
+    DosePredictor::Model model = predictor.learned();
+    double determinant = model.covariance[0][0] * model.covariance[1][1] - model.covariance[0][1] * model.covariance[1][0];
+    TEST_ASSERT_TRUE(model.covariance[0][0] > 0 && model.covariance[0][0] <= 0.25 + 1e-12); // the prior bounds it
+    TEST_ASSERT_TRUE(model.covariance[1][1] > 0 && model.covariance[1][1] <= 0.04 + 1e-12);
+    TEST_ASSERT_TRUE(determinant > 0);
+  }
+  // only the overshoot at this flow rate is observable, and it was learned
+  TEST_ASSERT_INT32_WITHIN(Grams(0.02).raw(), Grams(1.6).raw(), Grams(predictor.inFlight() + 2 * predictor.latency()).raw());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_flow_fit_on_a_ramp);
+  RUN_TEST(test_stop_at_rounds_towards_the_earlier_stop);
+  RUN_TEST(test_not_ready_below_min_flow_rate);
+  RUN_TEST(test_learn_rejects_a_large_error);
+  RUN_TEST(test_covariance_stays_positive_definite_at_one_flow_rate);
+  return UNITY_END();
+}
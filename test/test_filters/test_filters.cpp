@@ -0,0 +1,250 @@
+#include <unity.h>
+#include <FixedPoint.h>
+#include <WeightFilters.h>
+
+typedef Fixed<16> Weight;
+
+void setUp() {}
+void tearDown() {}
+
+void test_median_rejects_a_single_spike() {
+  MedianFilter<Weight, 3> median;
+  median.reset(10);
+  Weight out[] = {median.update(10), median.update(50), median.update(10), median.update(-30), median.update(10)};
+  for (Weight w : out) {
+    TEST_ASSERT_EQUAL_INT32(Weight(10).raw(), w.raw());
+  }
+}
+
+void test_median_follows_a_step_after_half_the_window() {
+  MedianFilter<Weight, 5> median;
+  median.reset(0);
+  for (int i = 0; i < 4; i++) {
+    median.update(0);
+  }
+  TEST_ASSERT_EQUAL_INT32(0, median.update(20).raw());
+  TEST_ASSERT_EQUAL_INT32(0, median.update(20).raw());
+  TEST_ASSERT_EQUAL_INT32(Weight(20).raw(), median.update(20).raw());
+}
+
+void test_median_reset_forgets_the_window() {
+  MedianFilter<Weight, 3> median;
+  for (int i = 0; i < 3; i++) {
+    median.update(10);
+  }
+  median.reset(0);
+  TEST_ASSERT_EQUAL_INT32(0, median.update(0).raw()); // {10, 10, 0} would give 10
+}
+
+void test_moving_average_reaches_a_step_after_n_samples() {
+  MovingAverage<Weight, 4> average;
+  average.reset(0);
+  for (int i = 0; i < 3; i++) {
+    average.update(0);
+  }
+  TEST_ASSERT_EQUAL_INT32(Weight(2).raw(), average.update(8).raw());
+  TEST_ASSERT_EQUAL_INT32(Weight(4).raw(), average.update(8).raw());
+  TEST_ASSERT_EQUAL_INT32(Weight(6).raw(), average.update(8).raw());
+  TEST_ASSERT_EQUAL_INT32(Weight(8).raw(), average.update(8).raw());
+}
+
+void test_moving_average_sum_does_not_drift() {
+  MovingAverage<Weight, 4> average;
+  Weight value(0.1);
+  Weight out;
+  for (int i = 0; i < 100000; i++) {
+    out = average.update(value);
+  }
+  TEST_ASSERT_EQUAL_INT32(value.raw(), out.raw());
+}
+
+void test_moving_average_reset_averages_from_the_value() {
+  MovingAverage<Weight, 4> average;
+  for (int i = 0; i < 4; i++) {
+    average.update(100);
+  }
+  average.reset(2);
+  TEST_ASSERT_EQUAL_INT32(Weight(3).raw(), average.update(4).raw()); // (2 + 4) / 2, the 100s are gone
+}
+
+AdaptiveKalmanFilter<Weight> makeKalman() {
+  return AdaptiveKalmanFilter<Weight>(Weight(0.03), Weight(0.0005), 4, 1);
+}
+
+void test_kalman_averages_noise_at_rest() {
+  AdaptiveKalmanFilter<Weight> kalman = makeKalman();
+  kalman.reset(10);
+  Weight out;
+  for (int i = 0; i < 100; i++) {
+    out = kalman.update(Weight(i % 2 ? 10.03 : 9.97));
+  }
+  TEST_ASSERT_INT32_WITHIN(Weight(0.01).raw(), Weight(10).raw(), out.raw());
+}
+
+void test_kalman_jumps_to_a_step() {
+  AdaptiveKalmanFilter<Weight> kalman = makeKalman();
+  kalman.reset(0);
+  for (int i = 0; i < 50; i++) {
+    kalman.update(0);
+  }
+  Weight out = kalman.update(18);
+  TEST_ASSERT_INT32_WITHIN(Weight(0.1).raw(), Weight(18).raw(), out.raw());
+}
+
+void test_kalman_follows_a_ramp() {
+  AdaptiveKalmanFilter<Weight> kalman = makeKalman();
+  kalman.reset(0);
+  Weight out;
+  for (int i = 0; i <= 100; i++) {
+    out = kalman.update(Weight(i) / 10); // 1 g/s at 10 SPS
+  }
+  TEST_ASSERT_INT32_WITHIN(Weight(0.3).raw(), Weight(10).raw(), out.raw());
+}
+
+void test_kalman_reset_restarts_at_the_value() {
+  AdaptiveKalmanFilter<Weight> kalman = makeKalman();
+  for (int i = 0; i < 20; i++) {
+    kalman.update(50);
+  }
+  kalman.reset(3);
+  TEST_ASSERT_EQUAL_INT32(Weight(3).raw(), kalman.update(3).raw());
+}
+
+typedef FilterChain<MedianFilter<Weight, 3>, MovingAverage<Weight, 2>> Chain;
+
+Chain makeChain() {
+  return Chain(MedianFilter<Weight, 3>(), MovingAverage<Weight, 2>());
+}
+
+void test_chain_runs_the_stages_in_order() {
+  Chain chain = makeChain();
+  chain.reset(10);
+  chain.update(10);
+  TEST_ASSERT_EQUAL_INT32(Weight(10).raw(), chain.update(90).raw()); // the median took the spike out before the average
+  TEST_ASSERT_EQUAL_INT32(Weight(10).raw(), chain.update(10).raw());
+}
+
+void test_chain_reset_resets_every_stage() {
+  Chain chain = makeChain();
+  for (int i = 0; i < 5; i++) {
+    chain.update(40);
+  }
+  chain.reset(0);
+  TEST_ASSERT_EQUAL_INT32(0, chain.update(0).raw());
+  TEST_ASSERT_EQUAL_INT32(0, chain.stage<1>().update(0).raw());
+}
+
+// a tare window at 10 SPS
+typedef StabilityDetector<Weight, 5> TareDetector;
+
+bool stableWith(const Weight (&window)[5], Weight &mean) {
+  TareDetector detector{Weight(0.03)};
+  for (Weight w : window) {
+    detector.update(w);
+  }
+  return detector.stable(mean);
+}
+
+void test_stability_leaves_out_one_spike() {
+  Weight mean;
+  const Weight window[5] = {Weight(0.01), Weight(-0.01), Weight(3), Weight(0.01), Weight(-0.01)};
+  TEST_ASSERT_TRUE(stableWith(window, mean));
+  TEST_ASSERT_INT32_WITHIN(Weight(0.01).raw(), 0, mean.raw());
+}
+
+void test_stability_rejects_two_spikes() {
+  Weight mean;
+  const Weight window[5] = {Weight(0.01), Weight(3), Weight(0.01), Weight(-3), Weight(-0.01)};
+  TEST_ASSERT_FALSE(stableWith(window, mean));
+}
+
+void test_stability_rejects_drift() {
+  Weight mean;
+  const Weight window[5] = {Weight(0), Weight(0.03), Weight(0.06), Weight(0.09), Weight(0.12)};
+  TEST_ASSERT_FALSE(stableWith(window, mean));
+}
+
+typedef SettleDetector<Weight, 8> Settle;
+
+Settle makeSettle() { return Settle(Weight(0.015), Weight(0.03), 1000, 200, 3000); }
+
+// within the filtered noise at rest
+Weight jitter(int64_t ms) {
+  const Weight pattern[4] = {Weight(0.01), Weight(-0.01), Weight(0.015), Weight(-0.015)};
+  return pattern[(ms / 100) % 4];
+}
+
+Weight slowRamp(int64_t ms) { return Weight(18) + Weight(0.05 * ms / 1000); }
+Weight plateau(int64_t ms) { return Weight(18) + jitter(ms); }
+Weight lateGrounds(int64_t ms) { return Weight(17.5) + (ms >= 1600 ? Weight(0.5) : Weight(0)) + jitter(ms); }
+Weight lateRise(int64_t ms) {
+  Weight landed = ms < 900 ? Weight(0) : ms < 1100 ? Weight(0.1 * (ms - 800) / 100) : Weight(0.3);
+  return Weight(18) + landed + jitter(ms);
+}
+
+// ms after the stop when it first settled, -1 if not within untilMs
+int64_t settleAfter(Settle &settle, int64_t stopMs, Weight (*weightAt)(int64_t), int64_t untilMs, Weight &weight) {
+  settle.stopped(stopMs);
+  for (int64_t ms = 0; ms <= untilMs; ms += 100) {
+    settle.update(stopMs + ms, weightAt(ms));
+    if (settle.settled(stopMs + ms, weight)) {
+      return ms;
+    }
+  }
+  return -1;
+}
+
+void test_settle_never_on_a_ramp() {
+  Settle settle = makeSettle();
+  Weight weight;
+  TEST_ASSERT_TRUE(settleAfter(settle, 0, slowRamp, 10000, weight) == -1);
+}
+
+void test_settle_waits_for_the_learned_tail() {
+  Settle settle = makeSettle();
+  Weight weight;
+  settle.stopped(0);
+  for (int64_t ms = 0; ms <= 2500; ms += 100) {
+    settle.update(ms, lateGrounds(ms));
+  }
+  settle.learnTail();
+  TEST_ASSERT_TRUE(settle.tailMs() == 1150); // a quarter of the way to 1600
+
+  TEST_ASSERT_TRUE(settleAfter(settle, 10000, plateau, 5000, weight) == 1200);
+  TEST_ASSERT_INT32_WITHIN(Weight(0.01).raw(), Weight(18).raw(), weight.raw());
+  settle.learnTail();
+  TEST_ASSERT_TRUE(settle.tailMs() == 1150); // nothing landed to time
+}
+
+void test_settle_restarts_after_a_late_rise() {
+  Settle settle = makeSettle();
+  Weight weight;
+  int64_t settledMs = settleAfter(settle, 0, lateRise, 5000, weight);
+  TEST_ASSERT_TRUE(settledMs >= 1100 + 700); // a whole window after the rise
+  TEST_ASSERT_INT32_WITHIN(Weight(0.01).raw(), Weight(18.3).raw(), weight.raw());
+  settle.learnTail();
+  TEST_ASSERT_TRUE(settle.tailMs() == 1025); // the last rise was 1100 ms after the stop
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_median_rejects_a_single_spike);
+  RUN_TEST(test_median_follows_a_step_after_half_the_window);
+  RUN_TEST(test_median_reset_forgets_the_window);
+  RUN_TEST(test_moving_average_reaches_a_step_after_n_samples);
+  RUN_TEST(test_moving_average_sum_does_not_drift);
+  RUN_TEST(test_moving_average_reset_averages_from_the_value);
+  RUN_TEST(test_kalman_averages_noise_at_rest);
+  RUN_TEST(test_kalman_jumps_to_a_step);
+  RUN_TEST(test_kalman_follows_a_ramp);
+  RUN_TEST(test_kalman_reset_restarts_at_the_value);
+  RUN_TEST(test_chain_runs_the_stages_in_order);
+  RUN_TEST(test_chain_reset_resets_every_stage);
+  RUN_TEST(test_stability_leaves_out_one_spike);
+  RUN_TEST(test_stability_rejects_two_spikes);
+  RUN_TEST(test_stability_rejects_drift);
+  RUN_TEST(test_settle_never_on_a_ramp);
+  RUN_TEST(test_settle_waits_for_the_learned_tail);
+  RUN_TEST(test_settle_restarts_after_a_late_rise);
+  return UNITY_END();
+}
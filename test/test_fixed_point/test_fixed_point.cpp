@@ -0,0 +1,76 @@
+#include <unity.h>
+#include <FixedPoint.h>
+
+typedef Fixed<16> Weight;
+
+static_assert(std::is_convertible<Weight, Weight::Wide>::value, "widening is implicit");
+static_assert(!std::is_convertible<Weight::Wide, Weight>::value, "narrowing is explicit");
+static_assert(std::is_constructible<Weight, Weight::Wide>::value, "narrowing is explicit");
+
+void setUp() {}
+void tearDown() {}
+
+void test_double_rounds_half_away_from_zero() {
+  const double lsb = 1.0 / 65536;
+  TEST_ASSERT_EQUAL_INT32(1, Weight(0.5 * lsb).raw());
+  TEST_ASSERT_EQUAL_INT32(-1, Weight(-0.5 * lsb).raw());
+  TEST_ASSERT_EQUAL_INT32(-1, Weight(-1.4 * lsb).raw());
+  TEST_ASSERT_EQUAL_INT32(-2, Weight(-1.6 * lsb).raw());
+  TEST_ASSERT_EQUAL_INT32(-163840, Weight(-2.5).raw());
+  TEST_ASSERT_EQUAL_INT32(-6554, Weight(-0.1).raw()); // -6553.6
+}
+
+void test_round_to_nearest_integer() {
+  TEST_ASSERT_EQUAL_INT32(3, Weight(2.5).round());
+  TEST_ASSERT_EQUAL_INT32(-3, Weight(-2.5).round());
+  TEST_ASSERT_EQUAL_INT32(-2, Weight(-2.4).round());
+  TEST_ASSERT_EQUAL_INT32(-1, Weight(-0.5).round());
+  TEST_ASSERT_EQUAL_INT32(0, Weight::fromRaw(-32767).round());
+  TEST_ASSERT_EQUAL_INT32(-1, Weight::fromRaw(-32768).round());
+  TEST_ASSERT_TRUE(Weight::Wide(-2.5).round() == -3);
+}
+
+void test_widening_and_narrowing_keep_the_value() {
+  Weight weight(-3.25);
+  Weight::Wide wide = weight;
+  TEST_ASSERT_TRUE(wide.raw() == weight.raw());
+  TEST_ASSERT_EQUAL_INT32(weight.raw(), Weight(wide).raw());
+
+  // sums of many weights fit Wide, and what comes back from an average fits again
+  Weight::Wide sum = 0;
+  for (int i = 0; i < 1000; i++) {
+    sum += Weight(1000.5);
+  }
+  TEST_ASSERT_TRUE(sum.raw() == (int64_t)1000 * Weight(1000.5).raw());
+  TEST_ASSERT_EQUAL_INT32(Weight(1000.5).raw(), Weight(sum / (int64_t)1000).raw());
+  TEST_ASSERT_TRUE((Weight::Wide(Weight(-2.345)) * 100).round() == -235); // centigrams as in the logs
+}
+
+// the HX711 spans 2^23 counts, about 1141 g at the default 7351 counts/g; products
+// and quotients are within one raw unit of the exact result of the stored values
+void test_mul_div_at_the_load_cell_range() {
+  const double weights[] = {-1141.1, -18.3, -0.37, 0.0001, 3.2, 18.02, 1141.1};
+  const double factors[] = {-2.5, 0.0137, 0.6, 1.0037, 2.5, 28.7};
+  for (double w : weights) {
+    for (double f : factors) {
+      Weight a(w), b(f);
+      double product = a.toDouble() * b.toDouble();
+      if (product > -32767 && product < 32767) {
+        TEST_ASSERT_INT32_WITHIN(1, Weight(product).raw(), (a * b).raw());
+      }
+      double quotient = a.toDouble() / b.toDouble();
+      if (quotient > -32767 && quotient < 32767) {
+        TEST_ASSERT_INT32_WITHIN(1, Weight(quotient).raw(), (a / b).raw());
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_double_rounds_half_away_from_zero);
+  RUN_TEST(test_round_to_nearest_integer);
+  RUN_TEST(test_widening_and_narrowing_keep_the_value);
+  RUN_TEST(test_mul_div_at_the_load_cell_range);
+  return UNITY_END();
+}
@@ -0,0 +1,88 @@
+#include <unity.h>
+#include <MathBuffer.h>
+
+void setUp() {}
+void tearDown() {}
+
+// what the binary search has to agree with
+template<typename B> size_t countLinearly(const B &buffer, int64_t cutoffMs) {
+  size_t n = 0;
+  for (auto sample : buffer.samples()) {
+    n += sample.timestampMs >= cutoffMs;
+  }
+  return n;
+}
+
+void test_cutoff_includes_a_sample_at_it() {
+  MathBuffer<int32_t, 8> buffer;
+  for (int i = 0; i < 5; i++) {
+    buffer.push(i, 1000 + i * 100);
+  }
+  TEST_ASSERT_EQUAL_INT(5, buffer.countSamplesSince(0));
+  TEST_ASSERT_EQUAL_INT(5, buffer.countSamplesSince(1000));
+  TEST_ASSERT_EQUAL_INT(4, buffer.countSamplesSince(1001));
+  TEST_ASSERT_EQUAL_INT(2, buffer.countSamplesSince(1300));
+  TEST_ASSERT_EQUAL_INT(1, buffer.countSamplesSince(1400));
+  TEST_ASSERT_EQUAL_INT(0, buffer.countSamplesSince(1401));
+}
+
+void test_cutoff_after_the_ring_wrapped() {
+  MathBuffer<int32_t, 16> buffer;
+  int64_t ms = 0;
+  for (int i = 0; i < 53; i++) {
+    ms += 1 + i % 7; // uneven spacing, some equal gaps
+    buffer.push(i, ms);
+    for (int64_t cutoff = ms - 120; cutoff <= ms + 1; cutoff++) {
+      TEST_ASSERT_EQUAL_INT(countLinearly(buffer, cutoff), buffer.countSamplesSince(cutoff));
+    }
+  }
+}
+
+void test_queries_cover_the_samples_since_the_cutoff() {
+  MathBuffer<int32_t, 8> buffer;
+  int32_t values[] = {5, -3, 9, 2, 7, 4, 1, 8, 6, 0}; // two wrap around
+  for (int i = 0; i < 10; i++) {
+    buffer.push(values[i], i * 10);
+  }
+  // since 50 ms: 4, 1, 8, 6, 0
+  TEST_ASSERT_EQUAL_INT32(3, buffer.averageSince(50));
+  TEST_ASSERT_EQUAL_INT32(8, buffer.maxSince(50));
+  TEST_ASSERT_EQUAL_INT32(0, buffer.minSince(50));
+  TEST_ASSERT_EQUAL_INT32(7, buffer.firstValueOlderThan(50));
+  int32_t newest[5];
+  size_t i = 0;
+  size_t visited = buffer.forEachSince(50, [&newest, &i](int32_t value, int64_t) { newest[i++ % 5] = value; });
+  TEST_ASSERT_EQUAL_INT(5, visited);
+  TEST_ASSERT_EQUAL_INT32(0, newest[0]); // newest first
+  TEST_ASSERT_EQUAL_INT32(4, newest[4]);
+}
+
+void test_cutoff_across_a_rebase() {
+  MathBuffer<int32_t, 8> buffer;
+  int64_t start = 1000;
+  int64_t later = start + (int64_t)UINT32_MAX + 5000; // past what a 32 bit offset from the first sample holds
+  buffer.push(1, start);
+  buffer.push(2, later);
+  buffer.push(3, later + 100);
+  TEST_ASSERT_EQUAL_INT(2, buffer.countSamplesSince(later));
+  TEST_ASSERT_EQUAL_INT(1, buffer.countSamplesSince(later + 1));
+  TEST_ASSERT_EQUAL_INT(0, buffer.countSamplesSince(later + 101));
+  TEST_ASSERT_EQUAL_INT32(2, buffer.firstValueOlderThan(later + 1));
+}
+
+void test_empty_buffer_has_nothing_since_any_cutoff() {
+  MathBuffer<int32_t, 8> buffer;
+  TEST_ASSERT_EQUAL_INT(0, buffer.countSamplesSince(0));
+  TEST_ASSERT_EQUAL_INT32(0, buffer.averageSince(0));
+  TEST_ASSERT_EQUAL_INT32(0, buffer.firstValueOlderThan(0));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_cutoff_includes_a_sample_at_it);
+  RUN_TEST(test_cutoff_after_the_ring_wrapped);
+  RUN_TEST(test_queries_cover_the_samples_since_the_cutoff);
+  RUN_TEST(test_cutoff_across_a_rebase);
+  RUN_TEST(test_empty_buffer_has_nothing_since_any_cutoff);
+  return UNITY_END();
+}
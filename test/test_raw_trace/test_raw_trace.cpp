@@ -0,0 +1,98 @@
+#include <unity.h>
+#include <RawTrace.h>
+#include <string.h>
+
+void setUp() {}
+void tearDown() {}
+
+// feeds bytes to decoder, returns how many records came out into records
+size_t decodeAll(RawTraceDecoder &decoder, const uint8_t *bytes, size_t length, RawTraceRecord *records, size_t capacity) {
+  size_t decoded = 0;
+  for (size_t i = 0; i < length; i++) {
+    RawTraceRecord record;
+    if (decoder.push(bytes[i], record) && decoded < capacity) {
+      records[decoded++] = record;
+    }
+  }
+  return decoded;
+}
+
+RawTraceRecord sample(uint32_t timestampUs, int32_t value) {
+  RawTraceRecord record = {};
+  record.type = RAW_TRACE_SAMPLE;
+  record.timestampUs = timestampUs;
+  record.value = value;
+  return record;
+}
+
+void test_frames_have_no_zero_inside() {
+  uint8_t frame[RawTrace::maxFrame];
+  size_t length = RawTrace::encode(sample(0, 0), frame); // all zero payload
+  TEST_ASSERT_EQUAL_INT(0, frame[0]);
+  TEST_ASSERT_EQUAL_INT(0, frame[length - 1]);
+  for (size_t i = 1; i + 1 < length; i++) {
+    TEST_ASSERT_TRUE(frame[i] != 0);
+  }
+  TEST_ASSERT_EQUAL_INT(12, length); // a sample takes 12 bytes on the wire
+}
+
+void test_records_round_trip() {
+  RawTraceRecord in[4] = {sample(0, 0), sample(0xFFFFFFFF, -8388608), sample(0x01000100, 8388607), {}};
+  in[3].type = RAW_TRACE_SETTINGS;
+  in[3].timestampUs = 123456;
+  in[3].settings = {80, RAW_TRACE_TOP_UP | RAW_TRACE_BULK, -84213, 735100, 1800, 0, -250, 480, -3};
+  uint8_t stream[4 * RawTrace::maxFrame];
+  size_t length = 0;
+  for (const RawTraceRecord &record : in) {
+    length += RawTrace::encode(record, stream + length);
+  }
+  RawTraceDecoder decoder;
+  RawTraceRecord out[4];
+  TEST_ASSERT_EQUAL_INT(4, decodeAll(decoder, stream, length, out, 4));
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL_INT(RAW_TRACE_SAMPLE, out[i].type);
+    TEST_ASSERT_EQUAL_UINT32(in[i].timestampUs, out[i].timestampUs);
+    TEST_ASSERT_EQUAL_INT32(in[i].value, out[i].value);
+  }
+  TEST_ASSERT_EQUAL_INT(RAW_TRACE_SETTINGS, out[3].type);
+  TEST_ASSERT_EQUAL_MEMORY(&in[3].settings, &out[3].settings, sizeof(RawTraceSettings));
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.dropped());
+}
+
+void test_text_between_frames_is_dropped() {
+  uint8_t stream[2 * RawTrace::maxFrame + 32];
+  size_t length = RawTrace::encode(sample(1000, 42), stream);
+  const char *text = "Taring scale\n";
+  memcpy(stream + length, text, strlen(text));
+  length += strlen(text);
+  length += RawTrace::encode(sample(2000, -42), stream + length);
+
+  RawTraceDecoder decoder;
+  RawTraceRecord out[2];
+  TEST_ASSERT_EQUAL_INT(2, decodeAll(decoder, stream, length, out, 2));
+  TEST_ASSERT_EQUAL_INT32(42, out[0].value);
+  TEST_ASSERT_EQUAL_INT32(-42, out[1].value);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.dropped());
+}
+
+void test_a_corrupted_frame_fails_its_checksum() {
+  uint8_t stream[2 * RawTrace::maxFrame];
+  size_t first = RawTrace::encode(sample(1000, 4242), stream);
+  size_t length = first + RawTrace::encode(sample(2000, 17), stream + first);
+  stream[first / 2] ^= 0x10; // stays nonzero, so only the checksum can tell
+
+  RawTraceDecoder decoder;
+  RawTraceRecord out[2];
+  TEST_ASSERT_EQUAL_INT(1, decodeAll(decoder, stream, length, out, 2));
+  TEST_ASSERT_EQUAL_INT32(17, out[0].value);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.dropped());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_have_no_zero_inside);
+  RUN_TEST(test_records_round_trip);
+  RUN_TEST(test_text_between_frames_is_dropped);
+  RUN_TEST(test_a_corrupted_frame_fails_its_checksum);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+#include <unity.h>
+#include <Seqlock.h>
+#include <MathBuffer.h>
+#include <atomic>
+#include <thread>
+
+void setUp() {}
+void tearDown() {}
+
+// not a multiple of 4 bytes, every field the same when not torn, and long enough
+// that a writer often lands in the middle of a copy
+struct Snapshot {
+  int32_t a;
+  int64_t b;
+  int32_t more[16];
+  uint8_t c;
+  int16_t d;
+};
+
+Snapshot snapshotOf(int32_t n) {
+  Snapshot snapshot = {n, n, {}, (uint8_t)n, (int16_t)n};
+  for (int32_t &m : snapshot.more) {
+    m = n;
+  }
+  return snapshot;
+}
+
+bool torn(const Snapshot &snapshot) {
+  for (int32_t m : snapshot.more) {
+    if (m != snapshot.a) {
+      return true;
+    }
+  }
+  return snapshot.b != snapshot.a || snapshot.c != (uint8_t)snapshot.a || snapshot.d != (int16_t)snapshot.a;
+}
+
+void test_read_returns_what_was_published() {
+  Seqlock<Snapshot> lock;
+  lock.publish(snapshotOf(-7));
+  Snapshot read = lock.read();
+  TEST_ASSERT_EQUAL_INT32(-7, read.a);
+  TEST_ASSERT_EQUAL_INT32(-7, (int32_t)read.b);
+  TEST_ASSERT_EQUAL_INT((uint8_t)-7, read.c);
+  TEST_ASSERT_EQUAL_INT(-7, read.d);
+}
+
+void test_a_read_overlapping_a_write_runs_again() {
+  SequenceCounter counter;
+  int value = 1;
+  int runs = 0;
+  int read = counter.read([&] {
+    int seen = value;
+    if (runs++ == 0) { // the writer preempts the first run
+      counter.beginWrite();
+      value = 2;
+      counter.endWrite();
+    }
+    return seen;
+  });
+  TEST_ASSERT_EQUAL_INT(2, runs);
+  TEST_ASSERT_EQUAL_INT(2, read);
+}
+
+void test_shared_buffer_query_overlapping_a_push_runs_again() {
+  typedef SharedMathBuffer<int32_t, 8> Shared;
+  Shared shared;
+  shared.push(1, 0);
+  int runs = 0;
+  size_t count = shared.read([&](const Shared::Buffer &buffer) {
+    size_t seen = buffer.countSamplesSince(0);
+    if (runs++ == 0) {
+      shared.push(2, 10);
+    }
+    return seen;
+  });
+  TEST_ASSERT_EQUAL_INT(2, runs);
+  TEST_ASSERT_EQUAL_INT(2, count);
+}
+
+void test_concurrent_reads_are_never_torn() {
+  Seqlock<Snapshot> lock;
+  lock.publish(snapshotOf(0));
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (int32_t n = 1; n <= 200000; n++) {
+      lock.publish(snapshotOf(n));
+    }
+    done = true;
+  });
+  int tornReads = 0;
+  int32_t last = 0;
+  bool backwards = false;
+  while (!done) {
+    Snapshot read = lock.read();
+    tornReads += torn(read);
+    backwards |= read.a < last;
+    last = read.a;
+  }
+  writer.join();
+  TEST_ASSERT_EQUAL_INT(0, tornReads);
+  TEST_ASSERT_FALSE(backwards);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_read_returns_what_was_published);
+  RUN_TEST(test_a_read_overlapping_a_write_runs_again);
+  RUN_TEST(test_shared_buffer_query_overlapping_a_push_runs_again);
+  RUN_TEST(test_concurrent_reads_are_never_torn);
+  return UNITY_END();
+}
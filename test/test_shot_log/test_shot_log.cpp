@@ -0,0 +1,116 @@
+#include <unity.h>
+#include <ShotLog.h>
+
+// the RAM backed "shots" partition of lib/NativeHal
+#define LABEL "shots"
+
+void setUp() {
+  sim::flashErase();
+}
+
+void tearDown() {}
+
+bool appendDose(ShotLog &log, int16_t dosedCg) {
+  ShotRecord record = {};
+  record.dosedCg = dosedCg;
+  record.flags = SHOT_FINISHED;
+  return log.append(record);
+}
+
+// sequences of the intact records, oldest first, have to count up by one
+bool contiguous(const ShotLog &log, uint32_t &first, uint32_t &last) {
+  bool ok = true;
+  bool any = false;
+  log.forEach([&](const ShotRecord &record) {
+    ok &= !any || record.sequence == last + 1;
+    first = any ? first : record.sequence;
+    last = record.sequence;
+    any = true;
+  });
+  return ok && any;
+}
+
+void test_appends_read_back_oldest_first() {
+  ShotLog log;
+  TEST_ASSERT_TRUE(log.begin(LABEL));
+  TEST_ASSERT_EQUAL_INT(0, log.count());
+  for (int i = 0; i < 100; i++) {
+    TEST_ASSERT_TRUE(appendDose(log, 1800 + i));
+  }
+  TEST_ASSERT_EQUAL_INT(100, log.count());
+  int16_t expected = 1800;
+  log.forEach([&expected](const ShotRecord &record) {
+    TEST_ASSERT_EQUAL_INT(expected, record.dosedCg);
+    TEST_ASSERT_EQUAL_UINT32(expected - 1800, record.sequence);
+    expected++;
+  });
+}
+
+void test_a_full_log_drops_its_oldest_sector() {
+  ShotLog log;
+  TEST_ASSERT_TRUE(log.begin(LABEL));
+  size_t appended = log.capacity() + ShotLog::recordsPerSector / 2;
+  for (size_t i = 0; i < appended; i++) {
+    TEST_ASSERT_TRUE(appendDose(log, (int16_t)(i % 3000)));
+  }
+  // the newest sector is half full, the one it replaced was the oldest
+  TEST_ASSERT_EQUAL_INT(log.capacity() - ShotLog::recordsPerSector / 2, log.count());
+  uint32_t first = 0, last = 0;
+  TEST_ASSERT_TRUE(contiguous(log, first, last));
+  TEST_ASSERT_EQUAL_UINT32(appended - 1, last);
+  TEST_ASSERT_EQUAL_UINT32(appended - log.count(), first);
+}
+
+void test_a_restart_continues_after_the_wrap() {
+  size_t appended;
+  {
+    ShotLog log;
+    TEST_ASSERT_TRUE(log.begin(LABEL));
+    appended = log.capacity() + 5;
+    for (size_t i = 0; i < appended; i++) {
+      appendDose(log, 1);
+    }
+  }
+  ShotLog log;
+  TEST_ASSERT_TRUE(log.begin(LABEL));
+  TEST_ASSERT_TRUE(appendDose(log, 2));
+  uint32_t first = 0, last = 0;
+  TEST_ASSERT_TRUE(contiguous(log, first, last));
+  TEST_ASSERT_EQUAL_UINT32(appended, last);
+  uint16_t boot = 0;
+  log.forEach([&boot](const ShotRecord &record) { boot = record.boot; });
+  TEST_ASSERT_EQUAL_INT(1, boot);
+}
+
+void test_an_interrupted_write_is_skipped() {
+  {
+    ShotLog log;
+    TEST_ASSERT_TRUE(log.begin(LABEL));
+    for (int i = 0; i < 3; i++) {
+      appendDose(log, 1);
+    }
+  }
+  // half of a fourth record made it to the flash before the power went
+  const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, LABEL);
+  uint8_t half[sizeof(ShotRecord) / 2] = {};
+  size_t slot = sizeof(ShotLog::SectorHeader) + 3 * sizeof(ShotRecord);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_write(partition, slot, half, sizeof(half)));
+
+  ShotLog log;
+  TEST_ASSERT_TRUE(log.begin(LABEL));
+  TEST_ASSERT_EQUAL_INT(3, log.count());
+  TEST_ASSERT_TRUE(appendDose(log, 2));
+  TEST_ASSERT_EQUAL_INT(4, log.count());
+  uint32_t first = 0, last = 0;
+  TEST_ASSERT_TRUE(contiguous(log, first, last));
+  TEST_ASSERT_EQUAL_UINT32(3, last);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_appends_read_back_oldest_first);
+  RUN_TEST(test_a_full_log_drops_its_oldest_sector);
+  RUN_TEST(test_a_restart_continues_after_the_wrap);
+  RUN_TEST(test_an_interrupted_write_is_skipped);
+  return UNITY_END();
+}
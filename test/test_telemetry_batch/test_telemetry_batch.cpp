@@ -0,0 +1,59 @@
+#include <unity.h>
+#include <TelemetryBatch.h>
+
+void setUp() {}
+void tearDown() {}
+
+TelemetryEvent weightAt(uint32_t ms, int32_t cg) {
+  return {ms, cg, 0, TELEMETRY_SAMPLE, 0, 0};
+}
+
+void test_samples_at_the_interval_share_a_line() {
+  TelemetryBatch<256> batch(100);
+  TEST_ASSERT_TRUE(batch.add(weightAt(1000, 0)));
+  TEST_ASSERT_TRUE(batch.add(weightAt(1100, 12)));
+  TEST_ASSERT_TRUE(batch.add(weightAt(1195, -3))); // jitter within half an interval
+  TEST_ASSERT_EQUAL_STRING("w 1000 100 0 12 -3", batch.payload());
+  TEST_ASSERT_EQUAL_INT(3, batch.events());
+}
+
+void test_a_gap_or_an_event_starts_a_new_line() {
+  TelemetryBatch<256> batch(100);
+  batch.add(weightAt(1000, 5));
+  batch.add(weightAt(1400, 6)); // samples were lost
+  batch.add({1450, 1800, 7000, TELEMETRY_DOSE_STARTED, 2, 0});
+  batch.add(weightAt(1500, 7));
+  batch.add({9000, 1803, 8123, TELEMETRY_DOSE_FINISHED, 2, 0x05});
+  batch.add({9001, -250, 0, TELEMETRY_OFFSET, 2, 0});
+  TEST_ASSERT_EQUAL_STRING("w 1000 100 5\nw 1400 100 6\ns 1450 2 1800 7000\nw 1500 100 7\nf 9000 2 1803 8123 5\no 9001 2 -250",
+                           batch.payload());
+  TEST_ASSERT_EQUAL_INT(strlen(batch.payload()), batch.length());
+}
+
+void test_an_event_that_does_not_fit_leaves_the_batch_as_it_was() {
+  TelemetryBatch<64> batch(100);
+  size_t added = 0;
+  while (batch.add(weightAt(1000 + 100 * added, -12345))) {
+    added++;
+  }
+  TEST_ASSERT_TRUE(added > 0);
+  TEST_ASSERT_TRUE(batch.length() < 64);
+  TEST_ASSERT_EQUAL_INT(added, batch.events());
+  char before[64];
+  strcpy(before, batch.payload());
+  TEST_ASSERT_FALSE(batch.add({9000, 1803, 8123, TELEMETRY_DOSE_FAILED, 1, 0}));
+  TEST_ASSERT_EQUAL_STRING(before, batch.payload());
+
+  batch.clear();
+  TEST_ASSERT_TRUE(batch.empty());
+  TEST_ASSERT_TRUE(batch.add(weightAt(50000, 1))); // a new line after clear, not a continuation
+  TEST_ASSERT_EQUAL_STRING("w 50000 100 1", batch.payload());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_samples_at_the_interval_share_a_line);
+  RUN_TEST(test_a_gap_or_an_event_starts_a_new_line);
+  RUN_TEST(test_an_event_that_does_not_fit_leaves_the_batch_as_it_was);
+  return UNITY_END();
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+"""Record a raw load cell trace from the scale for the native --replay.
+
+    python3 tools/capture_raw.py /dev/ttyUSB0 trace.bin
+
+Sends 'r' to start the capture and again on Ctrl-C to stop it. The file is the
+byte stream as received, frames and any text the firmware printed in between;
+the decoder in lib/RawTrace skips the text.
+"""
+import argparse
+import sys
+import time
+
+import serial  # pyserial
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('port')
+    parser.add_argument('output')
+    parser.add_argument('--seconds', type=float, help='stop after this long instead of on Ctrl-C')
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, 115200, timeout=0.2) as device, open(args.output, 'wb') as output:
+        device.reset_input_buffer()
+        device.write(b'r')
+        started = time.monotonic()
+        received = 0
+        try:
+            while args.seconds is None or time.monotonic() - started < args.seconds:
+                data = device.read(4096)
+                output.write(data)
+                received += len(data)
+                print(f'\r{received} bytes', end='', file=sys.stderr)
+        except KeyboardInterrupt:
+            pass
+        device.write(b'r')
+        output.write(device.read(4096))  # frames still on their way
+        print(file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
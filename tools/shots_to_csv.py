@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Decode the shot log the firmware sends for the 'h' serial command into CSV.
+
+    python3 tools/shots_to_csv.py capture.txt > shots.csv
+    python3 tools/shots_to_csv.py --port /dev/ttyUSB0 > shots.csv
+
+The record layout is ShotRecord in lib/ShotLog/src/ShotLog.h.
+"""
+import argparse
+import binascii
+import csv
+import struct
+import sys
+
+RECORD = struct.Struct('<IHHIhhhhHhhhBBH32h')
+CHECKSUM = slice(6, 8)
+
+FLAGS = {
+    0x01: 'finished',
+    0x02: 'predicted',
+    0x04: 'settled',
+    0x08: 'scale',
+    0x10: 'continuous',
+    0x80: 'topped-up',
+}
+BEAN_SHIFT = 5
+BEAN_MASK = 0x60
+
+
+def serial_lines(port):
+    import serial  # pyserial, only needed to read from the device directly
+
+    with serial.Serial(port, 115200, timeout=5) as device:
+        device.reset_input_buffer()
+        device.write(b'h')
+        while True:
+            line = device.readline()
+            if not line:
+                raise SystemExit('timed out waiting for the shot log')
+            line = line.decode('ascii', 'replace')
+            yield line
+            if line.startswith('#end'):
+                return
+
+
+def records(lines):
+    for line in lines:
+        if not line.startswith('#shot '):
+            continue
+        data = bytes.fromhex(line[6:].strip())
+        if len(data) != RECORD.size:
+            print(f'skipping record of {len(data)} bytes', file=sys.stderr)
+            continue
+        if binascii.crc_hqx(data[:CHECKSUM.start] + data[CHECKSUM.stop:], 0xFFFF) != RECORD.unpack(data)[2]:
+            print('skipping record with a bad checksum', file=sys.stderr)
+            continue
+        yield RECORD.unpack(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', nargs='?', help='serial capture, stdin if omitted')
+    parser.add_argument('--port', help='read the log from the scale on this serial port')
+    args = parser.parse_args()
+
+    if args.port:
+        lines = serial_lines(args.port)
+    elif args.capture:
+        lines = open(args.capture, encoding='ascii', errors='replace')
+    else:
+        lines = sys.stdin
+
+    out = csv.writer(sys.stdout)
+    out.writerow(['sequence', 'boot', 'started_ms', 'target_g', 'dosed_g', 'error_g', 'offset_g', 'cup_g',
+                  'grind_ms', 'flow_gps', 'latency_ms', 'inflight_g', 'bean', 'flags', 'curve_interval_ms', 'curve_g'])
+    for (sequence, boot, _, started, target, dosed, offset, cup, grind, flow, latency, inflight, flags,
+         points, interval, *curve) in records(lines):
+        out.writerow([
+            sequence, boot, started,
+            target / 100, dosed / 100, (dosed - target) / 100, offset / 100, cup / 100,
+            grind, flow / 100, latency, inflight / 100, ((flags & BEAN_MASK) >> BEAN_SHIFT) + 1,
+            ' '.join(name for bit, name in FLAGS.items() if flags & bit),
+            interval, ' '.join(str(point / 100) for point in curve[:points]),
+        ])
+
+
+if __name__ == '__main__':
+    main()